@@ -0,0 +1,163 @@
+#include <string.h>
+#include "mikado-cache.h"
+
+/* Unused entries looked at from the least recent end for each eviction. */
+#define MIKADO_CACHE_SAMPLE 8
+
+static void entry_free(MikadoCache *cache, MikadoCacheEntry *entry)
+{
+    guint i;
+    for (i = 0; i < entry->n_outputs; i++)
+        if (entry->outputs[i] && cache->free_output)
+            cache->free_output(entry->outputs[i]);
+    g_free(entry->outputs);
+    g_free(entry);
+}
+
+static void unused_remove(MikadoCache *cache, MikadoCacheEntry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->first = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->last = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void unused_prepend(MikadoCache *cache, MikadoCacheEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->first;
+    if (cache->first)
+        cache->first->prev = entry;
+    else
+        cache->last = entry;
+    cache->first = entry;
+}
+
+static void entry_drop(MikadoCache *cache, MikadoCacheEntry *entry)
+{
+    unused_remove(cache, entry);
+    g_hash_table_remove(cache->entries, &entry->key);
+    cache->bytes -= entry->bytes;
+    entry_free(cache, entry);
+}
+
+/* Of the few least recently used entries, the one that took the least
+ * time per byte goes first. */
+static void evict(MikadoCache *cache)
+{
+    while (cache->bytes > cache->budget && cache->last)
+    {
+        MikadoCacheEntry *victim = cache->last;
+        MikadoCacheEntry *entry = victim->prev;
+        guint i;
+
+        for (i = 1; entry && i < MIKADO_CACHE_SAMPLE; i++, entry = entry->prev)
+            if (entry->cost * (gdouble) MAX(victim->bytes, 1) < victim->cost * (gdouble) MAX(entry->bytes, 1))
+                victim = entry;
+        entry_drop(cache, victim);
+        cache->evictions++;
+    }
+}
+
+void mikado_cache_init(MikadoCache *cache, GDestroyNotify free_output)
+{
+    memset(cache, 0, sizeof(MikadoCache));
+    g_mutex_init(&cache->lock);
+    cache->entries = g_hash_table_new(g_int64_hash, g_int64_equal);
+    cache->free_output = free_output;
+}
+
+/* Pinned entries are freed too, no element may use them afterwards. */
+void mikado_cache_clear(MikadoCache *cache)
+{
+    GHashTableIter iter;
+    gpointer entry;
+
+    g_hash_table_iter_init(&iter, cache->entries);
+    while (g_hash_table_iter_next(&iter, NULL, &entry))
+        entry_free(cache, entry);
+    g_hash_table_destroy(cache->entries);
+    g_mutex_clear(&cache->lock);
+}
+
+void mikado_cache_set_budget(MikadoCache *cache, gsize budget)
+{
+    g_mutex_lock(&cache->lock);
+    cache->budget = budget;
+    evict(cache);
+    g_mutex_unlock(&cache->lock);
+}
+
+/* Returns the entry of a key, pinned, NULL when there is none. */
+MikadoCacheEntry *mikado_cache_lookup(MikadoCache *cache, guint64 key)
+{
+    MikadoCacheEntry *entry;
+
+    g_mutex_lock(&cache->lock);
+    entry = g_hash_table_lookup(cache->entries, &key);
+    if (entry)
+    {
+        if (entry->users++ == 0)
+            unused_remove(cache, entry);
+        cache->hits++;
+    }
+    else
+        cache->misses++;
+    g_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+/* Takes the outputs over and returns their entry, pinned. */
+MikadoCacheEntry *mikado_cache_insert(MikadoCache *cache, guint64 key, gpointer *outputs, guint n_outputs,
+    gsize bytes, gint64 cost)
+{
+    MikadoCacheEntry *entry = g_new0(MikadoCacheEntry, 1);
+    MikadoCacheEntry *old;
+
+    entry->key = key;
+    entry->outputs = outputs;
+    entry->n_outputs = n_outputs;
+    entry->bytes = bytes;
+    entry->cost = cost;
+    entry->users = 1;
+
+    g_mutex_lock(&cache->lock);
+    old = g_hash_table_lookup(cache->entries, &key);
+    if (old && old->users == 0)
+        entry_drop(cache, old);
+    else if (old)
+        g_hash_table_remove(cache->entries, &key); /* left to its users */
+    g_hash_table_insert(cache->entries, &entry->key, entry);
+    cache->bytes += bytes;
+    g_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+/* Unpins an entry. Entries nobody can ask for again, like the ones of a
+ * removed element, are not kept. */
+void mikado_cache_release(MikadoCache *cache, MikadoCacheEntry *entry, gboolean keep)
+{
+    g_mutex_lock(&cache->lock);
+    if (--entry->users == 0)
+    {
+        if (g_hash_table_lookup(cache->entries, &entry->key) != entry)
+        {
+            cache->bytes -= entry->bytes;
+            entry_free(cache, entry);
+        }
+        else
+        {
+            unused_prepend(cache, entry);
+            if (! keep)
+                entry_drop(cache, entry);
+            else
+                evict(cache);
+        }
+    }
+    g_mutex_unlock(&cache->lock);
+}
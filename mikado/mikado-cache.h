@@ -0,0 +1,50 @@
+#ifndef __MIKADO_CACHE_H__
+#define __MIKADO_CACHE_H__
+
+#include <glib.h>
+
+/*
+ * The outputs of elements, by a key standing for everything they were
+ * computed from. An entry in use by an element is pinned; the others
+ * stay around within a byte budget, for when the same key comes back,
+ * and are evicted among the least recently used, cheapest to compute
+ * per byte first. Every function takes the lock, workers share the
+ * cache.
+ */
+typedef struct _MikadoCacheEntry MikadoCacheEntry;
+
+struct _MikadoCacheEntry
+{
+    guint64 key;
+    gpointer *outputs;
+    guint n_outputs;
+    gsize bytes;
+    gint64 cost; /* microseconds the outputs took to compute */
+    guint users;
+    MikadoCacheEntry *prev; /* unused entries, most recent first */
+    MikadoCacheEntry *next;
+};
+
+typedef struct _MikadoCache
+{
+    GMutex lock;
+    GHashTable *entries;
+    MikadoCacheEntry *first;
+    MikadoCacheEntry *last;
+    GDestroyNotify free_output;
+    gsize budget;
+    gsize bytes;
+    guint64 hits;
+    guint64 misses;
+    guint64 evictions;
+} MikadoCache;
+
+void mikado_cache_init(MikadoCache *cache, GDestroyNotify free_output);
+void mikado_cache_clear(MikadoCache *cache);
+void mikado_cache_set_budget(MikadoCache *cache, gsize budget);
+MikadoCacheEntry *mikado_cache_lookup(MikadoCache *cache, guint64 key);
+MikadoCacheEntry *mikado_cache_insert(MikadoCache *cache, guint64 key, gpointer *outputs, guint n_outputs,
+    gsize bytes, gint64 cost);
+void mikado_cache_release(MikadoCache *cache, MikadoCacheEntry *entry, gboolean keep);
+
+#endif // __MIKADO_CACHE_H__
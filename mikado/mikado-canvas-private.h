@@ -0,0 +1,94 @@
+#ifndef __MIKADO_CANVAS_PRIVATE_H__
+#define __MIKADO_CANVAS_PRIVATE_H__
+
+#include "mikado-canvas.h"
+#include "mikado-history.h"
+#include "mikado-pool.h"
+
+/* The records behind the handles, shared with the rest of the library. */
+
+typedef struct _MikadoElementSlot
+{
+    MikadoPoolItem item;
+    MikadoPad first_source; /* pads in order, linked through their next field */
+    MikadoPad last_source;
+    MikadoPad first_sink;
+    MikadoPad last_sink;
+    guint sources;
+    guint sinks;
+    MikadoAttribute first_attribute;
+    gdouble x;
+    gdouble y;
+    gchar *label;
+    gboolean selected;
+} MikadoElementSlot;
+
+typedef struct _MikadoPadSlot
+{
+    MikadoPoolItem item;
+    MikadoElement element;
+    gboolean is_source;
+    guint index; /* among the sources, or the sinks, of its element */
+    MikadoPad next;
+    MikadoConnection first_connection;
+    guint connections;
+} MikadoPadSlot;
+
+/* A connection is in the list of its source and in the one of its sink. */
+typedef struct _MikadoConnectionSlot
+{
+    MikadoPoolItem item;
+    MikadoPad source;
+    MikadoPad sink;
+    MikadoConnection next_from;
+    MikadoConnection prev_from;
+    MikadoConnection next_to;
+    MikadoConnection prev_to;
+} MikadoConnectionSlot;
+
+typedef struct _MikadoAttributeSlot
+{
+    MikadoPoolItem item;
+    MikadoElement element;
+    const gchar *name; /* interned */
+    gdouble value;
+    MikadoAttribute next;
+} MikadoAttributeSlot;
+
+/* What listeners are told about, along with the element concerned. */
+typedef enum
+{
+    MIKADO_CHANGE_ELEMENT_ADDED,
+    MIKADO_CHANGE_ELEMENT_REMOVED, /* the handle is no longer valid */
+    MIKADO_CHANGE_PADS, /* a pad was added to the element */
+    MIKADO_CHANGE_CONNECTION, /* a sink of the element was connected or disconnected */
+    MIKADO_CHANGE_ATTRIBUTE /* an attribute of the element changed value */
+} MikadoChange;
+
+typedef void (*MikadoChangeFunc) (MikadoCanvas *canvas, MikadoChange change, MikadoElement element, gpointer data);
+
+struct _MikadoCanvas
+{
+    MikadoPool elements;
+    MikadoPool pads;
+    MikadoPool connections;
+    MikadoPool attributes;
+    guint labels; /* elements with a label, which has to be freed */
+    gdouble zoom;
+    GSList *listeners;
+    MikadoHistory *history; /* NULL unless enabled */
+};
+
+void mikado_canvas_add_listener(MikadoCanvas *canvas, MikadoChangeFunc func, gpointer data);
+void mikado_canvas_remove_listener(MikadoCanvas *canvas, MikadoChangeFunc func, gpointer data);
+
+#define mikado_canvas_element(canvas, handle) \
+    ((MikadoElementSlot *) mikado_pool_get(&(canvas)->elements, (handle)))
+#define mikado_canvas_pad(canvas, handle) \
+    ((MikadoPadSlot *) mikado_pool_get(&(canvas)->pads, (handle)))
+#define mikado_canvas_connection(canvas, handle) \
+    ((MikadoConnectionSlot *) mikado_pool_get(&(canvas)->connections, (handle)))
+#define mikado_canvas_attribute(canvas, handle) \
+    ((MikadoAttributeSlot *) mikado_pool_get(&(canvas)->attributes, (handle)))
+
+#endif // __MIKADO_CANVAS_PRIVATE_H__
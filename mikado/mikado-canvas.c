@@ -0,0 +1,909 @@
+#include <string.h>
+#include "mikado-canvas-private.h"
+
+typedef struct _MikadoListener
+{
+    MikadoChangeFunc func;
+    gpointer data;
+} MikadoListener;
+
+void mikado_canvas_add_listener(MikadoCanvas *canvas, MikadoChangeFunc func, gpointer data)
+{
+    MikadoListener *listener = g_new(MikadoListener, 1);
+    listener->func = func;
+    listener->data = data;
+    canvas->listeners = g_slist_append(canvas->listeners, listener);
+}
+
+void mikado_canvas_remove_listener(MikadoCanvas *canvas, MikadoChangeFunc func, gpointer data)
+{
+    GSList *item;
+    for (item = canvas->listeners; item; item = item->next)
+    {
+        MikadoListener *listener = item->data;
+        if (listener->func == func && listener->data == data)
+        {
+            canvas->listeners = g_slist_delete_link(canvas->listeners, item);
+            g_free(listener);
+            return;
+        }
+    }
+}
+
+static void notify(MikadoCanvas *canvas, MikadoChange change, MikadoElement element)
+{
+    GSList *item;
+    for (item = canvas->listeners; item; item = item->next)
+    {
+        MikadoListener *listener = item->data;
+        listener->func(canvas, change, element, listener->data);
+    }
+}
+
+/* The operation to describe a change in, a scratch one when there is no
+ * history. */
+static MikadoOp *record(MikadoCanvas *canvas, MikadoOpType type, gint handle, MikadoOp *scratch)
+{
+    if (canvas->history)
+        return mikado_history_push(canvas->history, type, handle);
+    memset(scratch, 0, sizeof(MikadoOp));
+    scratch->type = type;
+    scratch->handle = handle;
+    return scratch;
+}
+
+MikadoCanvas *mikado_canvas_new(void)
+{
+    MikadoCanvas *canvas = g_new0(MikadoCanvas, 1);
+    mikado_pool_init(&canvas->elements, sizeof(MikadoElementSlot));
+    mikado_pool_init(&canvas->pads, sizeof(MikadoPadSlot));
+    mikado_pool_init(&canvas->connections, sizeof(MikadoConnectionSlot));
+    mikado_pool_init(&canvas->attributes, sizeof(MikadoAttributeSlot));
+    canvas->zoom = 1.0;
+    return canvas;
+}
+
+/* Everything goes at once with the pools, only labels are freed one by
+ * one. */
+void mikado_canvas_free(MikadoCanvas *canvas)
+{
+    guint slot;
+    for (slot = 1; canvas->labels && slot < canvas->elements.slots; slot++)
+    {
+        MikadoElementSlot *element = mikado_pool_slot(&canvas->elements, slot);
+        if (element->item.live && element->label)
+        {
+            g_free(element->label);
+            canvas->labels--;
+        }
+    }
+    mikado_pool_clear(&canvas->elements);
+    mikado_pool_clear(&canvas->pads);
+    mikado_pool_clear(&canvas->connections);
+    mikado_pool_clear(&canvas->attributes);
+    mikado_canvas_set_history_enabled(canvas, FALSE);
+    g_slist_free_full(canvas->listeners, g_free);
+    g_free(canvas);
+}
+
+MikadoElement mikado_canvas_add_element(MikadoCanvas *canvas)
+{
+    MikadoElement element = mikado_pool_alloc(&canvas->elements);
+    MikadoOp scratch;
+
+    if (! element)
+        return 0;
+    record(canvas, MIKADO_OP_ADD_ELEMENT, element, &scratch);
+    notify(canvas, MIKADO_CHANGE_ELEMENT_ADDED, element);
+    return element;
+}
+
+/* Brings an element back as the operation describes it. Its pads and
+ * attributes come back on their own. */
+static void element_create(MikadoCanvas *canvas, MikadoOp *op)
+{
+    MikadoElementSlot *slot = mikado_pool_restore(&canvas->elements, op->handle);
+    if (! slot)
+        return;
+    slot->x = op->u.element.x;
+    slot->y = op->u.element.y;
+    slot->label = op->u.element.label;
+    slot->selected = op->u.element.selected;
+    op->u.element.label = NULL;
+    if (slot->label)
+        canvas->labels++;
+    notify(canvas, MIKADO_CHANGE_ELEMENT_ADDED, op->handle);
+}
+
+/* Removes an element left without pads and attributes, describing it in
+ * the operation, which takes its label over. */
+static void element_destroy(MikadoCanvas *canvas, MikadoOp *op)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, op->handle);
+    op->u.element.x = slot->x;
+    op->u.element.y = slot->y;
+    op->u.element.label = slot->label;
+    op->u.element.selected = slot->selected;
+    if (slot->label)
+        canvas->labels--;
+    mikado_pool_release(&canvas->elements, op->handle);
+    notify(canvas, MIKADO_CHANGE_ELEMENT_REMOVED, op->handle);
+}
+
+static MikadoPad *pad_first(MikadoElementSlot *element, gboolean is_source)
+{
+    return is_source ? &element->first_source : &element->first_sink;
+}
+
+static MikadoPad *pad_last(MikadoElementSlot *element, gboolean is_source)
+{
+    return is_source ? &element->last_source : &element->last_sink;
+}
+
+/* Puts a pad back after the previous one it had. */
+static void pad_create(MikadoCanvas *canvas, MikadoOp *op)
+{
+    MikadoElementSlot *element = mikado_canvas_element(canvas, op->u.pad.element);
+    MikadoPadSlot *pad = mikado_pool_restore(&canvas->pads, op->handle);
+    MikadoPad *first;
+
+    if (! element || ! pad)
+        return;
+    pad->element = op->u.pad.element;
+    pad->is_source = op->u.pad.is_source;
+    pad->index = op->u.pad.index;
+    first = pad_first(element, pad->is_source);
+    if (op->u.pad.prev)
+    {
+        MikadoPadSlot *prev = mikado_canvas_pad(canvas, op->u.pad.prev);
+        pad->next = prev->next;
+        prev->next = op->handle;
+    }
+    else
+    {
+        pad->next = *first;
+        *first = op->handle;
+    }
+    if (! pad->next)
+        *pad_last(element, pad->is_source) = op->handle;
+    if (pad->is_source)
+        element->sources++;
+    else
+        element->sinks++;
+    notify(canvas, MIKADO_CHANGE_PADS, op->u.pad.element);
+}
+
+/* Removes a pad without connections. The list is kept valid along the
+ * way, listeners may walk it. */
+static void pad_destroy(MikadoCanvas *canvas, MikadoOp *op)
+{
+    MikadoPadSlot *pad = mikado_canvas_pad(canvas, op->handle);
+    MikadoElementSlot *element = mikado_canvas_element(canvas, pad->element);
+    MikadoPad *first = pad_first(element, pad->is_source);
+    MikadoPad *last = pad_last(element, pad->is_source);
+    MikadoPad prev = 0;
+    MikadoPad handle;
+
+    for (handle = *first; handle != op->handle; handle = mikado_canvas_pad(canvas, handle)->next)
+        prev = handle;
+    if (prev)
+        mikado_canvas_pad(canvas, prev)->next = pad->next;
+    else
+        *first = pad->next;
+    if (*last == op->handle)
+        *last = prev;
+    if (pad->is_source)
+        element->sources--;
+    else
+        element->sinks--;
+    op->u.pad.element = pad->element;
+    op->u.pad.prev = prev;
+    op->u.pad.index = pad->index;
+    op->u.pad.is_source = pad->is_source;
+    mikado_pool_release(&canvas->pads, op->handle);
+    notify(canvas, MIKADO_CHANGE_PADS, op->u.pad.element);
+}
+
+/* Puts an attribute back after the previous one it had. */
+static void attribute_create(MikadoCanvas *canvas, MikadoOp *op)
+{
+    MikadoElementSlot *element = mikado_canvas_element(canvas, op->u.attribute.element);
+    MikadoAttributeSlot *attribute = mikado_pool_restore(&canvas->attributes, op->handle);
+
+    if (! element || ! attribute)
+        return;
+    attribute->element = op->u.attribute.element;
+    attribute->name = op->u.attribute.name;
+    attribute->value = op->u.attribute.value;
+    if (op->u.attribute.prev)
+    {
+        MikadoAttributeSlot *prev = mikado_canvas_attribute(canvas, op->u.attribute.prev);
+        attribute->next = prev->next;
+        prev->next = op->handle;
+    }
+    else
+    {
+        attribute->next = element->first_attribute;
+        element->first_attribute = op->handle;
+    }
+    notify(canvas, MIKADO_CHANGE_ATTRIBUTE, attribute->element);
+}
+
+static void attribute_destroy(MikadoCanvas *canvas, MikadoOp *op)
+{
+    MikadoAttributeSlot *attribute = mikado_canvas_attribute(canvas, op->handle);
+    MikadoElementSlot *element = mikado_canvas_element(canvas, attribute->element);
+    MikadoAttribute prev = 0;
+    MikadoAttribute handle;
+
+    for (handle = element->first_attribute; handle != op->handle; handle = mikado_canvas_attribute(canvas, handle)->next)
+        prev = handle;
+    if (prev)
+        mikado_canvas_attribute(canvas, prev)->next = attribute->next;
+    else
+        element->first_attribute = attribute->next;
+    op->u.attribute.element = attribute->element;
+    op->u.attribute.prev = prev;
+    op->u.attribute.name = attribute->name;
+    op->u.attribute.value = attribute->value;
+    mikado_pool_release(&canvas->attributes, op->handle);
+    notify(canvas, MIKADO_CHANGE_ATTRIBUTE, op->u.attribute.element);
+}
+
+static void remove_pads(MikadoCanvas *canvas, MikadoPad *first)
+{
+    MikadoOp scratch;
+    while (*first)
+    {
+        MikadoPad pad = *first;
+        mikado_pad_disconnect_all(canvas, pad);
+        pad_destroy(canvas, record(canvas, MIKADO_OP_REMOVE_PAD, pad, &scratch));
+    }
+}
+
+/* Disconnects the element and removes its pads and attributes along
+ * with it. */
+void mikado_canvas_remove_element(MikadoCanvas *canvas, MikadoElement element)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    MikadoOp scratch;
+    MikadoOp *op;
+
+    if (! slot)
+        return;
+    remove_pads(canvas, &slot->first_source);
+    remove_pads(canvas, &slot->first_sink);
+    while (slot->first_attribute)
+        attribute_destroy(canvas, record(canvas, MIKADO_OP_REMOVE_ATTRIBUTE, slot->first_attribute, &scratch));
+    op = record(canvas, MIKADO_OP_REMOVE_ELEMENT, element, &scratch);
+    element_destroy(canvas, op);
+    if (op == &scratch)
+        g_free(scratch.u.element.label);
+}
+
+guint mikado_canvas_get_element_count(MikadoCanvas *canvas)
+{
+    return canvas->elements.live;
+}
+
+/* The list of connections of a pad runs through the next_from and
+ * prev_from fields for a source, next_to and prev_to for a sink. */
+static MikadoConnection *link_next(MikadoConnectionSlot *connection, gboolean source)
+{
+    return source ? &connection->next_from : &connection->next_to;
+}
+
+static MikadoConnection *link_prev(MikadoConnectionSlot *connection, gboolean source)
+{
+    return source ? &connection->prev_from : &connection->prev_to;
+}
+
+/* Links the connection after prev, first for 0. */
+static void pad_link(MikadoCanvas *canvas, MikadoPadSlot *pad, MikadoConnection handle, MikadoConnection prev)
+{
+    MikadoConnectionSlot *connection = mikado_canvas_connection(canvas, handle);
+    MikadoConnection next;
+
+    if (prev)
+    {
+        MikadoConnection *prev_next = link_next(mikado_canvas_connection(canvas, prev), pad->is_source);
+        next = *prev_next;
+        *prev_next = handle;
+    }
+    else
+    {
+        next = pad->first_connection;
+        pad->first_connection = handle;
+    }
+    if (next)
+        *link_prev(mikado_canvas_connection(canvas, next), pad->is_source) = handle;
+    *link_next(connection, pad->is_source) = next;
+    *link_prev(connection, pad->is_source) = prev;
+    pad->connections++;
+}
+
+/* Returns the connection that was before, 0 for none. */
+static MikadoConnection pad_unlink(MikadoCanvas *canvas, MikadoPadSlot *pad, MikadoConnection handle)
+{
+    MikadoConnectionSlot *connection = mikado_canvas_connection(canvas, handle);
+    MikadoConnection next = *link_next(connection, pad->is_source);
+    MikadoConnection prev = *link_prev(connection, pad->is_source);
+
+    if (prev)
+        *link_next(mikado_canvas_connection(canvas, prev), pad->is_source) = next;
+    else
+        pad->first_connection = next;
+    if (next)
+        *link_prev(mikado_canvas_connection(canvas, next), pad->is_source) = prev;
+    pad->connections--;
+    return prev;
+}
+
+/* Puts a connection back where it was in the lists of its pads. */
+static void connection_create(MikadoCanvas *canvas, MikadoOp *op)
+{
+    MikadoPadSlot *source = mikado_canvas_pad(canvas, op->u.connection.source);
+    MikadoPadSlot *sink = mikado_canvas_pad(canvas, op->u.connection.sink);
+    MikadoConnectionSlot *connection;
+
+    if (! source || ! sink)
+        return;
+    connection = mikado_pool_restore(&canvas->connections, op->handle);
+    if (! connection)
+        return;
+    connection->source = op->u.connection.source;
+    connection->sink = op->u.connection.sink;
+    pad_link(canvas, source, op->handle, op->u.connection.prev_from);
+    pad_link(canvas, sink, op->handle, op->u.connection.prev_to);
+    notify(canvas, MIKADO_CHANGE_CONNECTION, sink->element);
+}
+
+static void connection_destroy(MikadoCanvas *canvas, MikadoOp *op)
+{
+    MikadoConnectionSlot *connection = mikado_canvas_connection(canvas, op->handle);
+    MikadoPadSlot *sink = mikado_canvas_pad(canvas, connection->sink);
+
+    op->u.connection.source = connection->source;
+    op->u.connection.sink = connection->sink;
+    op->u.connection.prev_from = pad_unlink(canvas, mikado_canvas_pad(canvas, connection->source), op->handle);
+    op->u.connection.prev_to = pad_unlink(canvas, sink, op->handle);
+    mikado_pool_release(&canvas->connections, op->handle);
+    notify(canvas, MIKADO_CHANGE_CONNECTION, sink->element);
+}
+
+static void connection_remove(MikadoCanvas *canvas, MikadoConnection handle)
+{
+    MikadoOp scratch;
+    connection_destroy(canvas, record(canvas, MIKADO_OP_DISCONNECT, handle, &scratch));
+}
+
+/* Connects a source pad to a sink pad. A sink takes one connection, the
+ * one it had is replaced. Returns the connection, 0 when the pads can
+ * not be connected. */
+MikadoConnection mikado_canvas_connect(MikadoCanvas *canvas, MikadoPad from, MikadoPad to)
+{
+    MikadoPadSlot *source = mikado_canvas_pad(canvas, from);
+    MikadoPadSlot *sink = mikado_canvas_pad(canvas, to);
+    MikadoConnectionSlot *connection;
+    MikadoConnection handle;
+    MikadoOp scratch;
+
+    if (! source || ! sink || ! source->is_source || sink->is_source)
+        return 0;
+    if (sink->first_connection)
+    {
+        connection = mikado_canvas_connection(canvas, sink->first_connection);
+        if (connection->source == from)
+            return sink->first_connection;
+        connection_remove(canvas, sink->first_connection);
+    }
+    handle = mikado_pool_alloc(&canvas->connections);
+    if (! handle)
+        return 0;
+    connection = mikado_canvas_connection(canvas, handle);
+    connection->source = from;
+    connection->sink = to;
+    pad_link(canvas, source, handle, 0);
+    pad_link(canvas, sink, handle, 0);
+    record(canvas, MIKADO_OP_CONNECT, handle, &scratch);
+    notify(canvas, MIKADO_CHANGE_CONNECTION, sink->element);
+    return handle;
+}
+
+void mikado_canvas_disconnect(MikadoCanvas *canvas, MikadoPad from, MikadoPad to)
+{
+    MikadoConnection connection = mikado_canvas_get_connection(canvas, from, to);
+    if (connection)
+        connection_remove(canvas, connection);
+}
+
+MikadoConnection mikado_canvas_get_connection(MikadoCanvas *canvas, MikadoPad from, MikadoPad to)
+{
+    MikadoPadSlot *sink = mikado_canvas_pad(canvas, to);
+    MikadoConnection handle;
+
+    if (! sink || sink->is_source)
+        return 0;
+    for (handle = sink->first_connection; handle; )
+    {
+        MikadoConnectionSlot *connection = mikado_canvas_connection(canvas, handle);
+        if (connection->source == from)
+            return handle;
+        handle = connection->next_to;
+    }
+    return 0;
+}
+
+guint mikado_canvas_get_connection_count(MikadoCanvas *canvas)
+{
+    return canvas->connections.live;
+}
+
+void mikado_canvas_set_zoom(MikadoCanvas *canvas, gdouble zoom)
+{
+    canvas->zoom = zoom;
+}
+
+gdouble mikado_canvas_get_zoom(MikadoCanvas *canvas)
+{
+    return canvas->zoom;
+}
+
+/* Bytes held by the canvas, not counting labels. */
+gsize mikado_canvas_get_memory_size(MikadoCanvas *canvas)
+{
+    return sizeof(MikadoCanvas) +
+        mikado_pool_get_memory_size(&canvas->elements) +
+        mikado_pool_get_memory_size(&canvas->pads) +
+        mikado_pool_get_memory_size(&canvas->connections) +
+        mikado_pool_get_memory_size(&canvas->attributes);
+}
+
+gboolean mikado_element_is_valid(MikadoCanvas *canvas, MikadoElement element)
+{
+    return mikado_canvas_element(canvas, element) != NULL;
+}
+
+static MikadoPad element_add_pad(MikadoCanvas *canvas, MikadoElement element, gboolean is_source)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    MikadoPadSlot *pad;
+    MikadoPad handle;
+    MikadoPad *first;
+    MikadoPad *last;
+    MikadoOp scratch;
+
+    if (! slot)
+        return 0;
+    handle = mikado_pool_alloc(&canvas->pads);
+    if (! handle)
+        return 0;
+    pad = mikado_canvas_pad(canvas, handle);
+    pad->element = element;
+    pad->is_source = is_source;
+    first = pad_first(slot, is_source);
+    last = pad_last(slot, is_source);
+    if (*last)
+        mikado_canvas_pad(canvas, *last)->next = handle;
+    else
+        *first = handle;
+    *last = handle;
+    pad->index = is_source ? slot->sources++ : slot->sinks++;
+    record(canvas, MIKADO_OP_ADD_PAD, handle, &scratch);
+    notify(canvas, MIKADO_CHANGE_PADS, element);
+    return handle;
+}
+
+MikadoPad mikado_element_add_source(MikadoCanvas *canvas, MikadoElement element)
+{
+    return element_add_pad(canvas, element, TRUE);
+}
+
+MikadoPad mikado_element_add_sink(MikadoCanvas *canvas, MikadoElement element)
+{
+    return element_add_pad(canvas, element, FALSE);
+}
+
+static guint list_pads(MikadoCanvas *canvas, MikadoPad pad, MikadoPad *pads, guint n_pads)
+{
+    guint count = 0;
+    for (; pad; pad = mikado_canvas_pad(canvas, pad)->next)
+    {
+        if (count < n_pads)
+            pads[count] = pad;
+        count++;
+    }
+    return count;
+}
+
+/* Stores up to n_pads source pads of the element in pads, in the order
+ * they were added. Returns how many it has. */
+guint mikado_element_get_sources(MikadoCanvas *canvas, MikadoElement element, MikadoPad *pads, guint n_pads)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    return slot ? list_pads(canvas, slot->first_source, pads, n_pads) : 0;
+}
+
+guint mikado_element_get_sinks(MikadoCanvas *canvas, MikadoElement element, MikadoPad *pads, guint n_pads)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    return slot ? list_pads(canvas, slot->first_sink, pads, n_pads) : 0;
+}
+
+/* Moves made one after the other go in one operation of the history. */
+void mikado_element_set_position(MikadoCanvas *canvas, MikadoElement element, gdouble x, gdouble y)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    if (! slot)
+        return;
+    if (canvas->history)
+    {
+        MikadoOp *op = mikado_history_get_last(canvas->history, MIKADO_OP_SET_POSITION, element);
+        if (! op)
+        {
+            op = mikado_history_push(canvas->history, MIKADO_OP_SET_POSITION, element);
+            op->u.position.from_x = slot->x;
+            op->u.position.from_y = slot->y;
+        }
+        op->u.position.to_x = x;
+        op->u.position.to_y = y;
+    }
+    slot->x = x;
+    slot->y = y;
+}
+
+void mikado_element_get_position(MikadoCanvas *canvas, MikadoElement element, gdouble *x, gdouble *y)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    *x = slot ? slot->x : 0.0;
+    *y = slot ? slot->y : 0.0;
+}
+
+static void element_set_label(MikadoCanvas *canvas, MikadoElementSlot *slot, const gchar *text)
+{
+    if (slot->label)
+        canvas->labels--;
+    g_free(slot->label);
+    slot->label = g_strdup(text);
+    if (slot->label)
+        canvas->labels++;
+}
+
+void mikado_element_set_label(MikadoCanvas *canvas, MikadoElement element, const gchar *text)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    if (! slot)
+        return;
+    if (canvas->history)
+    {
+        MikadoOp *op = mikado_history_push(canvas->history, MIKADO_OP_SET_LABEL, element);
+        op->u.label.from = g_strdup(slot->label);
+        op->u.label.to = g_strdup(text);
+    }
+    element_set_label(canvas, slot, text);
+}
+
+const gchar *mikado_element_get_label(MikadoCanvas *canvas, MikadoElement element)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    return slot ? slot->label : NULL;
+}
+
+void mikado_element_set_selected(MikadoCanvas *canvas, MikadoElement element, gboolean selected)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    if (slot)
+        slot->selected = selected;
+}
+
+gboolean mikado_element_get_selected(MikadoCanvas *canvas, MikadoElement element)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    return slot ? slot->selected : FALSE;
+}
+
+/* Sets the attribute of the element with that name, adding it when it
+ * has none. Returns the attribute, 0 for an invalid element. */
+MikadoAttribute mikado_element_set_attribute(MikadoCanvas *canvas, MikadoElement element, const gchar *name, gdouble value)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    MikadoAttributeSlot *attribute = NULL;
+    MikadoAttribute handle;
+    MikadoAttribute last = 0;
+    MikadoOp scratch;
+
+    if (! slot)
+        return 0;
+    name = g_intern_string(name);
+    for (handle = slot->first_attribute; handle; handle = attribute->next)
+    {
+        attribute = mikado_canvas_attribute(canvas, handle);
+        if (attribute->name == name)
+        {
+            mikado_attribute_set_value(canvas, handle, value);
+            return handle;
+        }
+        last = handle;
+    }
+    handle = mikado_pool_alloc(&canvas->attributes);
+    if (! handle)
+        return 0;
+    if (last)
+        mikado_canvas_attribute(canvas, last)->next = handle;
+    else
+        slot->first_attribute = handle;
+    attribute = mikado_canvas_attribute(canvas, handle);
+    attribute->element = element;
+    attribute->name = name;
+    attribute->value = value;
+    record(canvas, MIKADO_OP_ADD_ATTRIBUTE, handle, &scratch);
+    notify(canvas, MIKADO_CHANGE_ATTRIBUTE, element);
+    return handle;
+}
+
+/* Returns the attribute of the element with that name, 0 for none. */
+MikadoAttribute mikado_element_get_attribute(MikadoCanvas *canvas, MikadoElement element, const gchar *name)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    MikadoAttribute handle;
+
+    if (! slot)
+        return 0;
+    name = g_intern_string(name);
+    for (handle = slot->first_attribute; handle; )
+    {
+        MikadoAttributeSlot *attribute = mikado_canvas_attribute(canvas, handle);
+        if (attribute->name == name)
+            return handle;
+        handle = attribute->next;
+    }
+    return 0;
+}
+
+guint mikado_element_get_attributes(MikadoCanvas *canvas, MikadoElement element, MikadoAttribute *attributes, guint n_attributes)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    MikadoAttribute handle;
+    guint count = 0;
+
+    if (! slot)
+        return 0;
+    for (handle = slot->first_attribute; handle; handle = mikado_canvas_attribute(canvas, handle)->next)
+    {
+        if (count < n_attributes)
+            attributes[count] = handle;
+        count++;
+    }
+    return count;
+}
+
+const gchar *mikado_attribute_get_name(MikadoCanvas *canvas, MikadoAttribute attribute)
+{
+    MikadoAttributeSlot *slot = mikado_canvas_attribute(canvas, attribute);
+    return slot ? slot->name : NULL;
+}
+
+static void attribute_set_value(MikadoCanvas *canvas, MikadoAttributeSlot *slot, gdouble value)
+{
+    if (! slot || slot->value == value)
+        return;
+    slot->value = value;
+    notify(canvas, MIKADO_CHANGE_ATTRIBUTE, slot->element);
+}
+
+/* Values set one after the other go in one operation of the history. */
+void mikado_attribute_set_value(MikadoCanvas *canvas, MikadoAttribute attribute, gdouble value)
+{
+    MikadoAttributeSlot *slot = mikado_canvas_attribute(canvas, attribute);
+    if (! slot || slot->value == value)
+        return;
+    if (canvas->history)
+    {
+        MikadoOp *op = mikado_history_get_last(canvas->history, MIKADO_OP_SET_VALUE, attribute);
+        if (! op)
+        {
+            op = mikado_history_push(canvas->history, MIKADO_OP_SET_VALUE, attribute);
+            op->u.value.from = slot->value;
+        }
+        op->u.value.to = value;
+    }
+    attribute_set_value(canvas, slot, value);
+}
+
+gdouble mikado_attribute_get_value(MikadoCanvas *canvas, MikadoAttribute attribute)
+{
+    MikadoAttributeSlot *slot = mikado_canvas_attribute(canvas, attribute);
+    return slot ? slot->value : 0.0;
+}
+
+MikadoElement mikado_pad_get_element(MikadoCanvas *canvas, MikadoPad pad)
+{
+    MikadoPadSlot *slot = mikado_canvas_pad(canvas, pad);
+    return slot ? slot->element : 0;
+}
+
+gboolean mikado_pad_is_source(MikadoCanvas *canvas, MikadoPad pad)
+{
+    MikadoPadSlot *slot = mikado_canvas_pad(canvas, pad);
+    return slot ? slot->is_source : FALSE;
+}
+
+/* Stores up to n_connections connections of the pad in connections.
+ * Returns how many it has. */
+guint mikado_pad_get_connections(MikadoCanvas *canvas, MikadoPad pad, MikadoConnection *connections, guint n_connections)
+{
+    MikadoPadSlot *slot = mikado_canvas_pad(canvas, pad);
+    MikadoConnection handle;
+    guint count = 0;
+
+    if (! slot)
+        return 0;
+    for (handle = slot->first_connection; handle; )
+    {
+        if (count < n_connections)
+            connections[count] = handle;
+        count++;
+        handle = *link_next(mikado_canvas_connection(canvas, handle), slot->is_source);
+    }
+    return count;
+}
+
+/* Tells whether a connection joins the two pads, in either order. */
+gboolean mikado_pad_is_connected_with(MikadoCanvas *canvas, MikadoPad pad, MikadoPad other)
+{
+    if (mikado_pad_is_source(canvas, pad))
+        return mikado_canvas_get_connection(canvas, pad, other) != 0;
+    return mikado_canvas_get_connection(canvas, other, pad) != 0;
+}
+
+void mikado_pad_disconnect_all(MikadoCanvas *canvas, MikadoPad pad)
+{
+    MikadoPadSlot *slot = mikado_canvas_pad(canvas, pad);
+    while (slot && slot->first_connection)
+        connection_remove(canvas, slot->first_connection);
+}
+
+MikadoPad mikado_connection_get_source(MikadoCanvas *canvas, MikadoConnection connection)
+{
+    MikadoConnectionSlot *slot = mikado_canvas_connection(canvas, connection);
+    return slot ? slot->source : 0;
+}
+
+MikadoPad mikado_connection_get_sink(MikadoCanvas *canvas, MikadoConnection connection)
+{
+    MikadoConnectionSlot *slot = mikado_canvas_connection(canvas, connection);
+    return slot ? slot->sink : 0;
+}
+
+/* Undoing goes backwards over the operations of a step, redoing
+ * forwards, every operation the other way round from the first. */
+static void replay(MikadoCanvas *canvas, MikadoOp *op, gboolean undo)
+{
+    MikadoElementSlot *element;
+
+    switch (op->type)
+    {
+    case MIKADO_OP_ADD_ELEMENT:
+    case MIKADO_OP_REMOVE_ELEMENT:
+        if ((op->type == MIKADO_OP_ADD_ELEMENT) != undo)
+            element_create(canvas, op);
+        else
+            element_destroy(canvas, op);
+        break;
+    case MIKADO_OP_ADD_PAD:
+    case MIKADO_OP_REMOVE_PAD:
+        if ((op->type == MIKADO_OP_ADD_PAD) != undo)
+            pad_create(canvas, op);
+        else
+            pad_destroy(canvas, op);
+        break;
+    case MIKADO_OP_CONNECT:
+    case MIKADO_OP_DISCONNECT:
+        if ((op->type == MIKADO_OP_CONNECT) != undo)
+            connection_create(canvas, op);
+        else
+            connection_destroy(canvas, op);
+        break;
+    case MIKADO_OP_ADD_ATTRIBUTE:
+    case MIKADO_OP_REMOVE_ATTRIBUTE:
+        if ((op->type == MIKADO_OP_ADD_ATTRIBUTE) != undo)
+            attribute_create(canvas, op);
+        else
+            attribute_destroy(canvas, op);
+        break;
+    case MIKADO_OP_SET_VALUE:
+        attribute_set_value(canvas, mikado_canvas_attribute(canvas, op->handle),
+            undo ? op->u.value.from : op->u.value.to);
+        break;
+    case MIKADO_OP_SET_POSITION:
+        element = mikado_canvas_element(canvas, op->handle);
+        if (! element)
+            break;
+        element->x = undo ? op->u.position.from_x : op->u.position.to_x;
+        element->y = undo ? op->u.position.from_y : op->u.position.to_y;
+        break;
+    case MIKADO_OP_SET_LABEL:
+        element = mikado_canvas_element(canvas, op->handle);
+        if (element)
+            element_set_label(canvas, element, undo ? op->u.label.from : op->u.label.to);
+        break;
+    }
+}
+
+/* Starts recording changes, or stops and forgets them. The history is
+ * off by default. */
+void mikado_canvas_set_history_enabled(MikadoCanvas *canvas, gboolean enabled)
+{
+    if (enabled && ! canvas->history)
+    {
+        canvas->history = g_new(MikadoHistory, 1);
+        mikado_history_init(canvas->history);
+    }
+    else if (! enabled && canvas->history)
+    {
+        mikado_history_clear(canvas->history);
+        g_free(canvas->history);
+        canvas->history = NULL;
+    }
+}
+
+/* Makes the changes since the last step one step of the history, undone
+ * and redone as a whole. */
+void mikado_canvas_end_step(MikadoCanvas *canvas)
+{
+    if (canvas->history)
+        mikado_history_end_step(canvas->history);
+}
+
+/* Undoes the last step done, ending the one being recorded first.
+ * Returns FALSE when there is none. */
+gboolean mikado_canvas_undo(MikadoCanvas *canvas)
+{
+    MikadoHistory *history = canvas->history;
+    guint start;
+
+    if (! history)
+        return FALSE;
+    mikado_history_end_step(history);
+    if (! history->steps_done)
+        return FALSE;
+    history->steps_done--;
+    start = history->steps_done ? history->steps[history->steps_done - 1] : 0;
+    while (history->done > start)
+        replay(canvas, &history->ops[--history->done], TRUE);
+    return TRUE;
+}
+
+/* Redoes the last step undone, as long as nothing was changed since.
+ * Returns FALSE when there is none. */
+gboolean mikado_canvas_redo(MikadoCanvas *canvas)
+{
+    MikadoHistory *history = canvas->history;
+    guint end;
+
+    if (! history || history->steps_done == history->n_steps)
+        return FALSE;
+    end = history->steps[history->steps_done++];
+    while (history->done < end)
+        replay(canvas, &history->ops[history->done++], FALSE);
+    return TRUE;
+}
+
+/* Steps that can be undone, the one being recorded included, which is
+ * left open: this can be polled while a change goes on. */
+guint mikado_canvas_get_undo_count(MikadoCanvas *canvas)
+{
+    return canvas->history ? mikado_history_get_undo_count(canvas->history) : 0;
+}
+
+guint mikado_canvas_get_redo_count(MikadoCanvas *canvas)
+{
+    MikadoHistory *history = canvas->history;
+    return history ? history->n_steps - history->steps_done : 0;
+}
+
+/* Bytes held by the history, not counting labels. */
+gsize mikado_canvas_get_history_size(MikadoCanvas *canvas)
+{
+    return canvas->history ? mikado_history_get_size(canvas->history) : 0;
+}
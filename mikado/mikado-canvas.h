@@ -0,0 +1,77 @@
+#ifndef __MIKADO_CANVAS_H__
+#define __MIKADO_CANVAS_H__
+
+#include <glib.h>
+
+/*
+ * The graph model: a canvas holds elements, which have source and sink
+ * pads, connections going from a source to a sink, and named numeric
+ * attributes. Every object is referred to by a handle, a positive
+ * integer that stays valid until the object is removed and is rejected
+ * afterwards, never reused for another object. 0 stands for no object.
+ *
+ * With the history enabled, changes are recorded in steps that can be
+ * undone and redone, an object removed coming back under its handle.
+ * Zoom and selection are not recorded.
+ */
+typedef struct _MikadoCanvas MikadoCanvas;
+
+typedef gint MikadoElement;
+typedef gint MikadoPad;
+typedef gint MikadoConnection;
+typedef gint MikadoAttribute;
+
+MikadoCanvas *mikado_canvas_new(void);
+void mikado_canvas_free(MikadoCanvas *canvas);
+
+MikadoElement mikado_canvas_add_element(MikadoCanvas *canvas);
+void mikado_canvas_remove_element(MikadoCanvas *canvas, MikadoElement element);
+guint mikado_canvas_get_element_count(MikadoCanvas *canvas);
+
+MikadoConnection mikado_canvas_connect(MikadoCanvas *canvas, MikadoPad from, MikadoPad to);
+void mikado_canvas_disconnect(MikadoCanvas *canvas, MikadoPad from, MikadoPad to);
+MikadoConnection mikado_canvas_get_connection(MikadoCanvas *canvas, MikadoPad from, MikadoPad to);
+guint mikado_canvas_get_connection_count(MikadoCanvas *canvas);
+
+void mikado_canvas_set_zoom(MikadoCanvas *canvas, gdouble zoom);
+gdouble mikado_canvas_get_zoom(MikadoCanvas *canvas);
+
+gsize mikado_canvas_get_memory_size(MikadoCanvas *canvas);
+
+void mikado_canvas_set_history_enabled(MikadoCanvas *canvas, gboolean enabled);
+void mikado_canvas_end_step(MikadoCanvas *canvas);
+gboolean mikado_canvas_undo(MikadoCanvas *canvas);
+gboolean mikado_canvas_redo(MikadoCanvas *canvas);
+guint mikado_canvas_get_undo_count(MikadoCanvas *canvas);
+guint mikado_canvas_get_redo_count(MikadoCanvas *canvas);
+gsize mikado_canvas_get_history_size(MikadoCanvas *canvas);
+
+gboolean mikado_element_is_valid(MikadoCanvas *canvas, MikadoElement element);
+MikadoPad mikado_element_add_source(MikadoCanvas *canvas, MikadoElement element);
+MikadoPad mikado_element_add_sink(MikadoCanvas *canvas, MikadoElement element);
+guint mikado_element_get_sources(MikadoCanvas *canvas, MikadoElement element, MikadoPad *pads, guint n_pads);
+guint mikado_element_get_sinks(MikadoCanvas *canvas, MikadoElement element, MikadoPad *pads, guint n_pads);
+void mikado_element_set_position(MikadoCanvas *canvas, MikadoElement element, gdouble x, gdouble y);
+void mikado_element_get_position(MikadoCanvas *canvas, MikadoElement element, gdouble *x, gdouble *y);
+void mikado_element_set_label(MikadoCanvas *canvas, MikadoElement element, const gchar *text);
+const gchar *mikado_element_get_label(MikadoCanvas *canvas, MikadoElement element);
+void mikado_element_set_selected(MikadoCanvas *canvas, MikadoElement element, gboolean selected);
+gboolean mikado_element_get_selected(MikadoCanvas *canvas, MikadoElement element);
+
+MikadoAttribute mikado_element_set_attribute(MikadoCanvas *canvas, MikadoElement element, const gchar *name, gdouble value);
+MikadoAttribute mikado_element_get_attribute(MikadoCanvas *canvas, MikadoElement element, const gchar *name);
+guint mikado_element_get_attributes(MikadoCanvas *canvas, MikadoElement element, MikadoAttribute *attributes, guint n_attributes);
+const gchar *mikado_attribute_get_name(MikadoCanvas *canvas, MikadoAttribute attribute);
+void mikado_attribute_set_value(MikadoCanvas *canvas, MikadoAttribute attribute, gdouble value);
+gdouble mikado_attribute_get_value(MikadoCanvas *canvas, MikadoAttribute attribute);
+
+MikadoElement mikado_pad_get_element(MikadoCanvas *canvas, MikadoPad pad);
+gboolean mikado_pad_is_source(MikadoCanvas *canvas, MikadoPad pad);
+guint mikado_pad_get_connections(MikadoCanvas *canvas, MikadoPad pad, MikadoConnection *connections, guint n_connections);
+gboolean mikado_pad_is_connected_with(MikadoCanvas *canvas, MikadoPad pad, MikadoPad other);
+void mikado_pad_disconnect_all(MikadoCanvas *canvas, MikadoPad pad);
+
+MikadoPad mikado_connection_get_source(MikadoCanvas *canvas, MikadoConnection connection);
+MikadoPad mikado_connection_get_sink(MikadoCanvas *canvas, MikadoConnection connection);
+
+#endif // __MIKADO_CANVAS_H__
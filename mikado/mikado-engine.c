@@ -0,0 +1,395 @@
+#include <string.h>
+#include "mikado-canvas-private.h"
+#include "mikado-engine.h"
+#include "mikado-ring.h"
+
+#define MIKADO_ENGINE_COMMANDS 1024
+#define MIKADO_ENGINE_NOTIFICATIONS 1024
+/* How often progress is told while a frame is computed, and notifications
+ * that did not fit are tried again. */
+#define MIKADO_ENGINE_INTERVAL (G_USEC_PER_SEC / 30)
+
+typedef enum
+{
+    MIKADO_COMMAND_ADD_ELEMENT,
+    MIKADO_COMMAND_REMOVE_ELEMENT,
+    MIKADO_COMMAND_CONNECT,
+    MIKADO_COMMAND_DISCONNECT,
+    MIKADO_COMMAND_SET_ATTRIBUTE,
+    MIKADO_COMMAND_SET_OUTPUT
+} MikadoCommandType;
+
+typedef struct _MikadoCommand
+{
+    MikadoCommandType type;
+    guint tag;
+    MikadoElement element;
+    guint pad; /* a source of the element */
+    MikadoElement other;
+    guint other_pad; /* a sink of the other element */
+    guint sources; /* ADD_ELEMENT, with sinks */
+    guint sinks;
+    const gchar *name; /* interned */
+    gdouble x;
+    gdouble y;
+    gdouble value;
+} MikadoCommand;
+
+struct _MikadoEngine
+{
+    MikadoCanvas *canvas;
+    MikadoScheduler *scheduler;
+    MikadoCopyFunc copy_output;
+    GDestroyNotify free_output;
+    MikadoEngineFunc notify;
+    gpointer data;
+    MikadoRing *commands;
+    MikadoRing *notifications;
+    GThread *thread;
+    gint quit;
+    gint sleeping; /* commands must wake the engine thread */
+    GMutex lock; /* guards the fields below */
+    GCond cond;
+    gboolean wake;
+    gboolean result_ready;
+    gpointer result;
+    /* engine thread only */
+    MikadoNotification *backlog; /* did not fit in the ring */
+    guint n_backlog;
+    guint backlog_size;
+    guint progress;
+};
+
+/* Main loop side */
+
+/* The lock is only taken to wake an engine thread with nothing to do. */
+static gboolean send(MikadoEngine *engine, MikadoCommand *command)
+{
+    if (! mikado_ring_push(engine->commands, command, NULL))
+        return FALSE;
+    if (! g_atomic_int_get(&engine->sleeping))
+        return TRUE;
+    g_mutex_lock(&engine->lock);
+    engine->wake = TRUE;
+    g_cond_signal(&engine->cond);
+    g_mutex_unlock(&engine->lock);
+    return TRUE;
+}
+
+/* The tag comes back with the handle of the element, in the
+ * ELEMENT_ADDED notification. */
+gboolean mikado_engine_add_element(MikadoEngine *engine, guint tag, gdouble x, gdouble y, guint sources, guint sinks)
+{
+    MikadoCommand command = { 0 };
+    command.type = MIKADO_COMMAND_ADD_ELEMENT;
+    command.tag = tag;
+    command.x = x;
+    command.y = y;
+    command.sources = sources;
+    command.sinks = sinks;
+    return send(engine, &command);
+}
+
+gboolean mikado_engine_remove_element(MikadoEngine *engine, MikadoElement element)
+{
+    MikadoCommand command = { 0 };
+    command.type = MIKADO_COMMAND_REMOVE_ELEMENT;
+    command.element = element;
+    return send(engine, &command);
+}
+
+gboolean mikado_engine_connect(MikadoEngine *engine, MikadoElement from, guint source, MikadoElement to, guint sink)
+{
+    MikadoCommand command = { 0 };
+    command.type = MIKADO_COMMAND_CONNECT;
+    command.element = from;
+    command.pad = source;
+    command.other = to;
+    command.other_pad = sink;
+    return send(engine, &command);
+}
+
+gboolean mikado_engine_disconnect(MikadoEngine *engine, MikadoElement from, guint source, MikadoElement to, guint sink)
+{
+    MikadoCommand command = { 0 };
+    command.type = MIKADO_COMMAND_DISCONNECT;
+    command.element = from;
+    command.pad = source;
+    command.other = to;
+    command.other_pad = sink;
+    return send(engine, &command);
+}
+
+gboolean mikado_engine_set_attribute(MikadoEngine *engine, MikadoElement element, const gchar *name, gdouble value)
+{
+    MikadoCommand command = { 0 };
+    command.type = MIKADO_COMMAND_SET_ATTRIBUTE;
+    command.element = element;
+    command.name = g_intern_string(name);
+    command.value = value;
+    return send(engine, &command);
+}
+
+/* Sets the source computed for every frame. */
+gboolean mikado_engine_set_output(MikadoEngine *engine, MikadoElement element, guint source)
+{
+    MikadoCommand command = { 0 };
+    command.type = MIKADO_COMMAND_SET_OUTPUT;
+    command.element = element;
+    command.pad = source;
+    return send(engine, &command);
+}
+
+/* Returns FALSE when there is no notification waiting. */
+gboolean mikado_engine_next_notification(MikadoEngine *engine, MikadoNotification *notification)
+{
+    return mikado_ring_pop(engine->notifications, notification);
+}
+
+/* Engine side */
+
+static void notify(MikadoEngine *engine, MikadoNotification *notification)
+{
+    gboolean was_empty = FALSE;
+
+    if (! engine->n_backlog && mikado_ring_push(engine->notifications, notification, &was_empty))
+    {
+        if (was_empty && engine->notify)
+            engine->notify(engine, engine->data);
+        return;
+    }
+    if (engine->n_backlog == engine->backlog_size)
+    {
+        engine->backlog_size = MAX(16, engine->backlog_size * 2);
+        engine->backlog = g_renew(MikadoNotification, engine->backlog, engine->backlog_size);
+    }
+    engine->backlog[engine->n_backlog++] = *notification;
+}
+
+static void backlog_flush(MikadoEngine *engine)
+{
+    gboolean was_empty = FALSE;
+    gboolean wake = FALSE;
+    guint i;
+
+    for (i = 0; i < engine->n_backlog; i++)
+    {
+        if (! mikado_ring_push(engine->notifications, &engine->backlog[i], &was_empty))
+            break;
+        wake |= was_empty;
+    }
+    if (! i)
+        return;
+    engine->n_backlog -= i;
+    memmove(engine->backlog, engine->backlog + i, engine->n_backlog * sizeof(MikadoNotification));
+    if (wake && engine->notify)
+        engine->notify(engine, engine->data);
+}
+
+/* Called from the frame thread of the scheduler. A result nobody read
+ * yet is replaced. */
+static void frame_ready(MikadoScheduler *scheduler, gpointer output, gpointer data)
+{
+    MikadoEngine *engine = data;
+    gpointer copy = output && engine->copy_output ? engine->copy_output(output, engine->data) : NULL;
+
+    (void) scheduler;
+    g_mutex_lock(&engine->lock);
+    if (engine->result_ready && engine->result && engine->free_output)
+        engine->free_output(engine->result);
+    engine->result = copy;
+    engine->result_ready = TRUE;
+    engine->wake = TRUE;
+    g_cond_signal(&engine->cond);
+    g_mutex_unlock(&engine->lock);
+}
+
+static MikadoPad element_pad(MikadoCanvas *canvas, MikadoElement element, guint index, gboolean source)
+{
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    MikadoPad pad;
+
+    if (! slot)
+        return 0;
+    for (pad = source ? slot->first_source : slot->first_sink; pad && index; index--)
+        pad = mikado_canvas_pad(canvas, pad)->next;
+    return pad;
+}
+
+/* Attribute values go through the queue of the scheduler, everything
+ * else changes the canvas and stops the frame in progress first. */
+static void apply(MikadoEngine *engine, MikadoCommand *command)
+{
+    MikadoCanvas *canvas = engine->canvas;
+    MikadoNotification notification = { 0 };
+    MikadoAttribute attribute;
+    MikadoPad from;
+    MikadoPad to;
+    guint i;
+
+    if (command->type == MIKADO_COMMAND_SET_ATTRIBUTE)
+    {
+        attribute = mikado_element_get_attribute(canvas, command->element, command->name);
+        if (attribute)
+        {
+            mikado_scheduler_queue_value(engine->scheduler, attribute, command->value);
+            return;
+        }
+    }
+    mikado_scheduler_cancel(engine->scheduler);
+    switch (command->type)
+    {
+    case MIKADO_COMMAND_ADD_ELEMENT:
+        notification.type = MIKADO_NOTIFICATION_ELEMENT_ADDED;
+        notification.tag = command->tag;
+        notification.element = mikado_canvas_add_element(canvas);
+        for (i = 0; i < command->sources; i++)
+            mikado_element_add_source(canvas, notification.element);
+        for (i = 0; i < command->sinks; i++)
+            mikado_element_add_sink(canvas, notification.element);
+        mikado_element_set_position(canvas, notification.element, command->x, command->y);
+        notify(engine, &notification);
+        break;
+    case MIKADO_COMMAND_REMOVE_ELEMENT:
+        mikado_canvas_remove_element(canvas, command->element);
+        break;
+    case MIKADO_COMMAND_CONNECT:
+    case MIKADO_COMMAND_DISCONNECT:
+        from = element_pad(canvas, command->element, command->pad, TRUE);
+        to = element_pad(canvas, command->other, command->other_pad, FALSE);
+        if (command->type == MIKADO_COMMAND_CONNECT)
+            mikado_canvas_connect(canvas, from, to);
+        else
+            mikado_canvas_disconnect(canvas, from, to);
+        break;
+    case MIKADO_COMMAND_SET_ATTRIBUTE:
+        mikado_element_set_attribute(canvas, command->element, command->name, command->value);
+        break;
+    case MIKADO_COMMAND_SET_OUTPUT:
+        mikado_scheduler_set_output(engine->scheduler,
+            element_pad(canvas, command->element, command->pad, TRUE), frame_ready, engine);
+        break;
+    }
+}
+
+/* Takes every command waiting, ticks the scheduler once for all of them,
+ * then tells what came out and sleeps until the next command, or the
+ * next result. */
+static gpointer engine_thread(gpointer data)
+{
+    MikadoEngine *engine = data;
+    MikadoCommand command;
+
+    while (! g_atomic_int_get(&engine->quit))
+    {
+        MikadoNotification notification = { 0 };
+        gboolean changed = FALSE;
+        gboolean result_ready;
+        gboolean busy;
+        gpointer result;
+
+        while (mikado_ring_pop(engine->commands, &command))
+        {
+            apply(engine, &command);
+            changed = TRUE;
+        }
+        if (changed)
+            mikado_scheduler_tick(engine->scheduler);
+
+        backlog_flush(engine);
+        g_mutex_lock(&engine->lock);
+        result_ready = engine->result_ready;
+        result = engine->result;
+        engine->result_ready = FALSE;
+        engine->result = NULL;
+        g_mutex_unlock(&engine->lock);
+        if (result_ready)
+        {
+            notification.type = MIKADO_NOTIFICATION_RESULT;
+            notification.output = result;
+            notify(engine, &notification);
+        }
+
+        busy = mikado_scheduler_is_busy(engine->scheduler);
+        if (busy)
+        {
+            notification.type = MIKADO_NOTIFICATION_PROGRESS;
+            notification.output = NULL;
+            mikado_scheduler_get_progress(engine->scheduler, &notification.done, &notification.total);
+            if (notification.done != engine->progress)
+                notify(engine, &notification);
+            engine->progress = notification.done;
+        }
+
+        g_mutex_lock(&engine->lock);
+        g_atomic_int_set(&engine->sleeping, TRUE);
+        if (mikado_ring_get_length(engine->commands))
+            engine->wake = TRUE; /* sent before sleeping was set */
+        while (! engine->wake)
+        {
+            if (! busy && ! engine->n_backlog)
+                g_cond_wait(&engine->cond, &engine->lock);
+            else if (! g_cond_wait_until(&engine->cond, &engine->lock,
+                g_get_monotonic_time() + MIKADO_ENGINE_INTERVAL))
+                break;
+        }
+        g_atomic_int_set(&engine->sleeping, FALSE);
+        engine->wake = FALSE;
+        g_mutex_unlock(&engine->lock);
+    }
+    mikado_scheduler_cancel(engine->scheduler);
+    return NULL;
+}
+
+MikadoEngine *mikado_engine_new(MikadoProcessFunc process, MikadoCopyFunc copy_output,
+    GDestroyNotify free_output, MikadoEngineFunc notify, gpointer data)
+{
+    MikadoEngine *engine = g_new0(MikadoEngine, 1);
+    engine->canvas = mikado_canvas_new();
+    engine->scheduler = mikado_scheduler_new(engine->canvas, process, free_output, data);
+    engine->copy_output = copy_output;
+    engine->free_output = free_output;
+    engine->notify = notify;
+    engine->data = data;
+    engine->commands = mikado_ring_new(sizeof(MikadoCommand), MIKADO_ENGINE_COMMANDS);
+    engine->notifications = mikado_ring_new(sizeof(MikadoNotification), MIKADO_ENGINE_NOTIFICATIONS);
+    g_mutex_init(&engine->lock);
+    g_cond_init(&engine->cond);
+    engine->thread = g_thread_new("mikado-engine", engine_thread, engine);
+    return engine;
+}
+
+static void notification_clear(MikadoEngine *engine, MikadoNotification *notification)
+{
+    if (notification->type == MIKADO_NOTIFICATION_RESULT && notification->output && engine->free_output)
+        engine->free_output(notification->output);
+}
+
+/* Results not read yet are freed along. */
+void mikado_engine_free(MikadoEngine *engine)
+{
+    MikadoNotification notification;
+    guint i;
+
+    g_atomic_int_set(&engine->quit, TRUE);
+    g_mutex_lock(&engine->lock);
+    engine->wake = TRUE;
+    g_cond_signal(&engine->cond);
+    g_mutex_unlock(&engine->lock);
+    g_thread_join(engine->thread);
+
+    mikado_scheduler_free(engine->scheduler);
+    mikado_canvas_free(engine->canvas);
+    while (mikado_ring_pop(engine->notifications, &notification))
+        notification_clear(engine, &notification);
+    for (i = 0; i < engine->n_backlog; i++)
+        notification_clear(engine, &engine->backlog[i]);
+    if (engine->result && engine->free_output)
+        engine->free_output(engine->result);
+    g_free(engine->backlog);
+    mikado_ring_free(engine->commands);
+    mikado_ring_free(engine->notifications);
+    g_mutex_clear(&engine->lock);
+    g_cond_clear(&engine->cond);
+    g_free(engine);
+}
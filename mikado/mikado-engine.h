@@ -0,0 +1,58 @@
+#ifndef __MIKADO_ENGINE_H__
+#define __MIKADO_ENGINE_H__
+
+#include <glib.h>
+#include "mikado-canvas.h"
+#include "mikado-scheduler.h"
+
+/*
+ * A canvas and its scheduler run by a thread of their own, so that the
+ * main loop never waits for a computation and the other way round. The
+ * main loop sends commands and reads notifications, both through lock
+ * free rings: a command is refused when its ring is full, and the engine
+ * keeps the notifications that do not fit until they do.
+ *
+ * Elements are known by the handles given in the notifications, pads by
+ * their index among the sources, or the sinks, of their element.
+ * Attribute values sent faster than frames are computed are coalesced.
+ */
+typedef struct _MikadoEngine MikadoEngine;
+
+/* Copies an output for the main loop, which frees it with free_output. */
+typedef gpointer (*MikadoCopyFunc) (gpointer output, gpointer data);
+
+/* Called from the engine thread when notifications are waiting, typically
+ * to add an idle source reading them. */
+typedef void (*MikadoEngineFunc) (MikadoEngine *engine, gpointer data);
+
+typedef enum
+{
+    MIKADO_NOTIFICATION_ELEMENT_ADDED,
+    MIKADO_NOTIFICATION_RESULT, /* a frame of the output is computed */
+    MIKADO_NOTIFICATION_PROGRESS /* of the frame being computed */
+} MikadoNotificationType;
+
+typedef struct _MikadoNotification
+{
+    MikadoNotificationType type;
+    guint tag; /* ELEMENT_ADDED: the one of the command */
+    MikadoElement element; /* ELEMENT_ADDED */
+    gpointer output; /* RESULT: a copy for the receiver, NULL without copy function */
+    guint done; /* PROGRESS: elements computed */
+    guint total;
+} MikadoNotification;
+
+MikadoEngine *mikado_engine_new(MikadoProcessFunc process, MikadoCopyFunc copy_output,
+    GDestroyNotify free_output, MikadoEngineFunc notify, gpointer data);
+void mikado_engine_free(MikadoEngine *engine);
+
+gboolean mikado_engine_add_element(MikadoEngine *engine, guint tag, gdouble x, gdouble y, guint sources, guint sinks);
+gboolean mikado_engine_remove_element(MikadoEngine *engine, MikadoElement element);
+gboolean mikado_engine_connect(MikadoEngine *engine, MikadoElement from, guint source, MikadoElement to, guint sink);
+gboolean mikado_engine_disconnect(MikadoEngine *engine, MikadoElement from, guint source, MikadoElement to, guint sink);
+gboolean mikado_engine_set_attribute(MikadoEngine *engine, MikadoElement element, const gchar *name, gdouble value);
+gboolean mikado_engine_set_output(MikadoEngine *engine, MikadoElement element, guint source);
+
+gboolean mikado_engine_next_notification(MikadoEngine *engine, MikadoNotification *notification);
+
+#endif // __MIKADO_ENGINE_H__
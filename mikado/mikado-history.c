@@ -0,0 +1,109 @@
+#include <string.h>
+#include "mikado-history.h"
+
+static void op_clear(MikadoOp *op)
+{
+    if (op->type == MIKADO_OP_ADD_ELEMENT || op->type == MIKADO_OP_REMOVE_ELEMENT)
+        g_free(op->u.element.label);
+    else if (op->type == MIKADO_OP_SET_LABEL)
+    {
+        g_free(op->u.label.from);
+        g_free(op->u.label.to);
+    }
+}
+
+/* Forgets the operations that were undone. */
+static void forget_undone(MikadoHistory *history)
+{
+    guint i;
+    for (i = history->done; i < history->n_ops; i++)
+        op_clear(&history->ops[i]);
+    history->n_ops = history->done;
+    history->n_steps = history->steps_done;
+}
+
+/* Where the step being recorded starts, it is done as long as it is
+ * open. */
+static guint step_start(MikadoHistory *history)
+{
+    return history->steps_done ? history->steps[history->steps_done - 1] : 0;
+}
+
+void mikado_history_init(MikadoHistory *history)
+{
+    memset(history, 0, sizeof(MikadoHistory));
+}
+
+void mikado_history_clear(MikadoHistory *history)
+{
+    history->done = 0;
+    history->steps_done = 0;
+    forget_undone(history);
+    g_free(history->ops);
+    g_free(history->steps);
+    mikado_history_init(history);
+}
+
+/* Returns a zeroed operation to fill, added to the open step. Whatever
+ * was undone can no longer be redone. */
+MikadoOp *mikado_history_push(MikadoHistory *history, MikadoOpType type, gint handle)
+{
+    MikadoOp *op;
+
+    forget_undone(history);
+    if (history->n_ops == history->ops_size)
+    {
+        history->ops_size = MAX(64, history->ops_size * 2);
+        history->ops = g_renew(MikadoOp, history->ops, history->ops_size);
+    }
+    op = &history->ops[history->n_ops++];
+    memset(op, 0, sizeof(MikadoOp));
+    op->type = type;
+    op->handle = handle;
+    history->done = history->n_ops;
+    return op;
+}
+
+/* Returns the last operation of the open step when it is of that type
+ * and on that object, for a change to go in the same operation as the
+ * one before it, NULL otherwise. */
+MikadoOp *mikado_history_get_last(MikadoHistory *history, MikadoOpType type, gint handle)
+{
+    MikadoOp *op;
+
+    if (history->done != history->n_ops || history->done == step_start(history))
+        return NULL;
+    op = &history->ops[history->done - 1];
+    return op->type == type && op->handle == handle ? op : NULL;
+}
+
+/* Closes the open step, if anything was recorded in it. */
+void mikado_history_end_step(MikadoHistory *history)
+{
+    if (history->done != history->n_ops || history->done == step_start(history))
+        return;
+    if (history->n_steps == history->steps_size)
+    {
+        history->steps_size = MAX(16, history->steps_size * 2);
+        history->steps = g_renew(guint, history->steps, history->steps_size);
+    }
+    history->steps[history->n_steps++] = history->done;
+    history->steps_done = history->n_steps;
+}
+
+/* Steps that can be undone, the open one included if anything was
+ * recorded in it. Leaves the open step as it is. */
+guint mikado_history_get_undo_count(MikadoHistory *history)
+{
+    gboolean open = history->done == history->n_ops && history->done != step_start(history);
+    return history->steps_done + (open ? 1 : 0);
+}
+
+/* Bytes taken by the operations and steps recorded, not counting
+ * labels. */
+gsize mikado_history_get_size(MikadoHistory *history)
+{
+    return sizeof(MikadoHistory) +
+        history->n_ops * sizeof(MikadoOp) +
+        history->n_steps * sizeof(guint);
+}
@@ -0,0 +1,107 @@
+#ifndef __MIKADO_HISTORY_H__
+#define __MIKADO_HISTORY_H__
+
+#include <glib.h>
+#include "mikado-canvas.h"
+
+/*
+ * The changes made to a canvas, as a log of operations grouped in steps.
+ * An operation records what it takes to go either way, so a step costs
+ * memory in proportion to what it changed and is undone, or redone, by
+ * going over its own operations only. Objects come back under the
+ * handles they had, which keeps the log and the handles held by the
+ * application valid.
+ */
+typedef enum
+{
+    MIKADO_OP_ADD_ELEMENT,
+    MIKADO_OP_REMOVE_ELEMENT,
+    MIKADO_OP_ADD_PAD,
+    MIKADO_OP_REMOVE_PAD,
+    MIKADO_OP_CONNECT,
+    MIKADO_OP_DISCONNECT,
+    MIKADO_OP_ADD_ATTRIBUTE,
+    MIKADO_OP_REMOVE_ATTRIBUTE,
+    MIKADO_OP_SET_VALUE,
+    MIKADO_OP_SET_POSITION,
+    MIKADO_OP_SET_LABEL
+} MikadoOpType;
+
+/* An object created or removed is described as it was when removed, the
+ * previous objects telling where it goes back in the lists of its owners.
+ * Labels in operations are owned by the log. */
+typedef struct _MikadoOp
+{
+    MikadoOpType type;
+    gint handle; /* of the object concerned */
+    union
+    {
+        struct
+        {
+            gdouble x;
+            gdouble y;
+            gchar *label;
+            gboolean selected;
+        } element;
+        struct
+        {
+            MikadoElement element;
+            MikadoPad prev;
+            guint index;
+            gboolean is_source;
+        } pad;
+        struct
+        {
+            MikadoPad source;
+            MikadoPad sink;
+            MikadoConnection prev_from;
+            MikadoConnection prev_to;
+        } connection;
+        struct
+        {
+            MikadoElement element;
+            MikadoAttribute prev;
+            const gchar *name; /* interned */
+            gdouble value;
+        } attribute;
+        struct
+        {
+            gdouble from;
+            gdouble to;
+        } value;
+        struct
+        {
+            gdouble from_x;
+            gdouble from_y;
+            gdouble to_x;
+            gdouble to_y;
+        } position;
+        struct
+        {
+            gchar *from;
+            gchar *to;
+        } label;
+    } u;
+} MikadoOp;
+
+typedef struct _MikadoHistory
+{
+    MikadoOp *ops;
+    guint n_ops; /* the ones past done were undone and can be redone */
+    guint done;
+    guint ops_size;
+    guint *steps; /* where each step ends in ops */
+    guint n_steps;
+    guint steps_done;
+    guint steps_size;
+} MikadoHistory;
+
+void mikado_history_init(MikadoHistory *history);
+void mikado_history_clear(MikadoHistory *history);
+MikadoOp *mikado_history_push(MikadoHistory *history, MikadoOpType type, gint handle);
+MikadoOp *mikado_history_get_last(MikadoHistory *history, MikadoOpType type, gint handle);
+void mikado_history_end_step(MikadoHistory *history);
+guint mikado_history_get_undo_count(MikadoHistory *history);
+gsize mikado_history_get_size(MikadoHistory *history);
+
+#endif // __MIKADO_HISTORY_H__
@@ -0,0 +1,131 @@
+#include <string.h>
+#include "mikado-pool.h"
+
+/* In next_free, for a slot out of the free list for good. */
+#define MIKADO_SLOT_RETIRED G_MAXUINT
+
+void mikado_pool_init(MikadoPool *pool, gsize size)
+{
+    memset(pool, 0, sizeof(MikadoPool));
+    pool->size = size;
+    pool->slots = 1;
+}
+
+/* Frees every record at once, without visiting them. */
+void mikado_pool_clear(MikadoPool *pool)
+{
+    guint i;
+    for (i = 0; i < pool->chunks; i++)
+        g_free(pool->chunk[i]);
+    g_free(pool->chunk);
+    mikado_pool_init(pool, pool->size);
+}
+
+/* Returns the handle of a zeroed record, 0 when the pool is full. */
+gint mikado_pool_alloc(MikadoPool *pool)
+{
+    MikadoPoolItem *item;
+    guint generation;
+    guint slot;
+
+    if (pool->free_slot)
+    {
+        slot = pool->free_slot;
+        item = (MikadoPoolItem *) mikado_pool_slot(pool, slot);
+        pool->free_slot = item->next_free;
+        generation = item->generation;
+    }
+    else
+    {
+        if (pool->slots > MIKADO_SLOT_MASK)
+            return 0;
+        if (pool->slots >= pool->chunks << MIKADO_CHUNK_BITS)
+        {
+            pool->chunk = g_renew(guint8 *, pool->chunk, pool->chunks + 1);
+            pool->chunk[pool->chunks++] = g_malloc(pool->size * MIKADO_CHUNK_SIZE);
+        }
+        slot = pool->slots++;
+        item = (MikadoPoolItem *) mikado_pool_slot(pool, slot);
+        generation = 0;
+    }
+    memset(item, 0, pool->size);
+    item->generation = generation;
+    item->live = TRUE;
+    pool->live++;
+    return (gint) (generation << MIKADO_SLOT_BITS | slot);
+}
+
+/* Stale handles are ignored. A slot whose generations ran out is
+ * retired rather than put back in the free list. */
+void mikado_pool_release(MikadoPool *pool, gint handle)
+{
+    MikadoPoolItem *item = mikado_pool_get(pool, handle);
+    guint newest;
+
+    if (! item)
+        return;
+    newest = MAX(item->generation, item->next_free);
+    item->live = FALSE;
+    pool->live--;
+    if (newest == MIKADO_GENERATION_MAX)
+    {
+        item->generation = newest;
+        item->next_free = MIKADO_SLOT_RETIRED;
+        return;
+    }
+    item->generation = newest + 1;
+    item->next_free = pool->free_slot;
+    pool->free_slot = (guint) handle & MIKADO_SLOT_MASK;
+}
+
+/* Makes a released record live again under the handle it had, zeroed
+ * but for its header. Only the record released last can come back, as
+ * happens when changes are undone in the reverse order, NULL is returned
+ * for any other. Handles given by the slot since are not given again. */
+gpointer mikado_pool_restore(MikadoPool *pool, gint handle)
+{
+    guint slot = (guint) handle & MIKADO_SLOT_MASK;
+    guint generation = (guint) handle >> MIKADO_SLOT_BITS;
+    MikadoPoolItem *item;
+    guint newest;
+
+    if (handle <= 0 || slot >= pool->slots)
+        return NULL;
+    item = (MikadoPoolItem *) mikado_pool_slot(pool, slot);
+    if (item->live)
+        return NULL;
+    if (item->next_free == MIKADO_SLOT_RETIRED)
+        newest = MIKADO_GENERATION_MAX;
+    else if (pool->free_slot == slot && generation < item->generation)
+    {
+        pool->free_slot = item->next_free;
+        newest = item->generation - 1;
+    }
+    else
+        return NULL;
+    memset(item, 0, pool->size);
+    item->generation = generation;
+    item->next_free = newest; /* for the generation after it */
+    item->live = TRUE;
+    pool->live++;
+    return item;
+}
+
+/* Returns the record of a handle, NULL when it is not live. */
+gpointer mikado_pool_get(MikadoPool *pool, gint handle)
+{
+    guint slot = (guint) handle & MIKADO_SLOT_MASK;
+    MikadoPoolItem *item;
+
+    if (handle <= 0 || slot >= pool->slots)
+        return NULL;
+    item = (MikadoPoolItem *) mikado_pool_slot(pool, slot);
+    if (! item->live || item->generation != ((guint) handle >> MIKADO_SLOT_BITS))
+        return NULL;
+    return item;
+}
+
+gsize mikado_pool_get_memory_size(MikadoPool *pool)
+{
+    return pool->chunks * (pool->size * MIKADO_CHUNK_SIZE + sizeof(guint8 *));
+}
@@ -0,0 +1,62 @@
+#ifndef __MIKADO_POOL_H__
+#define __MIKADO_POOL_H__
+
+#include <glib.h>
+
+/*
+ * Fixed size records kept in chunks that are never moved, so pointers
+ * to them stay valid while the pool grows. A record is referred to by a
+ * handle: the low MIKADO_SLOT_BITS bits pick the slot, the bits above
+ * hold the generation the slot had when the handle was issued. Freeing
+ * a record bumps the generation of its slot, so stale handles are
+ * rejected instead of aliasing a newer record. 0 is never a handle.
+ */
+#define MIKADO_SLOT_BITS 24
+#define MIKADO_SLOT_MASK ((1 << MIKADO_SLOT_BITS) - 1)
+#define MIKADO_GENERATION_MAX ((1 << (31 - MIKADO_SLOT_BITS)) - 1)
+
+#define MIKADO_CHUNK_BITS 10
+#define MIKADO_CHUNK_SIZE (1 << MIKADO_CHUNK_BITS)
+
+/* Every record starts with this header. */
+typedef struct _MikadoPoolItem
+{
+    guint generation;
+    guint next_free; /* next slot in the free list, 0 terminates; while
+                      * live, the newest generation the slot has given */
+    gboolean live;
+} MikadoPoolItem;
+
+typedef struct _MikadoPool
+{
+    gsize size; /* bytes per record */
+    guint8 **chunk;
+    guint chunks;
+    guint slots; /* slot 0 is reserved */
+    guint free_slot;
+    guint live;
+} MikadoPool;
+
+void mikado_pool_init(MikadoPool *pool, gsize size);
+void mikado_pool_clear(MikadoPool *pool);
+gint mikado_pool_alloc(MikadoPool *pool);
+void mikado_pool_release(MikadoPool *pool, gint handle);
+gpointer mikado_pool_restore(MikadoPool *pool, gint handle);
+gpointer mikado_pool_get(MikadoPool *pool, gint handle);
+gsize mikado_pool_get_memory_size(MikadoPool *pool);
+
+/* The record in a slot, live or not, for walking the pool from slot 1
+ * up to pool->slots. */
+static inline gpointer mikado_pool_slot(MikadoPool *pool, guint slot)
+{
+    return pool->chunk[slot >> MIKADO_CHUNK_BITS] +
+        (gsize) (slot & (MIKADO_CHUNK_SIZE - 1)) * pool->size;
+}
+
+static inline gint mikado_pool_handle(MikadoPool *pool, guint slot)
+{
+    MikadoPoolItem *item = (MikadoPoolItem *) mikado_pool_slot(pool, slot);
+    return (gint) (item->generation << MIKADO_SLOT_BITS | slot);
+}
+
+#endif // __MIKADO_POOL_H__
@@ -0,0 +1,58 @@
+#include <string.h>
+#include "mikado-ring.h"
+
+/* The capacity is rounded up to a power of 2. */
+MikadoRing *mikado_ring_new(gsize item_size, guint capacity)
+{
+    MikadoRing *ring = g_new0(MikadoRing, 1);
+    guint size = 2;
+
+    while (size < capacity)
+        size <<= 1;
+    ring->items = g_malloc(item_size * size);
+    ring->item_size = item_size;
+    ring->mask = size - 1;
+    return ring;
+}
+
+void mikado_ring_free(MikadoRing *ring)
+{
+    g_free(ring->items);
+    g_free(ring);
+}
+
+/* Producer side. Returns FALSE when the ring is full; was_empty, when
+ * given, tells whether the consumer may have found nothing left, and so
+ * has to be told about the item. The head is read again once the item
+ * is published: the consumer may have emptied the ring in between. */
+gboolean mikado_ring_push(MikadoRing *ring, gconstpointer item, gboolean *was_empty)
+{
+    guint tail = ring->tail;
+    guint head = (guint) g_atomic_int_get(&ring->head);
+
+    if (tail - head > ring->mask)
+        return FALSE;
+    memcpy(ring->items + (gsize) (tail & ring->mask) * ring->item_size, item, ring->item_size);
+    g_atomic_int_set(&ring->tail, tail + 1);
+    if (was_empty)
+        *was_empty = (guint) g_atomic_int_get(&ring->head) == tail;
+    return TRUE;
+}
+
+/* Consumer side. Returns FALSE when the ring is empty. */
+gboolean mikado_ring_pop(MikadoRing *ring, gpointer item)
+{
+    guint head = ring->head;
+
+    if (head == (guint) g_atomic_int_get(&ring->tail))
+        return FALSE;
+    memcpy(item, ring->items + (gsize) (head & ring->mask) * ring->item_size, ring->item_size);
+    g_atomic_int_set(&ring->head, head + 1);
+    return TRUE;
+}
+
+/* Good from either side, though the other may have moved since. */
+guint mikado_ring_get_length(MikadoRing *ring)
+{
+    return (guint) g_atomic_int_get(&ring->tail) - (guint) g_atomic_int_get(&ring->head);
+}
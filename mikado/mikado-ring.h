@@ -0,0 +1,33 @@
+#ifndef __MIKADO_RING_H__
+#define __MIKADO_RING_H__
+
+#include <glib.h>
+
+/*
+ * A bounded queue of fixed size items between one producer thread and
+ * one consumer thread, without locks: neither ever waits for the other,
+ * a full ring refuses the item and an empty one has nothing to give.
+ * The producer only moves the tail and the consumer only the head, kept
+ * on cache lines of their own.
+ */
+#define MIKADO_RING_PAD 64
+
+typedef struct _MikadoRing
+{
+    guint8 *items;
+    gsize item_size;
+    guint mask; /* capacity - 1, the capacity being a power of 2 */
+    guint8 pad0[MIKADO_RING_PAD];
+    guint head; /* next item to pop */
+    guint8 pad1[MIKADO_RING_PAD - sizeof(guint)];
+    guint tail; /* next item to push */
+    guint8 pad2[MIKADO_RING_PAD - sizeof(guint)];
+} MikadoRing;
+
+MikadoRing *mikado_ring_new(gsize item_size, guint capacity);
+void mikado_ring_free(MikadoRing *ring);
+gboolean mikado_ring_push(MikadoRing *ring, gconstpointer item, gboolean *was_empty);
+gboolean mikado_ring_pop(MikadoRing *ring, gpointer item);
+guint mikado_ring_get_length(MikadoRing *ring);
+
+#endif // __MIKADO_RING_H__
@@ -0,0 +1,1075 @@
+#include <stdlib.h>
+#include <string.h>
+#include "mikado-cache.h"
+#include "mikado-canvas-private.h"
+#include "mikado-scheduler.h"
+
+/* What the scheduler knows of an element, by pool slot. The handle tells
+ * a reused slot from the element it held before. */
+typedef struct _MikadoElementState
+{
+    MikadoElement element;
+    gboolean dirty;
+    guint position; /* in the topological order */
+    guint stamp; /* last walk that visited the element */
+    gint pending; /* upstream elements of the cone still to compute */
+    MikadoCacheEntry *entry; /* the outputs */
+} MikadoElementState;
+
+typedef struct _MikadoConeItem
+{
+    guint position;
+    MikadoElement element;
+} MikadoConeItem;
+
+/* A worker computes the elements of its deque, from the bottom, and
+ * steals from the top of the others when it runs out. The thread that
+ * pulls is the first worker, the others have a thread of their own. */
+typedef struct _MikadoWorker
+{
+    MikadoScheduler *scheduler;
+    GThread *thread;
+    guint index;
+    GMutex lock;
+    MikadoElement *tasks;
+    guint n_tasks;
+    guint top;
+    guint bottom;
+    gpointer *inputs;
+    guint n_inputs;
+} MikadoWorker;
+
+struct _MikadoScheduler
+{
+    MikadoCanvas *canvas;
+    MikadoProcessFunc process;
+    MikadoSizeFunc size;
+    gpointer data;
+    MikadoCache cache;
+    MikadoElementState *state;
+    guint n_state;
+    gboolean order_valid;
+    guint stamp;
+    MikadoElement *stack; /* scratch for the walks */
+    guint n_stack;
+    MikadoConeItem *cone;
+    guint n_cone;
+    guint evaluations;
+    MikadoWorker *workers;
+    guint n_workers;
+    GMutex lock; /* guards the fields below, for the threads of the workers */
+    GCond wake;
+    GCond idle;
+    GCond work; /* signalled when an element is pushed or the job ends */
+    gint sleeping; /* workers waiting on work */
+    guint job; /* bumped for every cone computed in parallel */
+    guint busy; /* workers still on the current job */
+    gboolean quit;
+    gint done; /* elements of the job computed so far */
+    guint n_job;
+    gint cancel; /* set to stop the cone being computed */
+    gint progress; /* elements of the last cone computed so far */
+    gint progress_total;
+
+    /* frames, computed by a thread of their own */
+    GThread *frame_thread;
+    GMutex frame_lock; /* guards the fields below */
+    GCond frame_cond;
+    gboolean frame_request;
+    gboolean frame_busy;
+    gboolean frame_quit;
+    MikadoPad output;
+    MikadoFrameFunc frame_func;
+    gpointer frame_data;
+    MikadoFrameStats frame_stats;
+    GHashTable *queue_index; /* attribute to its place in the queue */
+    MikadoAttribute *queue;
+    gdouble *queue_values;
+    guint n_queue;
+    guint queue_size;
+    gboolean deferring; /* while the queue is set */
+    MikadoElement *touched; /* elements whose attributes it changed */
+    guint n_touched;
+    guint touched_size;
+};
+
+/* The outputs of an element that is gone can not be asked for again. */
+static void state_reset(MikadoScheduler *scheduler, MikadoElementState *state)
+{
+    if (state->entry)
+        mikado_cache_release(&scheduler->cache, state->entry, FALSE);
+    memset(state, 0, sizeof(MikadoElementState));
+}
+
+/* Elements the scheduler has not seen yet start dirty. */
+static MikadoElementState *state_get(MikadoScheduler *scheduler, MikadoElement element)
+{
+    guint slot = (guint) element & MIKADO_SLOT_MASK;
+    MikadoElementState *state;
+
+    if (slot >= scheduler->n_state)
+    {
+        guint n = MAX(scheduler->canvas->elements.slots, slot + 1);
+        scheduler->state = g_renew(MikadoElementState, scheduler->state, n);
+        memset(scheduler->state + scheduler->n_state, 0, (n - scheduler->n_state) * sizeof(MikadoElementState));
+        scheduler->n_state = n;
+    }
+    state = &scheduler->state[slot];
+    if (state->element != element)
+    {
+        state_reset(scheduler, state);
+        state->element = element;
+        state->dirty = TRUE;
+    }
+    return state;
+}
+
+/* Like state_get but never creates the state, so it is safe while the
+ * workers run. */
+static MikadoElementState *state_find(MikadoScheduler *scheduler, MikadoElement element)
+{
+    guint slot = (guint) element & MIKADO_SLOT_MASK;
+    if (slot >= scheduler->n_state || scheduler->state[slot].element != element)
+        return NULL;
+    return &scheduler->state[slot];
+}
+
+static void stack_push(MikadoScheduler *scheduler, guint *top, MikadoElement element)
+{
+    if (*top == scheduler->n_stack)
+    {
+        scheduler->n_stack = MAX(64, scheduler->n_stack * 2);
+        scheduler->stack = g_renew(MikadoElement, scheduler->stack, scheduler->n_stack);
+    }
+    scheduler->stack[(*top)++] = element;
+}
+
+/* Marks the elements on the stack and everything downstream of them
+ * dirty. A dirty element only has dirty elements downstream, so the walk
+ * stops at the ones already marked. Returns the height of the stack, 0
+ * unless cancelled. */
+static guint mark_stack(MikadoScheduler *scheduler, guint top, gboolean cancellable)
+{
+    MikadoCanvas *canvas = scheduler->canvas;
+
+    while (top)
+    {
+        MikadoElement handle;
+        MikadoElementSlot *slot;
+        MikadoElementState *state;
+        MikadoPad pad;
+
+        if (cancellable && g_atomic_int_get(&scheduler->cancel))
+            return top;
+        handle = scheduler->stack[--top];
+        slot = mikado_canvas_element(canvas, handle);
+        if (! slot)
+            continue;
+        state = state_get(scheduler, handle);
+        if (state->dirty)
+            continue;
+        state->dirty = TRUE;
+        for (pad = slot->first_source; pad; )
+        {
+            MikadoPadSlot *source = mikado_canvas_pad(canvas, pad);
+            MikadoConnection link = source->first_connection;
+            while (link)
+            {
+                MikadoConnectionSlot *connection = mikado_canvas_connection(canvas, link);
+                stack_push(scheduler, &top, mikado_canvas_pad(canvas, connection->sink)->element);
+                link = connection->next_from;
+            }
+            pad = source->next;
+        }
+    }
+    return 0;
+}
+
+static void mark_dirty(MikadoScheduler *scheduler, MikadoElement element)
+{
+    guint top = 0;
+    stack_push(scheduler, &top, element);
+    mark_stack(scheduler, top, FALSE);
+}
+
+/* Kahn's algorithm over the connections. Elements on a cycle come last,
+ * in slot order. */
+static void order_update(MikadoScheduler *scheduler)
+{
+    MikadoCanvas *canvas = scheduler->canvas;
+    guint slots = canvas->elements.slots;
+    guint *waiting = g_new0(guint, slots);
+    guint position = 0;
+    guint top = 0;
+    guint slot;
+
+    for (slot = 1; slot < slots; slot++)
+    {
+        MikadoElementSlot *element = mikado_pool_slot(&canvas->elements, slot);
+        MikadoPad pad;
+
+        if (! element->item.live)
+            continue;
+        for (pad = element->first_sink; pad; pad = mikado_canvas_pad(canvas, pad)->next)
+            if (mikado_canvas_pad(canvas, pad)->first_connection)
+                waiting[slot]++;
+        if (! waiting[slot])
+            stack_push(scheduler, &top, mikado_pool_handle(&canvas->elements, slot));
+    }
+    while (top)
+    {
+        MikadoElement handle = scheduler->stack[--top];
+        MikadoElementSlot *element = mikado_canvas_element(canvas, handle);
+        MikadoPad pad;
+
+        state_get(scheduler, handle)->position = position++;
+        for (pad = element->first_source; pad; pad = mikado_canvas_pad(canvas, pad)->next)
+        {
+            MikadoConnection connection = mikado_canvas_pad(canvas, pad)->first_connection;
+            while (connection)
+            {
+                MikadoConnectionSlot *slot_connection = mikado_canvas_connection(canvas, connection);
+                MikadoElement sink = mikado_canvas_pad(canvas, slot_connection->sink)->element;
+                guint sink_slot = (guint) sink & MIKADO_SLOT_MASK;
+
+                if (waiting[sink_slot] && --waiting[sink_slot] == 0)
+                    stack_push(scheduler, &top, sink);
+                connection = slot_connection->next_from;
+            }
+        }
+    }
+    for (slot = 1; slot < slots; slot++)
+        if (waiting[slot])
+            state_get(scheduler, mikado_pool_handle(&canvas->elements, slot))->position = position++;
+    g_free(waiting);
+    scheduler->order_valid = TRUE;
+}
+
+static MikadoElementState *upstream_state(MikadoScheduler *scheduler, MikadoPadSlot *sink, guint *index)
+{
+    MikadoCanvas *canvas = scheduler->canvas;
+    MikadoPadSlot *source;
+
+    if (! sink->first_connection)
+        return NULL;
+    source = mikado_canvas_pad(canvas, mikado_canvas_connection(canvas, sink->first_connection)->source);
+    *index = source->index;
+    return state_get(scheduler, source->element);
+}
+
+static guint64 key_mix(guint64 key, guint64 value)
+{
+    key ^= value + 0x9e3779b97f4a7c15ull + (key << 6) + (key >> 2);
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    return key ^ (key >> 31);
+}
+
+/* Stands for everything the outputs of an element are computed from:
+ * the element, its attributes and the keys of its inputs. */
+static guint64 element_key(MikadoScheduler *scheduler, MikadoElementSlot *slot, MikadoElement element)
+{
+    MikadoCanvas *canvas = scheduler->canvas;
+    guint64 key = key_mix(0, (guint) element);
+    MikadoAttribute handle;
+    MikadoPad pad;
+
+    for (handle = slot->first_attribute; handle; )
+    {
+        MikadoAttributeSlot *attribute = mikado_canvas_attribute(canvas, handle);
+        guint64 value;
+
+        memcpy(&value, &attribute->value, sizeof(value));
+        key = key_mix(key_mix(key, (guint64) (gsize) attribute->name), value);
+        handle = attribute->next;
+    }
+    for (pad = slot->first_sink; pad; )
+    {
+        MikadoPadSlot *sink = mikado_canvas_pad(canvas, pad);
+        guint64 input = 0;
+
+        if (sink->first_connection)
+        {
+            MikadoPadSlot *source = mikado_canvas_pad(canvas, mikado_canvas_connection(canvas, sink->first_connection)->source);
+            MikadoElementState *upstream = state_find(scheduler, source->element);
+            if (upstream && upstream->entry)
+                input = key_mix(upstream->entry->key, source->index + 1);
+        }
+        key = key_mix(key, input);
+        pad = sink->next;
+    }
+    return key;
+}
+
+static gsize outputs_size(MikadoScheduler *scheduler, gpointer *outputs, guint n_outputs)
+{
+    gsize bytes = 0;
+    guint i;
+
+    for (i = 0; i < n_outputs; i++)
+        if (outputs[i])
+            bytes += scheduler->size ? scheduler->size(outputs[i], scheduler->data) : 1;
+    return bytes;
+}
+
+/* Every element of a cone, and what it reads from, has its state by the
+ * time the cone is computed. The outputs come from the cache when the
+ * element has been computed from the same key before. */
+static void evaluate(MikadoScheduler *scheduler, MikadoWorker *worker, MikadoElement element)
+{
+    MikadoCanvas *canvas = scheduler->canvas;
+    MikadoElementSlot *slot = mikado_canvas_element(canvas, element);
+    MikadoElementState *state = state_find(scheduler, element);
+    MikadoCacheEntry *previous = state->entry;
+    MikadoCacheEntry *entry;
+    gpointer *outputs;
+    guint n_outputs;
+    guint64 key;
+    gint64 start;
+    MikadoPad pad;
+    guint i;
+
+    key = element_key(scheduler, slot, element);
+    if (previous && previous->key == key && previous->n_outputs == slot->sources)
+    {
+        state->dirty = FALSE;
+        g_atomic_int_inc(&scheduler->progress);
+        return;
+    }
+    entry = mikado_cache_lookup(&scheduler->cache, key);
+    if (entry && entry->n_outputs != slot->sources)
+    {
+        mikado_cache_release(&scheduler->cache, entry, TRUE);
+        entry = NULL;
+    }
+    if (entry)
+        goto done;
+
+    if (slot->sinks > worker->n_inputs)
+    {
+        worker->n_inputs = slot->sinks;
+        worker->inputs = g_renew(gpointer, worker->inputs, worker->n_inputs);
+    }
+    for (i = 0, pad = slot->first_sink; pad; i++)
+    {
+        MikadoPadSlot *sink = mikado_canvas_pad(canvas, pad);
+        MikadoElementState *upstream = NULL;
+        MikadoPadSlot *source = NULL;
+
+        if (sink->first_connection)
+        {
+            source = mikado_canvas_pad(canvas, mikado_canvas_connection(canvas, sink->first_connection)->source);
+            upstream = state_find(scheduler, source->element);
+        }
+        worker->inputs[i] = upstream && upstream->entry && source->index < upstream->entry->n_outputs ?
+            upstream->entry->outputs[source->index] : NULL;
+        pad = sink->next;
+    }
+    n_outputs = slot->sources;
+    outputs = g_new0(gpointer, n_outputs);
+    start = g_get_monotonic_time();
+    scheduler->process(canvas, element, worker->inputs, slot->sinks, outputs, n_outputs, scheduler->data);
+    entry = mikado_cache_insert(&scheduler->cache, key, outputs, n_outputs,
+        outputs_size(scheduler, outputs, n_outputs), g_get_monotonic_time() - start);
+    g_atomic_int_inc(&scheduler->evaluations);
+
+done:
+    /* the previous outputs go last, an element on a cycle may be reading
+     * them */
+    state->entry = entry;
+    state->dirty = FALSE;
+    if (previous)
+        mikado_cache_release(&scheduler->cache, previous, TRUE);
+    g_atomic_int_inc(&scheduler->progress);
+}
+
+/* Wakes the workers waiting for an element, or all of them. The lock is
+ * only taken when one is asleep. */
+static void workers_wake(MikadoScheduler *scheduler, gboolean all)
+{
+    if (! g_atomic_int_get(&scheduler->sleeping))
+        return;
+    g_mutex_lock(&scheduler->lock);
+    if (all)
+        g_cond_broadcast(&scheduler->work);
+    else
+        g_cond_signal(&scheduler->work);
+    g_mutex_unlock(&scheduler->lock);
+}
+
+static void worker_push(MikadoWorker *worker, MikadoElement element)
+{
+    g_mutex_lock(&worker->lock);
+    worker->tasks[worker->bottom++] = element;
+    g_mutex_unlock(&worker->lock);
+    workers_wake(worker->scheduler, FALSE);
+}
+
+static MikadoElement worker_take(MikadoWorker *worker)
+{
+    MikadoElement element = 0;
+    g_mutex_lock(&worker->lock);
+    if (worker->bottom > worker->top)
+        element = worker->tasks[--worker->bottom];
+    g_mutex_unlock(&worker->lock);
+    return element;
+}
+
+static MikadoElement worker_steal(MikadoWorker *worker)
+{
+    MikadoScheduler *scheduler = worker->scheduler;
+    guint i;
+
+    for (i = 1; i < scheduler->n_workers; i++)
+    {
+        MikadoWorker *victim = &scheduler->workers[(worker->index + i) % scheduler->n_workers];
+        MikadoElement element = 0;
+
+        g_mutex_lock(&victim->lock);
+        if (victim->bottom > victim->top)
+            element = victim->tasks[victim->top++];
+        g_mutex_unlock(&victim->lock);
+        if (element)
+            return element;
+    }
+    return 0;
+}
+
+static gboolean job_over(MikadoScheduler *scheduler)
+{
+    return (guint) g_atomic_int_get(&scheduler->done) >= scheduler->n_job || g_atomic_int_get(&scheduler->cancel);
+}
+
+static gboolean workers_have_tasks(MikadoScheduler *scheduler)
+{
+    gboolean found = FALSE;
+    guint i;
+
+    for (i = 0; i < scheduler->n_workers && ! found; i++)
+    {
+        MikadoWorker *worker = &scheduler->workers[i];
+        g_mutex_lock(&worker->lock);
+        found = worker->bottom > worker->top;
+        g_mutex_unlock(&worker->lock);
+    }
+    return found;
+}
+
+/* Waits for an element to take or steal, or for the end of the job. The
+ * worker counts itself asleep before it looks again: a push or the end
+ * of the job either is seen here or finds it asleep and wakes it. */
+static void worker_sleep(MikadoWorker *worker)
+{
+    MikadoScheduler *scheduler = worker->scheduler;
+
+    g_mutex_lock(&scheduler->lock);
+    g_atomic_int_inc(&scheduler->sleeping);
+    if (! job_over(scheduler) && ! workers_have_tasks(scheduler))
+        g_cond_wait(&scheduler->work, &scheduler->lock);
+    g_atomic_int_add(&scheduler->sleeping, -1);
+    g_mutex_unlock(&scheduler->lock);
+}
+
+/* Computes elements until the whole job is done. An element goes to the
+ * deque of the worker that computed its last missing input. */
+static void worker_run(MikadoWorker *worker)
+{
+    MikadoScheduler *scheduler = worker->scheduler;
+    MikadoCanvas *canvas = scheduler->canvas;
+
+    while (! job_over(scheduler))
+    {
+        MikadoElement element = worker_take(worker);
+        MikadoElementState *state;
+        MikadoPad pad;
+
+        if (! element)
+            element = worker_steal(worker);
+        if (! element)
+        {
+            worker_sleep(worker);
+            continue;
+        }
+        evaluate(scheduler, worker, element);
+        state = state_find(scheduler, element);
+        for (pad = mikado_canvas_element(canvas, element)->first_source; pad; )
+        {
+            MikadoPadSlot *source = mikado_canvas_pad(canvas, pad);
+            MikadoConnection link = source->first_connection;
+            while (link)
+            {
+                MikadoConnectionSlot *connection = mikado_canvas_connection(canvas, link);
+                MikadoElementState *sink = state_find(scheduler, mikado_canvas_pad(canvas, connection->sink)->element);
+
+                if (sink && sink->stamp == scheduler->stamp && sink->position > state->position &&
+                    g_atomic_int_dec_and_test(&sink->pending))
+                    worker_push(worker, sink->element);
+                link = connection->next_from;
+            }
+            pad = source->next;
+        }
+        if ((guint) g_atomic_int_add(&scheduler->done, 1) + 1 == scheduler->n_job)
+            workers_wake(scheduler, TRUE);
+    }
+}
+
+static gpointer worker_thread(gpointer data)
+{
+    MikadoWorker *worker = data;
+    MikadoScheduler *scheduler = worker->scheduler;
+    guint job = 0;
+
+    g_mutex_lock(&scheduler->lock);
+    for (;;)
+    {
+        while (scheduler->job == job && ! scheduler->quit)
+            g_cond_wait(&scheduler->wake, &scheduler->lock);
+        if (scheduler->quit)
+            break;
+        job = scheduler->job;
+        g_mutex_unlock(&scheduler->lock);
+        worker_run(worker);
+        g_mutex_lock(&scheduler->lock);
+        if (--scheduler->busy == 0)
+            g_cond_signal(&scheduler->idle);
+    }
+    g_mutex_unlock(&scheduler->lock);
+    return NULL;
+}
+
+/* Counts for every element of the cone the inputs it waits for. Fails
+ * when the cone holds a cycle, which is left to the serial order. */
+static gboolean cone_prepare(MikadoScheduler *scheduler, guint n_cone)
+{
+    MikadoCanvas *canvas = scheduler->canvas;
+    guint i;
+
+    for (i = 0; i < n_cone; i++)
+    {
+        MikadoElementState *state = state_find(scheduler, scheduler->cone[i].element);
+        MikadoPad pad;
+
+        state->pending = 0;
+        for (pad = mikado_canvas_element(canvas, state->element)->first_sink; pad; )
+        {
+            MikadoPadSlot *sink = mikado_canvas_pad(canvas, pad);
+            MikadoElementState *upstream;
+            guint index;
+
+            upstream = upstream_state(scheduler, sink, &index);
+            if (upstream && upstream->stamp == scheduler->stamp)
+            {
+                if (upstream->position >= state->position)
+                    return FALSE;
+                state->pending++;
+            }
+            pad = sink->next;
+        }
+    }
+    return TRUE;
+}
+
+static void evaluate_parallel(MikadoScheduler *scheduler, guint n_cone)
+{
+    guint next = 0;
+    guint i;
+
+    for (i = 0; i < scheduler->n_workers; i++)
+    {
+        MikadoWorker *worker = &scheduler->workers[i];
+        if (worker->n_tasks < n_cone)
+        {
+            worker->n_tasks = n_cone;
+            worker->tasks = g_renew(MikadoElement, worker->tasks, n_cone);
+        }
+        worker->top = worker->bottom = 0;
+    }
+    for (i = 0; i < n_cone; i++)
+    {
+        MikadoElementState *state = state_find(scheduler, scheduler->cone[i].element);
+        if (state->pending == 0)
+            worker_push(&scheduler->workers[next++ % scheduler->n_workers], state->element);
+    }
+    scheduler->done = 0;
+    scheduler->n_job = n_cone;
+
+    g_mutex_lock(&scheduler->lock);
+    scheduler->job++;
+    scheduler->busy = scheduler->n_workers - 1;
+    g_cond_broadcast(&scheduler->wake);
+    g_mutex_unlock(&scheduler->lock);
+
+    worker_run(&scheduler->workers[0]);
+
+    g_mutex_lock(&scheduler->lock);
+    while (scheduler->busy)
+        g_cond_wait(&scheduler->idle, &scheduler->lock);
+    g_mutex_unlock(&scheduler->lock);
+}
+
+static int cone_compare(const void *a, const void *b)
+{
+    const MikadoConeItem *first = a;
+    const MikadoConeItem *second = b;
+    return (first->position > second->position) - (first->position < second->position);
+}
+
+/* Collects the dirty elements the element depends on, and itself, then
+ * computes them in topological order. Clean elements only have clean
+ * elements upstream, the walk does not go past them. When cancelled, the
+ * elements not computed yet stay dirty. */
+static void evaluate_cone(MikadoScheduler *scheduler, MikadoElement element)
+{
+    MikadoCanvas *canvas = scheduler->canvas;
+    guint n_cone = 0;
+    guint top = 0;
+    guint i;
+
+    if (! scheduler->order_valid)
+        order_update(scheduler);
+    scheduler->stamp++;
+    state_get(scheduler, element)->stamp = scheduler->stamp;
+    stack_push(scheduler, &top, element);
+    while (top)
+    {
+        MikadoElement handle = scheduler->stack[--top];
+        MikadoElementState *state = state_get(scheduler, handle);
+        MikadoPad pad;
+
+        if (n_cone == scheduler->n_cone)
+        {
+            scheduler->n_cone = MAX(64, scheduler->n_cone * 2);
+            scheduler->cone = g_renew(MikadoConeItem, scheduler->cone, scheduler->n_cone);
+        }
+        scheduler->cone[n_cone].position = state->position;
+        scheduler->cone[n_cone++].element = handle;
+        for (pad = mikado_canvas_element(canvas, handle)->first_sink; pad; )
+        {
+            MikadoPadSlot *sink = mikado_canvas_pad(canvas, pad);
+            MikadoElementState *upstream;
+            guint index;
+
+            upstream = upstream_state(scheduler, sink, &index);
+            if (upstream && upstream->dirty && upstream->stamp != scheduler->stamp)
+            {
+                upstream->stamp = scheduler->stamp;
+                stack_push(scheduler, &top, upstream->element);
+            }
+            pad = sink->next;
+        }
+    }
+    qsort(scheduler->cone, n_cone, sizeof(MikadoConeItem), cone_compare);
+    g_atomic_int_set(&scheduler->progress, 0);
+    g_atomic_int_set(&scheduler->progress_total, n_cone);
+    if (scheduler->n_workers > 1 && n_cone > 1 && cone_prepare(scheduler, n_cone))
+    {
+        evaluate_parallel(scheduler, n_cone);
+        return;
+    }
+    for (i = 0; i < n_cone && ! g_atomic_int_get(&scheduler->cancel); i++)
+        evaluate(scheduler, &scheduler->workers[0], scheduler->cone[i].element);
+}
+
+static void changed(MikadoCanvas *canvas, MikadoChange change, MikadoElement element, gpointer data)
+{
+    MikadoScheduler *scheduler = data;
+    guint slot = (guint) element & MIKADO_SLOT_MASK;
+
+    (void) canvas;
+    switch (change)
+    {
+    case MIKADO_CHANGE_ELEMENT_ADDED:
+        scheduler->order_valid = FALSE;
+        break;
+    case MIKADO_CHANGE_ELEMENT_REMOVED:
+        if (slot < scheduler->n_state && scheduler->state[slot].element == element)
+            state_reset(scheduler, &scheduler->state[slot]);
+        scheduler->order_valid = FALSE;
+        break;
+    case MIKADO_CHANGE_CONNECTION:
+        scheduler->order_valid = FALSE;
+        mark_dirty(scheduler, element);
+        break;
+    case MIKADO_CHANGE_ATTRIBUTE:
+        if (scheduler->deferring)
+        {
+            if (scheduler->n_touched == scheduler->touched_size)
+            {
+                scheduler->touched_size = MAX(16, scheduler->touched_size * 2);
+                scheduler->touched = g_renew(MikadoElement, scheduler->touched, scheduler->touched_size);
+            }
+            scheduler->touched[scheduler->n_touched++] = element;
+            break;
+        }
+        mark_dirty(scheduler, element);
+        break;
+    case MIKADO_CHANGE_PADS:
+        mark_dirty(scheduler, element);
+        break;
+    }
+}
+
+/* The cone of a dragged element can be most of the graph, the queue
+ * leaves it to the frame thread to mark. Until they all are, clean
+ * elements may have dirty ones upstream and nothing is computed. When
+ * cancelled, what is left to walk goes back to the touched elements.
+ * Returns whether the marking is done. */
+static gboolean touched_mark(MikadoScheduler *scheduler, gboolean cancellable)
+{
+    guint top = 0;
+    guint i;
+
+    for (i = 0; i < scheduler->n_touched; i++)
+        stack_push(scheduler, &top, scheduler->touched[i]);
+    top = mark_stack(scheduler, top, cancellable);
+    if (top > scheduler->touched_size)
+    {
+        scheduler->touched_size = top;
+        scheduler->touched = g_renew(MikadoElement, scheduler->touched, top);
+    }
+    if (top)
+        memcpy(scheduler->touched, scheduler->stack, top * sizeof(MikadoElement));
+    scheduler->n_touched = top;
+    return top == 0;
+}
+
+/* Waits for the frame being computed, after which the caller has the
+ * states to itself. */
+static void frame_wait(MikadoScheduler *scheduler)
+{
+    g_mutex_lock(&scheduler->frame_lock);
+    while (scheduler->frame_busy)
+        g_cond_wait(&scheduler->frame_cond, &scheduler->frame_lock);
+    g_mutex_unlock(&scheduler->frame_lock);
+}
+
+/* Same, with every dirty element marked. */
+static void frame_settle(MikadoScheduler *scheduler)
+{
+    frame_wait(scheduler);
+    touched_mark(scheduler, FALSE);
+}
+
+/* Computes the output for every frame asked for. The frame function is
+ * called from here, before the frame counts as done, so the output it
+ * gets stays good until it returns. */
+static gpointer frame_thread(gpointer data)
+{
+    MikadoScheduler *scheduler = data;
+
+    g_mutex_lock(&scheduler->frame_lock);
+    for (;;)
+    {
+        MikadoPadSlot *pad;
+        MikadoElementState *state;
+        gboolean complete = FALSE;
+
+        while (! scheduler->frame_request && ! scheduler->frame_quit)
+            g_cond_wait(&scheduler->frame_cond, &scheduler->frame_lock);
+        if (scheduler->frame_quit)
+            break;
+        scheduler->frame_request = FALSE;
+        g_mutex_unlock(&scheduler->frame_lock);
+
+        pad = mikado_canvas_pad(scheduler->canvas, scheduler->output);
+        if (touched_mark(scheduler, TRUE) && pad)
+        {
+            state = state_get(scheduler, pad->element);
+            if (state->dirty)
+                evaluate_cone(scheduler, pad->element);
+            complete = ! state->dirty;
+            if (complete && scheduler->frame_func)
+                scheduler->frame_func(scheduler, pad->index < state->entry->n_outputs ?
+                    state->entry->outputs[pad->index] : NULL, scheduler->frame_data);
+        }
+
+        g_mutex_lock(&scheduler->frame_lock);
+        if (complete)
+            scheduler->frame_stats.completed++;
+        else
+            scheduler->frame_stats.cancelled++;
+        scheduler->frame_busy = FALSE;
+        g_cond_broadcast(&scheduler->frame_cond);
+    }
+    g_mutex_unlock(&scheduler->frame_lock);
+    return NULL;
+}
+
+MikadoScheduler *mikado_scheduler_new(MikadoCanvas *canvas, MikadoProcessFunc process,
+    GDestroyNotify free_output, gpointer data)
+{
+    MikadoScheduler *scheduler = g_new0(MikadoScheduler, 1);
+    scheduler->canvas = canvas;
+    scheduler->process = process;
+    scheduler->data = data;
+    mikado_cache_init(&scheduler->cache, free_output);
+    g_mutex_init(&scheduler->frame_lock);
+    g_cond_init(&scheduler->frame_cond);
+    scheduler->queue_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_mutex_init(&scheduler->lock);
+    g_cond_init(&scheduler->wake);
+    g_cond_init(&scheduler->idle);
+    g_cond_init(&scheduler->work);
+    mikado_scheduler_set_workers(scheduler, 1);
+    mikado_canvas_add_listener(canvas, changed, scheduler);
+    return scheduler;
+}
+
+static void workers_stop(MikadoScheduler *scheduler)
+{
+    guint i;
+
+    g_mutex_lock(&scheduler->lock);
+    scheduler->quit = TRUE;
+    g_cond_broadcast(&scheduler->wake);
+    g_mutex_unlock(&scheduler->lock);
+    for (i = 0; i < scheduler->n_workers; i++)
+    {
+        MikadoWorker *worker = &scheduler->workers[i];
+        if (worker->thread)
+            g_thread_join(worker->thread);
+        g_mutex_clear(&worker->lock);
+        g_free(worker->tasks);
+        g_free(worker->inputs);
+    }
+    g_free(scheduler->workers);
+    scheduler->workers = NULL;
+    scheduler->n_workers = 0;
+    scheduler->quit = FALSE;
+}
+
+/* Sets how many threads compute a cone, the pulling one included. 0 is
+ * one per processor, 1 computes everything in the pulling thread. With
+ * more than one, the process function is called from several threads
+ * at once. */
+void mikado_scheduler_set_workers(MikadoScheduler *scheduler, guint workers)
+{
+    guint i;
+
+    if (workers == 0)
+        workers = g_get_num_processors();
+    if (workers == scheduler->n_workers)
+        return;
+    frame_wait(scheduler);
+    workers_stop(scheduler);
+    scheduler->workers = g_new0(MikadoWorker, workers);
+    scheduler->n_workers = workers;
+    for (i = 0; i < workers; i++)
+    {
+        MikadoWorker *worker = &scheduler->workers[i];
+        worker->scheduler = scheduler;
+        worker->index = i;
+        g_mutex_init(&worker->lock);
+        if (i > 0)
+            worker->thread = g_thread_new("mikado-worker", worker_thread, worker);
+    }
+}
+
+guint mikado_scheduler_get_workers(MikadoScheduler *scheduler)
+{
+    return scheduler->n_workers;
+}
+
+void mikado_scheduler_free(MikadoScheduler *scheduler)
+{
+    guint i;
+    mikado_scheduler_cancel(scheduler);
+    if (scheduler->frame_thread)
+    {
+        g_mutex_lock(&scheduler->frame_lock);
+        scheduler->frame_quit = TRUE;
+        g_cond_broadcast(&scheduler->frame_cond);
+        g_mutex_unlock(&scheduler->frame_lock);
+        g_thread_join(scheduler->frame_thread);
+    }
+    g_mutex_clear(&scheduler->frame_lock);
+    g_cond_clear(&scheduler->frame_cond);
+    g_hash_table_destroy(scheduler->queue_index);
+    g_free(scheduler->queue);
+    g_free(scheduler->queue_values);
+    g_free(scheduler->touched);
+    mikado_canvas_remove_listener(scheduler->canvas, changed, scheduler);
+    workers_stop(scheduler);
+    g_mutex_clear(&scheduler->lock);
+    g_cond_clear(&scheduler->wake);
+    g_cond_clear(&scheduler->idle);
+    g_cond_clear(&scheduler->work);
+    for (i = 0; i < scheduler->n_state; i++)
+        state_reset(scheduler, &scheduler->state[i]);
+    mikado_cache_clear(&scheduler->cache);
+    g_free(scheduler->state);
+    g_free(scheduler->stack);
+    g_free(scheduler->cone);
+    g_free(scheduler);
+}
+
+/* Returns the value of a source pad, computing what it depends on first
+ * when needed. The value belongs to the scheduler and is good until the
+ * element is computed again. */
+gpointer mikado_scheduler_pull(MikadoScheduler *scheduler, MikadoPad source)
+{
+    MikadoPadSlot *pad = mikado_canvas_pad(scheduler->canvas, source);
+    MikadoElementState *state;
+
+    if (! pad || ! pad->is_source)
+        return NULL;
+    frame_settle(scheduler);
+    state = state_get(scheduler, pad->element);
+    if (state->dirty)
+        evaluate_cone(scheduler, pad->element);
+    return pad->index < state->entry->n_outputs ? state->entry->outputs[pad->index] : NULL;
+}
+
+/* Keeps the outputs elements no longer use, up to a budget in the units
+ * of the size function, bytes ideally. Without a size function every
+ * value counts one. A budget of 0, the default, keeps nothing. */
+void mikado_scheduler_set_cache(MikadoScheduler *scheduler, gsize budget, MikadoSizeFunc size)
+{
+    frame_wait(scheduler);
+    scheduler->size = size;
+    mikado_cache_set_budget(&scheduler->cache, budget);
+}
+
+void mikado_scheduler_get_cache_stats(MikadoScheduler *scheduler, MikadoCacheStats *stats)
+{
+    MikadoCache *cache = &scheduler->cache;
+
+    g_mutex_lock(&cache->lock);
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->bytes = cache->bytes;
+    stats->entries = g_hash_table_size(cache->entries);
+    g_mutex_unlock(&cache->lock);
+}
+
+gboolean mikado_scheduler_is_dirty(MikadoScheduler *scheduler, MikadoElement element)
+{
+    if (! mikado_canvas_element(scheduler->canvas, element))
+        return FALSE;
+    frame_settle(scheduler);
+    return state_get(scheduler, element)->dirty;
+}
+
+/* Elements computed since the scheduler was created. */
+guint mikado_scheduler_get_evaluation_count(MikadoScheduler *scheduler)
+{
+    return scheduler->evaluations;
+}
+
+/* Sets the source pad computed for every frame, and the function told
+ * about its value, from the thread that computes the frames. */
+void mikado_scheduler_set_output(MikadoScheduler *scheduler, MikadoPad source, MikadoFrameFunc func, gpointer data)
+{
+    mikado_scheduler_cancel(scheduler);
+    scheduler->output = source;
+    scheduler->frame_func = func;
+    scheduler->frame_data = data;
+}
+
+/* Queues a value for an attribute, to be set at the next tick. A value
+ * still in the queue is replaced. */
+void mikado_scheduler_queue_value(MikadoScheduler *scheduler, MikadoAttribute attribute, gdouble value)
+{
+    gpointer index;
+
+    scheduler->frame_stats.values++;
+    if (g_hash_table_lookup_extended(scheduler->queue_index, GINT_TO_POINTER(attribute), NULL, &index))
+    {
+        scheduler->queue_values[GPOINTER_TO_UINT(index)] = value;
+        scheduler->frame_stats.superseded++;
+        return;
+    }
+    if (scheduler->n_queue == scheduler->queue_size)
+    {
+        scheduler->queue_size = MAX(16, scheduler->queue_size * 2);
+        scheduler->queue = g_renew(MikadoAttribute, scheduler->queue, scheduler->queue_size);
+        scheduler->queue_values = g_renew(gdouble, scheduler->queue_values, scheduler->queue_size);
+    }
+    g_hash_table_insert(scheduler->queue_index, GINT_TO_POINTER(attribute), GUINT_TO_POINTER(scheduler->n_queue));
+    scheduler->queue[scheduler->n_queue] = attribute;
+    scheduler->queue_values[scheduler->n_queue++] = value;
+}
+
+/* To be called once per frame. Sets the queued values, stopping first a
+ * frame still being computed from older ones, and starts computing the
+ * output in the background when it needs it. Returns whether it does. */
+gboolean mikado_scheduler_tick(MikadoScheduler *scheduler)
+{
+    MikadoPadSlot *pad;
+    guint i;
+
+    scheduler->frame_stats.ticks++;
+    if (scheduler->n_queue)
+    {
+        mikado_scheduler_cancel(scheduler);
+        scheduler->deferring = TRUE;
+        for (i = 0; i < scheduler->n_queue; i++)
+            mikado_attribute_set_value(scheduler->canvas, scheduler->queue[i], scheduler->queue_values[i]);
+        scheduler->deferring = FALSE;
+        scheduler->n_queue = 0;
+        g_hash_table_remove_all(scheduler->queue_index);
+    }
+    else if (mikado_scheduler_is_busy(scheduler))
+        return FALSE;
+
+    pad = mikado_canvas_pad(scheduler->canvas, scheduler->output);
+    if (! pad)
+    {
+        touched_mark(scheduler, FALSE);
+        return FALSE;
+    }
+    if (! scheduler->n_touched && ! state_get(scheduler, pad->element)->dirty)
+        return FALSE;
+
+    if (! scheduler->frame_thread)
+        scheduler->frame_thread = g_thread_new("mikado-frame", frame_thread, scheduler);
+    g_mutex_lock(&scheduler->frame_lock);
+    scheduler->frame_stats.evaluations++;
+    scheduler->frame_busy = TRUE;
+    scheduler->frame_request = TRUE;
+    g_cond_broadcast(&scheduler->frame_cond);
+    g_mutex_unlock(&scheduler->frame_lock);
+    return TRUE;
+}
+
+gboolean mikado_scheduler_is_busy(MikadoScheduler *scheduler)
+{
+    gboolean busy;
+
+    g_mutex_lock(&scheduler->frame_lock);
+    busy = scheduler->frame_busy;
+    g_mutex_unlock(&scheduler->frame_lock);
+    return busy;
+}
+
+/* Stops the frame being computed, if any, and waits for it. The elements
+ * being computed are finished first. */
+void mikado_scheduler_cancel(MikadoScheduler *scheduler)
+{
+    g_atomic_int_set(&scheduler->cancel, TRUE);
+    workers_wake(scheduler, TRUE);
+    frame_wait(scheduler);
+    g_atomic_int_set(&scheduler->cancel, FALSE);
+}
+
+void mikado_scheduler_wait(MikadoScheduler *scheduler)
+{
+    frame_wait(scheduler);
+}
+
+void mikado_scheduler_get_frame_stats(MikadoScheduler *scheduler, MikadoFrameStats *stats)
+{
+    g_mutex_lock(&scheduler->frame_lock);
+    *stats = scheduler->frame_stats;
+    g_mutex_unlock(&scheduler->frame_lock);
+}
+
+/* How far the computation of the last cone went, from any thread. */
+void mikado_scheduler_get_progress(MikadoScheduler *scheduler, guint *done, guint *total)
+{
+    *done = g_atomic_int_get(&scheduler->progress);
+    *total = g_atomic_int_get(&scheduler->progress_total);
+}
@@ -0,0 +1,86 @@
+#ifndef __MIKADO_SCHEDULER_H__
+#define __MIKADO_SCHEDULER_H__
+
+#include <glib.h>
+#include "mikado-canvas.h"
+
+/*
+ * Pull based evaluation of a canvas. Every element is computed by a
+ * process function from the data on its sinks and its attributes, and
+ * produces one value per source pad, which the scheduler keeps until the
+ * element has to be computed again. Changing an attribute, a connection
+ * or the pads of an element marks it and everything downstream of it
+ * dirty; pulling a source pad then computes only the dirty elements it
+ * depends on, upstream first. With several workers, elements whose
+ * inputs are all computed run in parallel. The outputs an element no
+ * longer uses can be kept in a cache, for when its attributes and inputs
+ * come back to what they were.
+ *
+ * While a slider or a node is dragged, values are better queued than
+ * set: once per frame, mikado_scheduler_tick() sets the last value queued
+ * for every attribute and computes one output in the background,
+ * cancelling the frame before if it is still being computed.
+ *
+ * The scheduler follows the changes of its canvas and has to be freed
+ * before it. Process functions must not change the canvas, and the
+ * canvas must not be changed other than through the queue while a frame
+ * is computed: mikado_scheduler_cancel() or mikado_scheduler_wait()
+ * first.
+ */
+typedef struct _MikadoScheduler MikadoScheduler;
+
+/* inputs[i] is the value on the i-th sink of the element, NULL when it is
+ * not connected, and belongs to the scheduler. outputs[] comes zeroed and
+ * is to be filled with one value per source pad. */
+typedef void (*MikadoProcessFunc) (MikadoCanvas *canvas, MikadoElement element,
+    gpointer *inputs, guint n_inputs, gpointer *outputs, guint n_outputs, gpointer data);
+
+/* The size of an output, for the budget of the cache. */
+typedef gsize (*MikadoSizeFunc) (gpointer output, gpointer data);
+
+/* Gets the value of the output once a frame is computed. */
+typedef void (*MikadoFrameFunc) (MikadoScheduler *scheduler, gpointer output, gpointer data);
+
+typedef struct _MikadoFrameStats
+{
+    guint ticks;
+    guint evaluations; /* frames started */
+    guint completed;
+    guint cancelled;
+    guint64 values; /* queued */
+    guint64 superseded; /* replaced in the queue before their tick */
+} MikadoFrameStats;
+
+typedef struct _MikadoCacheStats
+{
+    guint64 hits;
+    guint64 misses;
+    guint64 evictions;
+    gsize bytes; /* held by the cache, in use or not */
+    guint entries;
+} MikadoCacheStats;
+
+MikadoScheduler *mikado_scheduler_new(MikadoCanvas *canvas, MikadoProcessFunc process,
+    GDestroyNotify free_output, gpointer data);
+void mikado_scheduler_free(MikadoScheduler *scheduler);
+
+void mikado_scheduler_set_workers(MikadoScheduler *scheduler, guint workers);
+guint mikado_scheduler_get_workers(MikadoScheduler *scheduler);
+
+void mikado_scheduler_set_cache(MikadoScheduler *scheduler, gsize budget, MikadoSizeFunc size);
+void mikado_scheduler_get_cache_stats(MikadoScheduler *scheduler, MikadoCacheStats *stats);
+
+void mikado_scheduler_set_output(MikadoScheduler *scheduler, MikadoPad source, MikadoFrameFunc func, gpointer data);
+void mikado_scheduler_queue_value(MikadoScheduler *scheduler, MikadoAttribute attribute, gdouble value);
+gboolean mikado_scheduler_tick(MikadoScheduler *scheduler);
+gboolean mikado_scheduler_is_busy(MikadoScheduler *scheduler);
+void mikado_scheduler_cancel(MikadoScheduler *scheduler);
+void mikado_scheduler_wait(MikadoScheduler *scheduler);
+void mikado_scheduler_get_frame_stats(MikadoScheduler *scheduler, MikadoFrameStats *stats);
+void mikado_scheduler_get_progress(MikadoScheduler *scheduler, guint *done, guint *total);
+
+gpointer mikado_scheduler_pull(MikadoScheduler *scheduler, MikadoPad source);
+gboolean mikado_scheduler_is_dirty(MikadoScheduler *scheduler, MikadoElement element);
+guint mikado_scheduler_get_evaluation_count(MikadoScheduler *scheduler);
+
+#endif // __MIKADO_SCHEDULER_H__
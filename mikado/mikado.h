@@ -3,6 +3,9 @@
 
 void mikado_hello();
 
+#include "mikado-canvas.h"
+#include "mikado-engine.h"
+#include "mikado-scheduler.h"
 #include "mikado-version.h"
 
 #endif // __MIKADO_H__
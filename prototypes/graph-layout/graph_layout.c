@@ -23,14 +23,35 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 #include "graph_layout.h"
 
 static gint id2no (struct GraphLayout *gl,
                    glong               id);
 
-static gint no2id (struct GraphLayout *gl,
-                   gint no);
+static struct GraphLayoutNode *id2node (struct GraphLayout *gl,
+                                        glong               id);
+
+static struct GraphLayoutNode *slot2node (struct GraphLayout *gl,
+                                          glong               slot_no);
+
+static void node_set_no (struct GraphLayout     *gl,
+                         gint                    node_no,
+                         struct GraphLayoutNode *node);
+
+static void slot_retire (struct GraphLayout     *gl,
+                         struct GraphLayoutNode *node);
+
+static void node_move (struct GraphLayout *gl,
+                       gint                from,
+                       gint                to);
+
+static gint node_permute (struct GraphLayout *gl,
+                          const gint         *order);
+
+static gint node_storage_resize (struct GraphLayout *gl,
+                                 glong               alloc);
 
 static void remove_connection (struct GraphLayout *gl,
                                gint                connection_no);
@@ -43,26 +64,121 @@ lines_intersect (gdouble x0, gdouble y0,
 
 static void toposort (struct GraphLayout *gl);
 
+static void reversed_count (struct GraphLayout *gl);
+
+static void add_connection_no (struct GraphLayout *gl);
+
+static void batch_flush (struct GraphLayout *gl);
+
 static void center_graph (struct GraphLayout *gl);
 
+static void mark_dirty (struct GraphLayout     *gl,
+                        struct GraphLayoutNode *node);
+
+static void dirty_clear (struct GraphLayout *gl);
+
+static void rows_init (struct GraphLayout *gl);
+
+static void grid_build (struct GraphLayout *gl);
+
+static void grid_free (struct GraphLayout *gl);
+
+static void grid_update (struct GraphLayout     *gl,
+                         struct GraphLayoutNode *node);
+
+static void grid_unlink (struct GraphLayout     *gl,
+                         struct GraphLayoutNode *node);
+
+static void grid_extents (struct GraphLayout     *gl,
+                          struct GraphLayoutNode *node);
+
+static void grid_query (struct GraphLayout *gl,
+                        gdouble x0, gdouble y0, gdouble x1, gdouble y1,
+                        gint (*func) (struct GraphLayout     *gl,
+                                      struct GraphLayoutNode *node,
+                                      gpointer                data),
+                        gpointer data);
+
+static gint pick_first (struct GraphLayout     *gl,
+                        struct GraphLayoutNode *node,
+                        gpointer                data);
+
+static void routes_invalidate (struct GraphLayout     *gl,
+                               struct GraphLayoutNode *node);
+
+static void routes_check (struct GraphLayout *gl);
+
+static void connection_changed (struct GraphLayout     *gl,
+                                struct GraphLayoutNode *source,
+                                struct GraphLayoutNode *dest);
+
 typedef struct rank_line
 {
   gint nodes;
   struct GraphLayoutNode **node;
 } rank_line;
 
+/* connection numbers touching one side of a node, ordered by the pad
+ * they use on that node
+ */
+typedef struct GraphLayoutEdges
+{
+  gint *conn;
+  gint count;
+  gint alloc;
+} GraphLayoutEdges;
+
+/* what a node standing for a group of nodes keeps, see Groups below */
+typedef struct GraphLayoutGroup
+{
+  gint collapsed;
+  gint dirty;			/* the content has to be laid out again */
+  gdouble width;		/* size when collapsed */
+  gdouble height;
+  gdouble content_width;	/* size when expanded, 0 before the content
+				   was laid out */
+  gdouble content_height;
+} GraphLayoutGroup;
+
+/* The per node bookkeeping, node structs live in a pool indexed by the
+ * slot part of their handle and are never moved, so pointers to them
+ * stay valid. The geometry used by the layout passes is kept apart in
+ * the x, y, width and height arrays of GraphLayout, indexed by no.
+ */
 typedef struct GraphLayoutNode
 {
   gint id;
-  gdouble x;
-  gdouble y;
-  gdouble width;
-  gdouble height;
+  gint no;			/* index into gl->node[], -1 when free */
+  gint generation;
+  gint next_free;		/* next slot in the free list, 0 terminates */
   gint inpads;
   gint outpads;
 
   gint rank;
   gint done;
+  gint row;			/* vertical slot, y = origin_y + row * ranksep */
+  gint order;			/* position within its rank */
+  gdouble key;			/* sort key used while ordering a rank */
+  gint root;			/* node_no of the top of its aligned block */
+  gint below;			/* node_no aligned below it, -1 for none */
+  gdouble offset;		/* x offset from the root of its block */
+  gint dirty;			/* 1 + position in gl->dirty, 0 when clean */
+
+  GraphLayoutEdges in;		/* connections ending in this node */
+  GraphLayoutEdges out;		/* connections starting in this node */
+
+  gint cell;			/* spatial index cell, -1 when not filed */
+  struct GraphLayoutNode *cell_next;
+  struct GraphLayoutNode *cell_prev;
+
+  gint group;			/* handle of the group it belongs to, 0 for
+				   none */
+  struct GraphLayoutGroup *meta;	/* set for the node of a group */
+  gint hidden;			/* inside a collapsed group, as of the last
+				   layout */
+  gdouble group_x;		/* position relative to the center of its
+				   group */
+  gdouble group_y;
 } GraphLayoutNode;
 
 typedef struct GraphLayoutConnection
@@ -74,220 +190,4603 @@ typedef struct GraphLayoutConnection
 
   gint from_node_no;
   gint to_node_no;
+
+  gdouble *route;		/* cached route, as x and y pairs */
+  gint route_points;		/* 0 when it has to be computed again */
+  gint route_alloc;
+
+  gint shown_from_id;		/* collapsed group drawn in place of a hidden
+				   end, 0 when the end is visible */
+  gint shown_from_pad;
+  gint shown_to_id;
+  gint shown_to_pad;
+
+  gint reversed;		/* taken the other way round by the last
+				   layout, to break a cycle */
 }
 GraphLayoutConnection;
 
+/* Node handles handed out by the API are generational slot references,
+ * the low GL_SLOT_BITS bits pick the node struct in the pool, the bits
+ * above hold the generation the slot had when the handle was issued.
+ * Freeing a node bumps the generation of its slot, so stale handles are
+ * detected in O(1) instead of silently aliasing a newer node.
+ */
+#define GL_SLOT_BITS        22
+#define GL_SLOT_MASK        ((1 << GL_SLOT_BITS) - 1)
+#define GL_GENERATION_MAX   ((1 << (31 - GL_SLOT_BITS)) - 1)
+
+/* the pool grows by chunks of node structs that are never reallocated */
+#define GL_CHUNK_BITS       10
+#define GL_CHUNK_SIZE       (1 << GL_CHUNK_BITS)
+
+typedef struct GraphLayoutGrid
+{
+  GraphLayoutNode **cell;	/* rows * cols lists, NULL when not built */
+  gint cols;
+  gint rows;
+  gdouble left;
+  gdouble top;
+  gdouble size;
+  gdouble half_width;		/* largest half extents of any node */
+  gdouble half_height;
+}
+GraphLayoutGrid;
+
 typedef struct GraphLayout
 {
-  GraphLayoutNode **node;
+  GraphLayoutNode **node;	/* live nodes, in layout order */
+  gdouble *x;			/* node geometry, indexed like gl->node[] */
+  gdouble *y;
+  gdouble *width;
+  gdouble *height;
   glong alloc_nodes;
   glong nodes;
 
-  GraphLayoutConnection **connection;
+  GraphLayoutConnection *connection;
   glong alloc_connections;
   glong connections;
 
-  glong max_nodeid;
+  GraphLayoutNode **pool;	/* chunks of node structs, by slot */
+  glong pool_chunks;
+  glong slots;			/* slot 0 is reserved, so 0 is never a handle */
+  glong free_slot;
+
+  gint unsorted_nodes;		/* nodes left out of the last toposort */
+  gint reversed_connections;	/* connections reversed by the last layout */
+
+  rank_line *rank_line;		/* nodes of each rank, from the last layout */
+  GraphLayoutNode **rank_node;	/* storage backing the rank lines */
+  gint ranks;
+  gint ranks_stale;		/* rank lines to rebuild from the nodes */
+
+  gint *dirty;			/* handles of nodes changed since last layout */
+  gint dirty_nodes;
+  gint alloc_dirty;
+
+  gint laid_out;		/* a full layout has been done */
+  gdouble origin_y;		/* y coordinate of row 0 */
+  gdouble *row_right;		/* rightmost x in each row, from row_first */
+  gint row_first;
+  gint rows;
+
+  GraphLayoutGrid grid;		/* spatial index over node positions */
+  gdouble *obstacle;		/* extents of the nodes in a lane, by pairs */
+  gint alloc_obstacles;
+  gdouble *route_path;		/* corners of the route being computed */
+  gint alloc_route_path;
+
+  glong crossings;		/* edge crossings left by the last layout */
 
   /* get/settables */
 
   gdouble nodesep;
   gdouble ranksep;
+  gint crossing_iterations;
+  gint crossing_time;		/* milliseconds, 0 for no limit */
+  gint threads;			/* 0 for one per processor */
+  GraphLayoutRouting routing;
+  GraphLayoutMode mode;
+
+  struct GraphLayoutQuad *quad;	/* quadtree of the force directed layout */
+  gint quads;
+  gint alloc_quads;
+  gdouble force_step;		/* longest move in the next iteration */
+  gdouble force_energy;		/* sum of the squared forces, last iteration */
+  gint force_progress;		/* iterations in a row lowering the energy */
+  glong force_revision;		/* revision the force state is for */
+
+  GThreadPool *workers;		/* lays out components, created on demand */
+  gint component_job;		/* laying out part of another layout */
+
+  GraphLayoutConnection *pending;	/* connections recorded by a batch */
+  glong alloc_pending;
+  glong pending_connections;
+  gint batch;			/* nesting depth of graph_layout_begin() */
+
+  gint groups;			/* nodes that are groups */
+
+  gchar *cache_path;		/* layout cache file, NULL for none */
+
+  glong revision;		/* bumped by every edit of the graph */
+  struct GraphLayoutJob *job;	/* pending asynchronous relayout */
+  GThreadPool *job_worker;	/* runs asynchronous relayouts */
+  gint *cancelled;		/* stop crossing reduction early when set */
 }
 GraphLayout;
 
-static inline gint
-node_rank (GraphLayout * gl, gint node_no, gint startrank)
+static void
+free_ranks (struct GraphLayout *gl)
 {
-  gint i;
-  gint maxrank = startrank;
-  for (i = 0; gl->connection[i]; i++)
-    {
-      GraphLayoutConnection *connection = gl->connection[i];
-      if (connection->to_node_no == node_no)
-	{
-	  gint rank = node_rank (gl, connection->from_node_no, startrank + 1);
-	  if (rank > maxrank)
-	    maxrank = rank;
-	}
-    }
-  return maxrank;
+  free (gl->rank_line);
+  free (gl->rank_node);
+  gl->rank_line = NULL;
+  gl->rank_node = NULL;
+  gl->ranks = 0;
+  gl->ranks_stale = 0;
 }
 
+typedef struct GraphLayoutRankKey
+{
+  gint rank;
+  gint order;
+  gdouble x;
+  GraphLayoutNode *node;
+} GraphLayoutRankKey;
+
+static gint
+rank_key_compare (const void *a, const void *b)
+{
+  const GraphLayoutRankKey *ka = a;
+  const GraphLayoutRankKey *kb = b;
+
+  if (ka->rank != kb->rank)
+    return ka->rank < kb->rank ? -1 : 1;
+  if (ka->order != kb->order)
+    return ka->order < kb->order ? -1 : 1;
+  if (ka->x != kb->x)
+    return ka->x < kb->x ? -1 : 1;
+  return 0;
+}
+
+/* rebuild the rank lines from the rank and order of the nodes, the
+ * orders being renumbered from 0 in every rank; nodes with the same
+ * order, such as nodes placed by an incremental relayout, follow each
+ * other from left to right. Members of groups have no order.
+ */
 static void
-init_data (struct GraphLayout *gl)
+ranks_rebuild (struct GraphLayout *gl)
 {
+  GraphLayoutRankKey *key;
+  gint ranks = 0;
+  gint count = 0;
   gint node_no;
+  gint i;
 
-  for (node_no = 0; gl->node[node_no]; node_no++)
+  free_ranks (gl);
+  key = malloc (sizeof (GraphLayoutRankKey) * (gl->nodes + 1));
+  if (!key)
+    return;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
     {
       GraphLayoutNode *node = gl->node[node_no];
-      node->x = -1;
-      node->y = -1;
-      node->done = 0;
+      if (node->order < 0 || node->rank < 0)
+	continue;
+      key[count].rank = node->rank;
+      key[count].order = node->order;
+      key[count].x = gl->x[node_no];
+      key[count].node = node;
+      ranks = MAX (ranks, node->rank + 1);
+      count++;
+    }
+  if (!count)
+    {
+      free (key);
+      return;
+    }
+  qsort (key, count, sizeof (GraphLayoutRankKey), rank_key_compare);
+
+  gl->rank_line = calloc (ranks, sizeof (rank_line));
+  gl->rank_node = malloc (sizeof (GraphLayoutNode *) * (gl->nodes + 1));
+  if (!gl->rank_line || !gl->rank_node)
+    {
+      free (key);
+      free_ranks (gl);
+      return;
     }
+  gl->ranks = ranks;
+  for (i = 0; i < count; i++)
+    {
+      rank_line *line = &gl->rank_line[key[i].rank];
+      if (!line->node)
+	line->node = gl->rank_node + i;
+      key[i].node->order = line->nodes++;
+      gl->rank_node[i] = key[i].node;
+    }
+  free (key);
 }
 
+/* bring the rank lines up to date after incremental relayouts */
+static void
+ranks_update (struct GraphLayout *gl)
+{
+  if (gl->ranks_stale)
+    ranks_rebuild (gl);
+}
 
-static gdouble
-hor_coord (struct GraphLayout *gl, gdouble ver_coord)
+/* Longest path layering, a node's rank is one more than the highest
+ * rank among its providers. gl->node[] is in topological order after
+ * toposort() so a single pass suffices; a connection pointing back to
+ * a node placed before is reversed, making its consumer the provider.
+ */
+static void
+assign_ranks (struct GraphLayout *gl)
 {
   gint node_no;
-  gdouble max = 0;
+  gint rank;
+  gint i;
+
+  free_ranks (gl);
+  if (!gl->nodes)
+    return;
 
   for (node_no = 0; node_no < gl->nodes; node_no++)
     {
-      if (gl->node[node_no]->y == ver_coord && gl->node[node_no]->x > max)
+      GraphLayoutNode *node = gl->node[node_no];
+      node->rank = 0;
+      for (i = 0; i < node->in.count; i++)
+	{
+	  gint from = gl->connection[node->in.conn[i]].from_node_no;
+	  if (from < node_no && gl->node[from]->rank >= node->rank)
+	    node->rank = gl->node[from]->rank + 1;
+	}
+      for (i = 0; i < node->out.count; i++)
 	{
-	  max = gl->node[node_no]->x;
+	  gint to = gl->connection[node->out.conn[i]].to_node_no;
+	  if (to < node_no && gl->node[to]->rank >= node->rank)
+	    node->rank = gl->node[to]->rank + 1;
 	}
+      if (node->rank >= gl->ranks)
+	gl->ranks = node->rank + 1;
+    }
+
+  gl->rank_line = calloc (gl->ranks, sizeof (rank_line));
+  gl->rank_node = malloc (sizeof (GraphLayoutNode *) * gl->nodes);
+  if (!gl->rank_line || !gl->rank_node)
+    {
+      fprintf (stderr, "graph_layout rank mem error\n");
+      free_ranks (gl);
+      return;
+    }
+
+  /* bucket the nodes by rank, keeping the topological order */
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    gl->rank_line[gl->node[node_no]->rank].nodes++;
+  for (rank = 0, i = 0; rank < gl->ranks; rank++)
+    {
+      gl->rank_line[rank].node = gl->rank_node + i;
+      i += gl->rank_line[rank].nodes;
+      gl->rank_line[rank].nodes = 0;
+    }
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      rank_line *line = &gl->rank_line[gl->node[node_no]->rank];
+      line->node[line->nodes++] = gl->node[node_no];
     }
-  return max + gl->nodesep;
 }
 
+/********* Per node adjacency ************/
 
-static void
-place_providers (struct GraphLayout *gl, gint node_no)
+static gint
+edge_pad (GraphLayout * gl, gint connection_no, gint incoming)
+{
+  GraphLayoutConnection *connection = &gl->connection[connection_no];
+  return incoming ? connection->to_pad : connection->from_pad;
+}
+
+/* binary search of a list ordered by pad, the index of the first
+ * connection on the pad or a later one
+ */
+static gint
+edges_search (GraphLayout * gl,
+	      GraphLayoutEdges * edges, gint pad, gint incoming)
 {
-  gint inpad;
+  gint low = 0;
+  gint high = edges->count;
 
-  for (inpad = 0; inpad < gl->node[node_no]->inpads; inpad++)
+  while (low < high)
     {
-      int conn_no;
-      for (conn_no = 0; conn_no < gl->connections; conn_no++)
-	{
-	  GraphLayoutConnection *connection = gl->connection[conn_no];
-	  if (connection->to_node_no == node_no &&
-	      connection->to_pad == inpad)
-	    {
+      gint middle = low + (high - low) / 2;
+      if (edge_pad (gl, edges->conn[middle], incoming) < pad)
+	low = middle + 1;
+      else
+	high = middle;
+    }
+  return low;
+}
 
-	      if (!gl->node[connection->from_node_no]->done)
-		{
-		  gl->node[connection->from_node_no]->y =
-		    gl->node[node_no]->y - gl->ranksep;
-		  gl->node[connection->from_node_no]->x =
-		    hor_coord (gl, gl->node[connection->from_node_no]->y);
-		  if (gl->node[connection->from_node_no]->x <
-		      gl->node[node_no]->x)
-		    {
-		      gl->node[connection->from_node_no]->x =
-			gl->node[node_no]->x;
-		    }
-
-
-		  gl->node[connection->from_node_no]->done = 1;
-		  place_providers (gl, connection->from_node_no);
-		}
-	    }
+/* find the connection ending in an input pad of a node, -1 for none
+ */
+static gint
+connection_at (GraphLayout * gl, gint node_id, gint pad)
+{
+  GraphLayoutNode *node = id2node (gl, node_id);
+  gint i;
+
+  if (!node)
+    return -1;
+  i = edges_search (gl, &node->in, pad, 1);
+  if (i < node->in.count && gl->connection[node->in.conn[i]].to_pad == pad)
+    return node->in.conn[i];
+  return -1;
+}
+
+/* insert a connection number keeping the list ordered by pad, after
+ * the connections already on that pad
+ */
+static gint
+edges_insert (GraphLayout * gl,
+	      GraphLayoutEdges * edges, gint connection_no, gint incoming)
+{
+  gint pad = edge_pad (gl, connection_no, incoming);
+  gint i;
+
+  if (edges->count == edges->alloc)
+    {
+      gint alloc = edges->alloc ? edges->alloc * 2 : 2;
+      gint *newlist = realloc (edges->conn, sizeof (gint) * alloc);
+      if (!newlist)
+	{
+	  fprintf (stderr, "graph_layout edge mem error\n");
+	  return -1;
 	}
+      edges->conn = newlist;
+      edges->alloc = alloc;
+    }
+  if (!edges->count || edge_pad (gl, edges->conn[edges->count - 1],
+				  incoming) <= pad)
+    i = edges->count;		/* pads are mostly connected in order */
+  else
+    {
+      i = edges_search (gl, edges, pad + 1, incoming);
+      memmove (&edges->conn[i + 1], &edges->conn[i],
+	       sizeof (gint) * (edges->count - i));
+    }
+  edges->conn[i] = connection_no;
+  edges->count++;
+  return 0;
+}
+
+static void
+edges_remove (GraphLayoutEdges * edges, gint connection_no)
+{
+  gint i;
+  for (i = 0; i < edges->count; i++)
+    if (edges->conn[i] == connection_no)
+      {
+	memmove (&edges->conn[i], &edges->conn[i + 1],
+		 sizeof (gint) * (edges->count - i - 1));
+	edges->count--;
+	return;
+      }
+}
+
+static void
+edges_renumber (GraphLayoutEdges * edges, gint old_no, gint new_no)
+{
+  gint i;
+  for (i = 0; i < edges->count; i++)
+    if (edges->conn[i] == old_no)
+      {
+	edges->conn[i] = new_no;
+	return;
+      }
+}
+
+static void
+init_data (struct GraphLayout *gl)
+{
+  gint node_no;
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      gl->x[node_no] = -1;
+      gl->y[node_no] = -1;
+      node->row = 0;
+      node->done = 0;
     }
 }
 
 static gint
 is_sink (struct GraphLayout *gl, gint node_no)
 {
-  gint conn_no;
   GraphLayoutNode *node = gl->node[node_no];
 
   if (!node->outpads)
     return 1;
-  for (conn_no = 0; conn_no < gl->connections; conn_no++)
-    {
-      GraphLayoutConnection *connection = gl->connection[conn_no];
-      if (connection->from_node_no == node_no)
-	return 0;
-    }
-  return 1;
+  return node->out.count == 0;
 }
 
+/* Walk depth first up from each sink, visiting providers in pad order.
+ * The order in which nodes are reached is stored in their key, and is
+ * the starting order within ranks for crossing reduction. Nodes not
+ * upstream of any sink are appended in topological order.
+ */
 static void
 initial_order (struct GraphLayout *gl)
 {
+  struct
+  {
+    gint node_no;
+    gint edge;
+  } *stack;
+  gint depth;
+  gint visited = 0;
   gint node_no;
 
   init_data (gl);
+  stack = malloc (sizeof (*stack) * (gl->nodes + 1));
+  if (!stack)
+    return;
+
   for (node_no = 0; gl->node[node_no]; node_no++)
     {
       GraphLayoutNode *node = gl->node[node_no];
 
-      if (is_sink (gl, node_no))
+      if (node->done || !is_sink (gl, node_no))
+	continue;
+      node->done = 1;
+      node->key = visited++;
+      depth = 0;
+      stack[0].node_no = node_no;
+      stack[0].edge = 0;
+
+      while (depth >= 0)
 	{
-	  node->done = 1;
-	  node->y = 0;
-	  node->x = hor_coord (gl, 0);
-	  place_providers (gl, node_no);
+	  GraphLayoutNode *consumer = gl->node[stack[depth].node_no];
+	  GraphLayoutConnection *connection;
+	  GraphLayoutNode *provider;
+
+	  if (stack[depth].edge >= consumer->in.count)
+	    {
+	      depth--;
+	      continue;
+	    }
+	  connection = &gl->connection[consumer->in.conn[stack[depth].edge++]];
+	  if (connection->to_pad < 0 || connection->to_pad >= consumer->inpads)
+	    continue;
+	  provider = gl->node[connection->from_node_no];
+	  if (provider->done)
+	    continue;
+	  provider->done = 1;
+	  provider->key = visited++;
+	  depth++;
+	  stack[depth].node_no = connection->from_node_no;
+	  stack[depth].edge = 0;
 	}
     }
+
+  for (node_no = 0; gl->node[node_no]; node_no++)
+    if (!gl->node[node_no]->done)
+      gl->node[node_no]->key = visited++;
+  free (stack);
 }
 
-void
-graph_layout_relayout (struct GraphLayout *gl)
+/********* Crossing reduction ************/
+
+static int
+cmp_key (const void *a, const void *b)
 {
-  toposort (gl);
-  initial_order (gl);
-  center_graph (gl);
-  return;
+  const GraphLayoutNode *na = *(GraphLayoutNode * const *) a;
+  const GraphLayoutNode *nb = *(GraphLayoutNode * const *) b;
+
+  if (na->key < nb->key)
+    return -1;
+  if (na->key > nb->key)
+    return 1;
+  return na->order - nb->order;
 }
 
-/* Instantiate a new graph layout engine
- */
-struct GraphLayout *
-graph_layout_new (void)
+/* stable sort of a rank by the nodes' key, renumbering their order */
+static void
+sort_rank (rank_line * line)
 {
-  GraphLayout *gl = calloc (1, sizeof (GraphLayout));
-
-  gl->nodes = 0;
-  gl->connections = 0;
-  gl->max_nodeid = 0;
-  gl->alloc_nodes = 8;
-  gl->node = malloc (sizeof (struct GraphLayoutNode *) * gl->alloc_nodes);
-  gl->node[0] = NULL;
-  gl->alloc_connections = 8;
-  gl->connection =
-    malloc (sizeof (struct GraphLayoutConnection *) * gl->alloc_nodes);
-  gl->connection[0] = NULL;
+  gint i;
 
-  return gl;
+  qsort (line->node, line->nodes, sizeof (GraphLayoutNode *), cmp_key);
+  for (i = 0; i < line->nodes; i++)
+    line->node[i]->order = i;
 }
 
-/* Remove all node data within graph
+/* Count the crossings between the connections going from rank to
+ * rank + 1 with the accumulator tree of Barth, Juenger and Mutzel: the
+ * connections are radix sorted by north and then south position, and
+ * the inversions among their south positions are counted, which is
+ * O(E log V). Connections spanning several ranks are not counted.
  */
-void
-graph_layout_clear (struct GraphLayout *gl)
+static glong
+count_crossings (struct GraphLayout *gl, gint rank)
 {
-  while (graph_layout_node_count (gl))
-    graph_layout_node_free (gl, no2id (gl, 0));
-  gl->max_nodeid = 0;
-  gl->nodes = 0;
+  rank_line *north = &gl->rank_line[rank];
+  rank_line *south = &gl->rank_line[rank + 1];
+  gint *mem;
+  gint *start;			/* first edge of each north node */
+  gint *count;			/* edges per south position */
+  gint *edge_north;
+  gint *edge_south;
+  gint *by_south;
+  gint *seq;			/* south positions, by north then south */
+  gint *tree;
+  gint edges = 0;
+  gint first_index = 1;
+  glong crossings = 0;
+  gint i, j;
 
-  while (graph_layout_connection_count (gl))
-    remove_connection (gl, 0);
-  gl->connections = 0;
+  for (i = 0; i < north->nodes; i++)
+    {
+      GraphLayoutEdges *out = &north->node[i]->out;
+      for (j = 0; j < out->count; j++)
+	if (gl->node[gl->connection[out->conn[j]].to_node_no]->rank ==
+	    rank + 1)
+	  edges++;
+    }
+  if (edges < 2)
+    return 0;
+
+  while (first_index < south->nodes)
+    first_index *= 2;
+
+  mem = calloc ((north->nodes + 1) + (south->nodes + 1) + 4 * edges +
+		2 * first_index, sizeof (gint));
+  if (!mem)
+    return 0;
+  start = mem;
+  count = start + north->nodes + 1;
+  edge_north = count + south->nodes + 1;
+  edge_south = edge_north + edges;
+  by_south = edge_south + edges;
+  seq = by_south + edges;
+  tree = seq + edges;
+
+  /* gathered per north node, so already grouped by north position */
+  edges = 0;
+  for (i = 0; i < north->nodes; i++)
+    {
+      GraphLayoutEdges *out = &north->node[i]->out;
+      start[i] = edges;
+      for (j = 0; j < out->count; j++)
+	{
+	  GraphLayoutNode *to =
+	    gl->node[gl->connection[out->conn[j]].to_node_no];
+	  if (to->rank != rank + 1)
+	    continue;
+	  edge_north[edges] = i;
+	  edge_south[edges] = to->order;
+	  count[to->order + 1]++;
+	  edges++;
+	}
+    }
+
+  /* counting sort by south position, then stably back into the north
+   * groups, leaves every group ordered by south position */
+  for (i = 0; i < south->nodes; i++)
+    count[i + 1] += count[i];
+  for (i = 0; i < edges; i++)
+    by_south[count[edge_south[i]]++] = i;
+  for (i = 0; i < edges; i++)
+    {
+      gint edge = by_south[i];
+      seq[start[edge_north[edge]]++] = edge_south[edge];
+    }
+
+  /* every south position entered adds the number of already entered
+   * positions to its right */
+  first_index -= 1;
+  for (i = 0; i < edges; i++)
+    {
+      gint index = seq[i] + first_index;
+      tree[index]++;
+      while (index > 0)
+	{
+	  if (index % 2)
+	    crossings += tree[index + 1];
+	  index = (index - 1) / 2;
+	  tree[index]++;
+	}
+    }
+
+  free (mem);
+  return crossings;
 }
 
-/* Dispose of a graph layout engine
- */
-void
-graph_layout_free (struct GraphLayout *gl)
+static glong
+total_crossings (struct GraphLayout *gl)
 {
-  graph_layout_clear (gl);
-  free (gl->node);
-  free (gl->connection);
-  free (gl);
+  glong crossings = 0;
+  gint rank;
+
+  for (rank = 0; rank + 1 < gl->ranks; rank++)
+    crossings += count_crossings (gl, rank);
+  return crossings;
 }
 
-/* Set the minimum nodeseperation used in the layout
+/* Reorder a rank by the barycenter of the positions of the nodes it is
+ * connected to in the ranks already swept, positions are normalized by
+ * the size of their rank so that connections spanning several ranks
+ * contribute too. Nodes without such neighbours keep their place.
  */
-void
-graph_layout_nodesep_set (struct GraphLayout *gl, gdouble nodesep)
+static void
+barycenter_rank (struct GraphLayout *gl, gint rank, gint downward)
 {
-  gl->nodesep = nodesep;
+  rank_line *line = &gl->rank_line[rank];
+  gint i, j;
+
+  for (i = 0; i < line->nodes; i++)
+    {
+      GraphLayoutNode *node = line->node[i];
+      GraphLayoutEdges *edges = downward ? &node->in : &node->out;
+      gdouble sum = 0.0;
+      gint n = 0;
+
+      for (j = 0; j < edges->count; j++)
+	{
+	  GraphLayoutConnection *connection = &gl->connection[edges->conn[j]];
+	  GraphLayoutNode *other = gl->node[downward ?
+					    connection->from_node_no :
+					    connection->to_node_no];
+	  if (downward ? other->rank >= rank : other->rank <= rank)
+	    continue;
+	  sum += (other->order + 0.5) / gl->rank_line[other->rank].nodes;
+	  n++;
+	}
+      node->key = n ? sum / n : (node->order + 0.5) / line->nodes;
+    }
+  sort_rank (line);
 }
 
-/* Set the nodeseperation used in the layout
+/* Alternate downward and upward barycenter sweeps, keeping the
+ * ordering with the fewest crossings. Stops after the configured
+ * number of iterations, when the time budget is spent, or when a few
+ * sweeps in a row bring no improvement.
  */
-void
-graph_layout_ranksep_set (struct GraphLayout *gl, gdouble ranksep)
+static void
+reduce_crossings (struct GraphLayout *gl)
+{
+  gint64 deadline = 0;
+  gint *best;
+  glong crossings;
+  gint stale = 0;
+  gint iteration;
+  gint node_no;
+  gint rank;
+
+  gl->crossings = total_crossings (gl);
+  if (!gl->crossings || gl->ranks < 2)
+    return;
+
+  best = malloc (sizeof (gint) * gl->nodes);
+  if (!best)
+    return;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    best[node_no] = gl->node[node_no]->order;
+  if (gl->crossing_time > 0)
+    deadline = g_get_monotonic_time () + gl->crossing_time * (gint64) 1000;
+
+  for (iteration = 0; iteration < gl->crossing_iterations; iteration++)
+    {
+      if (iteration % 2 == 0)
+	for (rank = 1; rank < gl->ranks; rank++)
+	  barycenter_rank (gl, rank, 1);
+      else
+	for (rank = gl->ranks - 2; rank >= 0; rank--)
+	  barycenter_rank (gl, rank, 0);
+
+      crossings = total_crossings (gl);
+      if (crossings < gl->crossings)
+	{
+	  gl->crossings = crossings;
+	  for (node_no = 0; node_no < gl->nodes; node_no++)
+	    best[node_no] = gl->node[node_no]->order;
+	  stale = 0;
+	}
+      else if (++stale >= 4)
+	break;
+      if (!gl->crossings)
+	break;
+      if (deadline && g_get_monotonic_time () > deadline)
+	break;
+      if (gl->cancelled && g_atomic_int_get (gl->cancelled))
+	break;
+    }
+
+  /* restore the best ordering found */
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      gl->rank_line[node->rank].node[best[node_no]] = node;
+      node->order = best[node_no];
+    }
+  free (best);
+}
+
+/* Order each rank by the depth first visiting order, which is a good
+ * starting point for the sweeps.
+ */
+static void
+initial_rank_order (struct GraphLayout *gl)
+{
+  gint rank, i;
+
+  for (rank = 0; rank < gl->ranks; rank++)
+    {
+      rank_line *line = &gl->rank_line[rank];
+      for (i = 0; i < line->nodes; i++)
+	line->node[i]->order = i;
+      sort_rank (line);
+    }
+}
+
+/********* Horizontal coordinate assignment ************/
+
+/* x offset of a pad from the center of a node, matching the end points
+ * given by graph_layout_connection_get_coords()
+ */
+static gdouble
+pad_offset (gdouble width, gint pad, gint pads)
+{
+  if (pads <= 0)
+    return 0.0;
+  return -width * 0.9 / 2 + (width * 0.9 / pads) * (pad + 0.5);
+}
+
+/* Vertical alignment in the manner of Brandes and Koepf: going down the
+ * ranks, each node is put in the block of the provider on its median
+ * input pad in the rank above, when that provider is not aligned yet
+ * and the alignment does not cross one made further left. Blocks are
+ * offset so that the aligned pads line up and the connection is drawn
+ * straight down.
+ */
+static void
+align_blocks (struct GraphLayout *gl)
+{
+  gint rank, i, j;
+
+  for (i = 0; i < gl->nodes; i++)
+    {
+      gl->node[i]->root = i;
+      gl->node[i]->below = -1;
+      gl->node[i]->offset = 0.0;
+    }
+
+  for (rank = 1; rank < gl->ranks; rank++)
+    {
+      rank_line *line = &gl->rank_line[rank];
+      gint last = -1;		/* order of the last aligned provider */
+
+      for (i = 0; i < line->nodes; i++)
+	{
+	  GraphLayoutNode *node = line->node[i];
+	  gint upper[2];
+	  gint count = 0;
+	  gint median;
+
+	  /* the incoming connections are ordered by pad */
+	  for (j = 0; j < node->in.count; j++)
+	    if (gl->node[gl->connection[node->in.conn[j]].from_node_no]->
+		rank == rank - 1)
+	      count++;
+	  if (!count)
+	    continue;
+	  upper[0] = (count - 1) / 2;
+	  upper[1] = count / 2;
+
+	  for (median = 0; median < 2; median++)
+	    {
+	      GraphLayoutConnection *connection = NULL;
+	      GraphLayoutNode *provider;
+	      gint n = 0;
+
+	      if (median && upper[1] == upper[0])
+		break;
+	      for (j = 0; j < node->in.count; j++)
+		{
+		  connection = &gl->connection[node->in.conn[j]];
+		  if (gl->node[connection->from_node_no]->rank != rank - 1)
+		    continue;
+		  if (n++ == upper[median])
+		    break;
+		}
+	      provider = gl->node[connection->from_node_no];
+	      if (provider->below != -1 || provider->order <= last)
+		continue;
+
+	      provider->below = node->no;
+	      node->root = provider->root;
+	      node->offset = provider->offset +
+		pad_offset (gl->width[provider->no], connection->from_pad,
+			    provider->outpads) -
+		pad_offset (gl->width[node->no], connection->to_pad,
+			    node->inpads);
+	      last = provider->order;
+	      break;
+	    }
+	}
+    }
+}
+
+/* Compact the blocks to the left. Every node with a left neighbour in
+ * its rank constrains its block's root to lie at least the separation
+ * right of the neighbour's block; the constraints form a DAG over the
+ * roots whose longest paths, taken in topological order, give the
+ * smallest x for every block. Linear in nodes.
+ */
+static gint
+compact_blocks (struct GraphLayout *gl)
+{
+  gint *start;
+  gint *target;
+  gdouble *weight;
+  gint *indegree;
+  gint *queue;
+  gdouble *root_x;
+  gint head = 0;
+  gint tail = 0;
+  gint roots = 0;
+  gint rank, i;
+
+  start = calloc (gl->nodes + 1, sizeof (gint));
+  target = malloc (sizeof (gint) * (gl->nodes + 1));
+  weight = malloc (sizeof (gdouble) * (gl->nodes + 1));
+  indegree = calloc (gl->nodes, sizeof (gint));
+  queue = malloc (sizeof (gint) * gl->nodes);
+  root_x = calloc (gl->nodes, sizeof (gdouble));
+  if (!start || !target || !weight || !indegree || !queue || !root_x)
+    goto out;
+
+  /* constraint edges, bucketed by the root of the left neighbour */
+  for (rank = 0; rank < gl->ranks; rank++)
+    {
+      rank_line *line = &gl->rank_line[rank];
+      for (i = 1; i < line->nodes; i++)
+	start[line->node[i - 1]->root + 1]++;
+    }
+  for (i = 0; i < gl->nodes; i++)
+    start[i + 1] += start[i];
+  for (rank = 0; rank < gl->ranks; rank++)
+    {
+      rank_line *line = &gl->rank_line[rank];
+      for (i = 1; i < line->nodes; i++)
+	{
+	  GraphLayoutNode *left = line->node[i - 1];
+	  GraphLayoutNode *node = line->node[i];
+	  gint edge = start[left->root]++;
+	  target[edge] = node->root;
+	  weight[edge] = left->offset - node->offset +
+	    gl->width[left->no] / 2 + gl->nodesep + gl->width[node->no] / 2;
+	  indegree[node->root]++;
+	}
+    }
+  for (i = gl->nodes; i > 0; i--)
+    start[i] = start[i - 1];
+  start[0] = 0;
+
+  for (i = 0; i < gl->nodes; i++)
+    if (gl->node[i]->root == i)
+      {
+	roots++;
+	if (!indegree[i])
+	  queue[tail++] = i;
+      }
+  while (head < tail)
+    {
+      gint root = queue[head++];
+      for (i = start[root]; i < start[root + 1]; i++)
+	{
+	  if (root_x[root] + weight[i] > root_x[target[i]])
+	    root_x[target[i]] = root_x[root] + weight[i];
+	  if (--indegree[target[i]] == 0)
+	    queue[tail++] = target[i];
+	}
+    }
+
+  if (tail == roots)
+    for (i = 0; i < gl->nodes; i++)
+      gl->x[i] = root_x[gl->node[i]->root] + gl->node[i]->offset;
+
+out:
+  free (start);
+  free (target);
+  free (weight);
+  free (indegree);
+  free (queue);
+  free (root_x);
+  return tail == roots && roots;
+}
+
+/* Place every rank on its own row and assign x coordinates with block
+ * alignment and compaction, O(N + E) overall. Should the compaction
+ * fail the ranks are simply packed left to right.
+ */
+static void
+place_ranks (struct GraphLayout *gl)
+{
+  gint compacted;
+  gint rank, i;
+
+  align_blocks (gl);
+  compacted = compact_blocks (gl);
+
+  for (rank = 0; rank < gl->ranks; rank++)
+    {
+      rank_line *line = &gl->rank_line[rank];
+      gdouble right = 0.0;
+      for (i = 0; i < line->nodes; i++)
+	{
+	  GraphLayoutNode *node = line->node[i];
+	  if (!compacted)
+	    {
+	      gl->x[node->no] = right + (i ? gl->nodesep : 0.0) +
+		gl->width[node->no] / 2;
+	      right = gl->x[node->no] + gl->width[node->no] / 2;
+	    }
+	  node->row = rank;
+	  gl->y[node->no] = rank * gl->ranksep;
+	  node->done = 1;
+	}
+    }
+}
+
+/********* Force directed layout ************/
+
+/* Nodes repel each other with a force of k^2 / d and connections pull
+ * their ends together with d^2 / k, after Fruchterman and Reingold, so
+ * graphs with cycles are laid out as well as acyclic ones. The
+ * repulsion is approximated in the manner of Barnes and Hut: the nodes
+ * in a quadtree cell that is small as seen from a node act on it as a
+ * single mass, making an iteration O(N log N). Each node moves at most
+ * a step per iteration, the step is adapted to the progress made as
+ * proposed by Hu. Positions are kept between runs, so a layout is
+ * continued from where it was left and edits settle in a few steps.
+ */
+
+#define GL_FORCE_THETA      1.0	/* cell size over distance to lump it */
+#define GL_FORCE_DEPTH      24	/* cells deeper than this are not split */
+#define GL_FORCE_COOLING    0.9
+#define GL_FORCE_GRAVITY    0.02	/* pull towards the center, keeps
+					   components together */
+#define GL_FORCE_SETTLED    0.02	/* largest move of a settled layout,
+					   relative to k */
+#define GL_FORCE_ITERATIONS 300	/* at most, for a full relayout */
+
+typedef struct GraphLayoutQuad
+{
+  gdouble x;			/* center of mass, a sum while building */
+  gdouble y;
+  gdouble mass;
+  gdouble left;
+  gdouble top;
+  gdouble size;
+  gint child;			/* first of the four children, 0 for a leaf */
+  gint body;			/* node_no of the first node in a leaf, the
+				   others follow in next */
+} GraphLayoutQuad;
+
+/* ideal length of a connection, from the node sizes and separations */
+static gdouble
+force_k (struct GraphLayout *gl)
+{
+  gdouble extent = 0.0;
+  gint node_no;
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    extent += gl->width[node_no] + gl->height[node_no];
+  return MAX (extent / 2 / MAX (gl->nodes, 1) +
+	      MAX (gl->nodesep, gl->ranksep), 1.0);
+}
+
+/* give nodes that were never placed a position next to the placed
+ * nodes they are connected to, or else on a spiral around the origin
+ */
+static void
+force_seed (struct GraphLayout *gl, gdouble k)
+{
+  gint seeded = 0;
+  gint node_no;
+  gint side, i;
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      gdouble x = 0.0;
+      gdouble y = 0.0;
+      gint placed = 0;
+      gdouble angle;
+
+      if (node->done)
+	continue;
+      for (side = 0; side < 2; side++)
+	{
+	  GraphLayoutEdges *edges = side ? &node->out : &node->in;
+	  for (i = 0; i < edges->count; i++)
+	    {
+	      GraphLayoutConnection *connection =
+		&gl->connection[edges->conn[i]];
+	      GraphLayoutNode *other =
+		id2node (gl, side ? connection->to_node_id :
+			 connection->from_node_id);
+	      if (other && other->done)
+		{
+		  x += gl->x[other->no];
+		  y += gl->y[other->no];
+		  placed++;
+		}
+	    }
+	}
+      /* the golden angle spreads consecutive nodes evenly */
+      angle = seeded++ * 2.39996;
+      if (placed)
+	{
+	  gl->x[node_no] = x / placed + k * cos (angle);
+	  gl->y[node_no] = y / placed + k * sin (angle);
+	}
+      else
+	{
+	  gl->x[node_no] = k * sqrt (seeded) * cos (angle);
+	  gl->y[node_no] = k * sqrt (seeded) * sin (angle);
+	}
+      node->done = 1;
+    }
+}
+
+/* return: index of a new empty cell, -1 when out of memory */
+static gint
+quad_new (struct GraphLayout *gl, gdouble left, gdouble top, gdouble size)
+{
+  GraphLayoutQuad *quad;
+
+  if (gl->quads == gl->alloc_quads)
+    {
+      gint alloc = gl->alloc_quads ? gl->alloc_quads * 2 : 64;
+      GraphLayoutQuad *newlist =
+	realloc (gl->quad, sizeof (GraphLayoutQuad) * alloc);
+      if (!newlist)
+	return -1;
+      gl->quad = newlist;
+      gl->alloc_quads = alloc;
+    }
+  quad = &gl->quad[gl->quads];
+  quad->x = quad->y = quad->mass = 0.0;
+  quad->left = left;
+  quad->top = top;
+  quad->size = size;
+  quad->child = 0;
+  quad->body = -1;
+  return gl->quads++;
+}
+
+static gint
+quad_child (GraphLayoutQuad * quad, gdouble x, gdouble y)
+{
+  gdouble half = quad->size / 2;
+  return quad->child + (x >= quad->left + half) +
+    2 * (y >= quad->top + half);
+}
+
+/* build the quadtree over the node positions, next links the nodes
+ * sharing a leaf
+ * return: -1 when out of memory
+ */
+static gint
+force_tree (struct GraphLayout *gl, gint * next)
+{
+  gdouble left = G_MAXDOUBLE;
+  gdouble top = G_MAXDOUBLE;
+  gdouble size = 0.0;
+  gint node_no;
+  gint q;
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      left = MIN (left, gl->x[node_no]);
+      top = MIN (top, gl->y[node_no]);
+    }
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    size = MAX (size, MAX (gl->x[node_no] - left, gl->y[node_no] - top));
+
+  gl->quads = 0;
+  if (quad_new (gl, left, top, size * 1.001 + 1.0) < 0)
+    return -1;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      gdouble x = gl->x[node_no];
+      gdouble y = gl->y[node_no];
+      gint depth = 0;
+
+      next[node_no] = -1;
+      q = 0;
+      for (;;)
+	{
+	  GraphLayoutQuad *quad = &gl->quad[q];
+
+	  quad->x += x;
+	  quad->y += y;
+	  quad->mass += 1.0;
+	  if (quad->child)
+	    {
+	      q = quad_child (quad, x, y);
+	      depth++;
+	      continue;
+	    }
+	  if (quad->body == -1)
+	    {
+	      quad->body = node_no;
+	      break;
+	    }
+	  if (depth >= GL_FORCE_DEPTH)
+	    {			/* nodes on the same spot share the leaf */
+	      next[node_no] = quad->body;
+	      quad->body = node_no;
+	      break;
+	    }
+
+	  /* split the leaf, moving its node down */
+	  {
+	    gdouble half = quad->size / 2;
+	    gint body = quad->body;
+	    gint child = quad_new (gl, quad->left, quad->top, half);
+	    GraphLayoutQuad *moved;
+
+	    if (child < 0 ||
+		quad_new (gl, quad->left + half, quad->top, half) < 0 ||
+		quad_new (gl, quad->left, quad->top + half, half) < 0 ||
+		quad_new (gl, quad->left + half, quad->top + half, half) < 0)
+	      return -1;
+	    quad = &gl->quad[q];	/* the cells may have moved */
+	    quad->child = child;
+	    quad->body = -1;
+	    moved = &gl->quad[quad_child (quad, gl->x[body], gl->y[body])];
+	    moved->x = gl->x[body];
+	    moved->y = gl->y[body];
+	    moved->mass = 1.0;
+	    moved->body = body;
+	    q = quad_child (quad, x, y);
+	    depth++;
+	  }
+	}
+    }
+
+  for (q = 0; q < gl->quads; q++)
+    if (gl->quad[q].mass > 0.0)
+      {
+	gl->quad[q].x /= gl->quad[q].mass;
+	gl->quad[q].y /= gl->quad[q].mass;
+      }
+  return 0;
+}
+
+/* list the nodes leaf by leaf, nodes that are close to each other
+ * then follow each other and look at the same cells
+ */
+static void
+force_order (struct GraphLayout *gl, const gint * next, gint * order)
+{
+  gint stack[3 * GL_FORCE_DEPTH + 4];
+  gint top = 0;
+  gint count = 0;
+
+  stack[top++] = 0;
+  while (top)
+    {
+      GraphLayoutQuad *quad = &gl->quad[stack[--top]];
+      gint i;
+
+      if (quad->child)
+	{
+	  for (i = 3; i >= 0; i--)
+	    if (gl->quad[quad->child + i].mass > 0.0)
+	      stack[top++] = quad->child + i;
+	  continue;
+	}
+      for (i = quad->body; i != -1; i = next[i])
+	order[count++] = i;
+    }
+}
+
+/* add the repulsion of all other nodes on a node to its force */
+static void
+force_repulsion (struct GraphLayout *gl, const gint * next, gint node_no,
+		 gdouble k, gdouble * force)
+{
+  gdouble k2 = k * k;
+  gint stack[4 * GL_FORCE_DEPTH + 4];
+  gint top = 0;
+  gdouble x = gl->x[node_no];
+  gdouble y = gl->y[node_no];
+
+  stack[top++] = 0;
+  while (top)
+    {
+      GraphLayoutQuad *quad = &gl->quad[stack[--top]];
+      gdouble dx = x - quad->x;
+      gdouble dy = y - quad->y;
+      gdouble d2 = dx * dx + dy * dy;
+      gint i;
+
+      if (quad->child &&
+	  quad->size * quad->size >= GL_FORCE_THETA * GL_FORCE_THETA * d2)
+	{			/* too close to lump, look at the children */
+	  for (i = 0; i < 4; i++)
+	    if (gl->quad[quad->child + i].mass > 0.0)
+	      stack[top++] = quad->child + i;
+	  continue;
+	}
+      if (!quad->child && d2 < k2)
+	{			/* a close leaf, look at its nodes */
+	  for (i = quad->body; i != -1; i = next[i])
+	    {
+	      if (i == node_no)
+		continue;
+	      dx = x - gl->x[i];
+	      dy = y - gl->y[i];
+	      d2 = dx * dx + dy * dy;
+	      if (d2 < 1e-6)
+		/* nodes on the same spot, part them by their order */
+		force[0] += i < node_no ? k : -k;
+	      else
+		{
+		  force[0] += dx * k2 / d2;
+		  force[1] += dy * k2 / d2;
+		}
+	    }
+	  continue;
+	}
+      force[0] += dx * k2 * quad->mass / d2;
+      force[1] += dy * k2 * quad->mass / d2;
+    }
+}
+
+/* Run up to iterations rounds of the force directed layout,
+ * return: 1 while nodes are still moving, 0 once the layout settled
+ */
+static gint
+force_run (struct GraphLayout *gl, gint iterations)
+{
+  gdouble *force;
+  gint *order;
+  gdouble k;
+  gdouble settled;
+  gint moving = 0;
+  gint node_no;
+  gint i;
+
+  if (!gl->nodes)
+    return 0;
+  k = force_k (gl);
+  settled = k * GL_FORCE_SETTLED;
+  force_seed (gl, k);
+  add_connection_no (gl);
+  if (gl->force_revision != gl->revision || gl->force_step <= 0.0)
+    {				/* the graph changed, heat it up again */
+      gl->force_step = k;
+      gl->force_energy = G_MAXDOUBLE;
+      gl->force_progress = 0;
+    }
+  force = malloc (sizeof (gdouble) * 2 * gl->nodes);
+  order = malloc (sizeof (gint) * 2 * gl->nodes);
+  if (!force || !order)
+    {
+      fprintf (stderr, "graph_layout force mem error\n");
+      free (force);
+      free (order);
+      return 0;
+    }
+
+  for (; iterations > 0; iterations--)
+    {
+      gdouble energy = 0.0;
+      gdouble largest = 0.0;
+      gdouble center_x;
+      gdouble center_y;
+
+      if (force_tree (gl, order + gl->nodes))
+	{
+	  fprintf (stderr, "graph_layout force mem error\n");
+	  break;
+	}
+      force_order (gl, order + gl->nodes, order);
+      center_x = gl->quad[0].x;
+      center_y = gl->quad[0].y;
+      for (i = 0; i < gl->nodes; i++)
+	{
+	  gdouble *f;
+
+	  node_no = order[i];
+	  f = force + 2 * node_no;
+	  f[0] = (center_x - gl->x[node_no]) * GL_FORCE_GRAVITY;
+	  f[1] = (center_y - gl->y[node_no]) * GL_FORCE_GRAVITY;
+	  force_repulsion (gl, order + gl->nodes, node_no, k, f);
+	}
+      for (i = 0; i < gl->connections; i++)
+	{
+	  GraphLayoutConnection *connection = &gl->connection[i];
+	  gint from = connection->from_node_no;
+	  gint to = connection->to_node_no;
+	  gdouble dx = gl->x[to] - gl->x[from];
+	  gdouble dy = gl->y[to] - gl->y[from];
+	  gdouble d = sqrt (dx * dx + dy * dy);
+
+	  force[2 * from] += dx * d / k;
+	  force[2 * from + 1] += dy * d / k;
+	  force[2 * to] -= dx * d / k;
+	  force[2 * to + 1] -= dy * d / k;
+	}
+
+      for (node_no = 0; node_no < gl->nodes; node_no++)
+	{
+	  gdouble *f = force + 2 * node_no;
+	  gdouble length = sqrt (f[0] * f[0] + f[1] * f[1]);
+	  gdouble move = MIN (length, gl->force_step);
+
+	  if (length > 0.0)
+	    {
+	      gl->x[node_no] += f[0] / length * move;
+	      gl->y[node_no] += f[1] / length * move;
+	    }
+	  energy += length * length;
+	  largest = MAX (largest, move);
+	}
+
+      if (energy < gl->force_energy)
+	{
+	  if (++gl->force_progress >= 5)
+	    {
+	      gl->force_progress = 0;
+	      gl->force_step /= GL_FORCE_COOLING;
+	    }
+	}
+      else
+	{
+	  gl->force_progress = 0;
+	  gl->force_step *= GL_FORCE_COOLING;
+	}
+      gl->force_energy = energy;
+      moving = largest >= settled && gl->force_step >= settled;
+      if (!moving)
+	break;
+    }
+  free (force);
+  free (order);
+  gl->revision++;
+  gl->force_revision = gl->revision;
+  return moving;
+}
+
+/* Select the layout algorithm used by graph_layout_relayout()
+ */
+void
+graph_layout_mode_set (struct GraphLayout *gl, GraphLayoutMode mode)
+{
+  gl->mode = mode;
+}
+
+GraphLayoutMode
+graph_layout_mode_get (struct GraphLayout *gl)
+{
+  return gl->mode;
+}
+
+/* run some iterations of the force directed layout from the current
+ * positions, for instance one per frame
+ */
+gint
+graph_layout_force_step (struct GraphLayout *gl, gint iterations)
+{
+  gint moving;
+
+  batch_flush (gl);
+  moving = force_run (gl, iterations);
+  grid_build (gl);
+  routes_check (gl);
+  return moving;
+}
+
+/********* Connected components ************/
+
+/* Weakly connected components share no connections, so they are laid
+ * out independently, in parallel on a thread pool when the graph is
+ * large enough, and the resulting bounding boxes are shelf packed. A
+ * job lays out a run of components in a private GraphLayout; the
+ * grouping into jobs only depends on the graph, so the result does not
+ * depend on the number of threads.
+ */
+
+#define GL_JOB_NODES 1024	/* nodes to gather before starting a new job */
+
+static gint
+component_find (gint * parent, gint node_no)
+{
+  while (parent[node_no] != node_no)
+    {
+      parent[node_no] = parent[parent[node_no]];
+      node_no = parent[node_no];
+    }
+  return node_no;
+}
+
+/* label the weakly connected components with union find, components
+ * are numbered in the order of their first node in gl->node[]
+ * return: the number of components
+ */
+static gint
+find_components (struct GraphLayout *gl, gint * component)
+{
+  gint *parent = malloc (sizeof (gint) * gl->nodes);
+  gint components = 0;
+  gint node_no;
+  gint i;
+
+  if (!parent)
+    return 0;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    parent[node_no] = node_no;
+  for (i = 0; i < gl->connections; i++)
+    {
+      gint a = component_find (parent, gl->connection[i].from_node_no);
+      gint b = component_find (parent, gl->connection[i].to_node_no);
+      if (a != b)
+	parent[MAX (a, b)] = MIN (a, b);
+    }
+
+  /* roots are the lowest node of their set, so they are labeled first */
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      gint root = component_find (parent, node_no);
+      component[node_no] = root == node_no ? components++ : component[root];
+    }
+  free (parent);
+  return components;
+}
+
+typedef struct
+{
+  GMutex lock;
+  GCond done;
+  gint pending;
+} ComponentWait;
+
+typedef struct
+{
+  struct GraphLayout *gl;
+  ComponentWait *wait;
+  gint *node;			/* node_no of the nodes laid out by the job */
+  gint nodes;
+  gint *local;			/* handle in the job's layout, by node_no */
+  gint *conn_map;		/* connection number in the job's layout */
+  gint index;
+  glong crossings;
+} ComponentJob;
+
+/* copy an edge list, renumbering the connections */
+static gint
+edges_copy (GraphLayoutEdges * dest, const GraphLayoutEdges * src,
+	    const gint * conn_map)
+{
+  gint i;
+
+  dest->conn = malloc (sizeof (gint) * MAX (src->count, 1));
+  if (!dest->conn)
+    return -1;
+  for (i = 0; i < src->count; i++)
+    dest->conn[i] = conn_map[src->conn[i]];
+  dest->count = src->count;
+  dest->alloc = MAX (src->count, 1);
+  return 0;
+}
+
+/* a new empty layout with the same settings as gl */
+static struct GraphLayout *
+layout_new_like (struct GraphLayout *gl)
+{
+  struct GraphLayout *sub = graph_layout_new ();
+
+  if (!sub)
+    return NULL;
+  sub->nodesep = gl->nodesep;
+  sub->ranksep = gl->ranksep;
+  sub->crossing_iterations = gl->crossing_iterations;
+  sub->crossing_time = gl->crossing_time;
+  sub->threads = gl->threads;
+  sub->mode = gl->mode;
+  return sub;
+}
+
+/* Copy the given nodes, and the connections between them, into a new
+ * layout with the same settings; local gets the handle of the copy of
+ * each node by node_no, conn_map the number of the copy of each
+ * connection. The edge lists keep their order, so the copy is laid out
+ * exactly like the original. Connections to nodes outside the set must
+ * not exist. Only reads gl, so copies of disjoint sets can be made from
+ * several threads sharing local and conn_map.
+ */
+static struct GraphLayout *
+layout_copy (struct GraphLayout *gl, const gint * node, gint nodes,
+	     gint * local, gint * conn_map)
+{
+  struct GraphLayout *sub = layout_new_like (gl);
+  gint connections = 0;
+  gint i, j;
+
+  if (!sub)
+    return NULL;
+
+  for (i = 0; i < nodes; i++)
+    {
+      gint node_no = node[i];
+      gint id = graph_layout_node_new (sub);
+      GraphLayoutNode *n = id2node (sub, id);
+
+      local[node_no] = id;
+      if (!n)
+	goto fail;
+      n->inpads = gl->node[node_no]->inpads;
+      n->outpads = gl->node[node_no]->outpads;
+      sub->width[n->no] = gl->width[node_no];
+      sub->height[n->no] = gl->height[node_no];
+      sub->x[n->no] = gl->x[node_no];	/* force directed layouts go on */
+      sub->y[n->no] = gl->y[node_no];	/* from where they are */
+      n->done = gl->node[node_no]->done;
+      connections += gl->node[node_no]->in.count;
+    }
+  for (i = 0; gl->groups && i < nodes; i++)
+    {				/* groups refer to nodes of the set */
+      GraphLayoutNode *from = gl->node[node[i]];
+      GraphLayoutNode *n = sub->node[i];
+      gint group = id2no (gl, from->group);
+
+      n->group = group == -1 ? 0 : local[group];
+      n->hidden = from->hidden;
+      n->group_x = from->group_x;
+      n->group_y = from->group_y;
+      if (from->meta)
+	{
+	  n->meta = malloc (sizeof (GraphLayoutGroup));
+	  if (!n->meta)
+	    goto fail;
+	  *n->meta = *from->meta;
+	  sub->groups++;
+	}
+    }
+
+  if (connections > sub->alloc_connections)
+    {
+      GraphLayoutConnection *newlist =
+	realloc (sub->connection, sizeof (GraphLayoutConnection) * connections);
+      if (!newlist)
+	goto fail;
+      sub->connection = newlist;
+      sub->alloc_connections = connections;
+    }
+  for (i = 0; i < nodes; i++)
+    {
+      GraphLayoutEdges *in = &gl->node[node[i]]->in;
+      for (j = 0; j < in->count; j++)
+	{
+	  GraphLayoutConnection *connection = &gl->connection[in->conn[j]];
+	  GraphLayoutConnection *copy = &sub->connection[sub->connections];
+
+	  *copy = *connection;
+	  copy->route = NULL;
+	  copy->route_points = copy->route_alloc = 0;
+	  copy->shown_from_id = copy->shown_to_id = 0;
+	  copy->from_node_id = local[id2no (gl, connection->from_node_id)];
+	  copy->to_node_id = local[node[i]];
+	  conn_map[in->conn[j]] = sub->connections++;
+	}
+    }
+  for (i = 0; i < nodes; i++)
+    {
+      GraphLayoutNode *n = sub->node[i];
+      if (edges_copy (&n->in, &gl->node[node[i]]->in, conn_map) ||
+	  edges_copy (&n->out, &gl->node[node[i]]->out, conn_map))
+	goto fail;
+    }
+  return sub;
+
+fail:
+  graph_layout_free (sub);
+  return NULL;
+}
+
+static void
+component_job_run (gpointer data, gpointer user_data)
+{
+  ComponentJob *job = data;
+  struct GraphLayout *gl = job->gl;
+  struct GraphLayout *sub;
+  gint i;
+  (void) user_data;
+
+  sub = layout_copy (gl, job->node, job->nodes, job->local, job->conn_map);
+  if (!sub)
+    goto done;
+  sub->component_job = 1;
+  graph_layout_relayout (sub);
+
+  for (i = 0; i < job->nodes; i++)
+    {
+      gint node_no = job->node[i];
+      GraphLayoutNode *n = id2node (sub, job->local[node_no]);
+      if (!n)
+	continue;
+      gl->x[node_no] = sub->x[n->no];
+      gl->node[node_no]->row = n->row;
+      gl->node[node_no]->done = n->done;
+      /* ranks list the jobs one after the other */
+      gl->node[node_no]->key = (gdouble) job->index * gl->nodes + n->order;
+    }
+  job->crossings = sub->crossings;
+  graph_layout_free (sub);
+
+done:
+  g_mutex_lock (&job->wait->lock);
+  if (--job->wait->pending == 0)
+    g_cond_signal (&job->wait->done);
+  g_mutex_unlock (&job->wait->lock);
+}
+
+/* lay out groups of components as separate jobs, placing nodes in rows
+ * relative to their component
+ * return: 0 when the graph fits in a single job, which is better laid
+ *         out in place
+ */
+static gint
+layout_components (struct GraphLayout *gl, const gint * component,
+		   gint components)
+{
+  ComponentWait wait;
+  ComponentJob *job;
+  gint *job_of;			/* job number of each component */
+  gint *job_node;
+  gint *local;
+  gint *conn_map;
+  gint jobs = 0;
+  gint size = 0;
+  gint threads;
+  gint node_no;
+  gint c, i;
+
+  /* consecutive components are grouped until a job has enough nodes */
+  job_of = calloc (components, sizeof (gint));
+  if (!job_of)
+    return 0;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    job_of[component[node_no]]++;
+  for (c = 0; c < components; c++)
+    {
+      gint nodes = job_of[c];
+      if (!jobs || size >= GL_JOB_NODES)
+	{
+	  jobs++;
+	  size = 0;
+	}
+      job_of[c] = jobs - 1;
+      size += nodes;
+    }
+  if (jobs < 2)
+    {
+      free (job_of);
+      return 0;
+    }
+
+  job = calloc (jobs, sizeof (ComponentJob));
+  job_node = malloc (sizeof (gint) * gl->nodes);
+  local = malloc (sizeof (gint) * gl->nodes);
+  conn_map = malloc (sizeof (gint) * (gl->connections + 1));
+  if (!job || !job_node || !local || !conn_map)
+    {
+      free (job);
+      free (job_node);
+      free (local);
+      free (conn_map);
+      free (job_of);
+      return 0;
+    }
+
+  /* bucket the nodes by job, keeping the topological order */
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    job[job_of[component[node_no]]].nodes++;
+  for (i = 0, size = 0; i < jobs; i++)
+    {
+      job[i].node = job_node + size;
+      size += job[i].nodes;
+      job[i].nodes = 0;
+    }
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      ComponentJob *j = &job[job_of[component[node_no]]];
+      j->node[j->nodes++] = node_no;
+    }
+
+  g_mutex_init (&wait.lock);
+  g_cond_init (&wait.done);
+  wait.pending = jobs;
+  for (i = 0; i < jobs; i++)
+    {
+      job[i].gl = gl;
+      job[i].wait = &wait;
+      job[i].local = local;
+      job[i].conn_map = conn_map;
+      job[i].index = i;
+    }
+
+  threads = gl->threads > 0 ? gl->threads : (gint) g_get_num_processors ();
+  if (threads > 1 && (!gl->workers ||
+		      g_thread_pool_get_max_threads (gl->workers) != threads))
+    {
+      if (gl->workers)
+	g_thread_pool_free (gl->workers, FALSE, TRUE);
+      gl->workers = g_thread_pool_new (component_job_run, NULL, threads,
+				       FALSE, NULL);
+    }
+
+  for (i = 0; i < jobs; i++)
+    if (threads < 2 || !gl->workers ||
+	!g_thread_pool_push (gl->workers, &job[i], NULL))
+      component_job_run (&job[i], NULL);
+
+  g_mutex_lock (&wait.lock);
+  while (wait.pending)
+    g_cond_wait (&wait.done, &wait.lock);
+  g_mutex_unlock (&wait.lock);
+  g_cond_clear (&wait.done);
+  g_mutex_clear (&wait.lock);
+
+  /* no connection runs between jobs, so the crossings add up */
+  gl->crossings = 0;
+  for (i = 0; i < jobs; i++)
+    gl->crossings += job[i].crossings;
+  for (i = 0; i < gl->ranks; i++)
+    sort_rank (&gl->rank_line[i]);
+
+  free (job);
+  free (job_node);
+  free (local);
+  free (conn_map);
+  free (job_of);
+  return 1;
+}
+
+typedef struct
+{
+  gint component;
+  gdouble left;
+  gdouble right;
+  gint row0;
+  gint row1;
+} ComponentBox;
+
+static int
+cmp_box (const void *a, const void *b)
+{
+  const ComponentBox *ba = a;
+  const ComponentBox *bb = b;
+  gint rows = (bb->row1 - bb->row0) - (ba->row1 - ba->row0);
+
+  if (rows)
+    return rows;
+  if (bb->right - bb->left != ba->right - ba->left)
+    return bb->right - bb->left > ba->right - ba->left ? 1 : -1;
+  return ba->component - bb->component;
+}
+
+/* Shelf pack the components, tallest first, onto shelves about as wide
+ * as a square holding all of them. Shelves start on whole rows so that
+ * y stays origin_y + row * ranksep for the incremental layout.
+ */
+static void
+pack_components (struct GraphLayout *gl, const gint * component,
+		 gint components)
+{
+  ComponentBox *box = malloc (sizeof (ComponentBox) * components);
+  gdouble *shift_x = malloc (sizeof (gdouble) * components);
+  gint *shift_row = malloc (sizeof (gint) * components);
+  gdouble area = 0.0;
+  gdouble limit = 0.0;
+  gdouble shelf_x = 0.0;
+  gint shelf_row = 0;
+  gint shelf_rows = 0;
+  gint node_no;
+  gint c;
+
+  if (!box || !shift_x || !shift_row)
+    goto out;
+
+  for (c = 0; c < components; c++)
+    {
+      box[c].component = c;
+      box[c].left = G_MAXDOUBLE;
+      box[c].right = -G_MAXDOUBLE;
+      box[c].row0 = G_MAXINT;
+      box[c].row1 = G_MININT;
+    }
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      ComponentBox *b = &box[component[node_no]];
+      GraphLayoutNode *node = gl->node[node_no];
+      b->left = MIN (b->left, gl->x[node_no] - gl->width[node_no] / 2);
+      b->right = MAX (b->right, gl->x[node_no] + gl->width[node_no] / 2);
+      b->row0 = MIN (b->row0, node->row);
+      b->row1 = MAX (b->row1, node->row + 1);
+    }
+  for (c = 0; c < components; c++)
+    {
+      gdouble width = box[c].right - box[c].left + gl->nodesep;
+      area += width * (box[c].row1 - box[c].row0 + 1) * gl->ranksep;
+      limit = MAX (limit, width);
+    }
+  limit = MAX (limit, sqrt (area));
+  qsort (box, components, sizeof (ComponentBox), cmp_box);
+
+  for (c = 0; c < components; c++)
+    {
+      gdouble width = box[c].right - box[c].left;
+      if (shelf_x > 0.0 && shelf_x + width > limit)
+	{			/* start a new shelf, a row apart */
+	  shelf_row += shelf_rows + 1;
+	  shelf_rows = 0;
+	  shelf_x = 0.0;
+	}
+      shift_x[box[c].component] = shelf_x - box[c].left;
+      shift_row[box[c].component] = shelf_row - box[c].row0;
+      shelf_rows = MAX (shelf_rows, box[c].row1 - box[c].row0);
+      shelf_x += width + gl->nodesep;
+    }
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      c = component[node_no];
+      gl->x[node_no] += shift_x[c];
+      node->row += shift_row[c];
+      gl->y[node_no] = node->row * gl->ranksep;
+    }
+
+out:
+  free (box);
+  free (shift_x);
+  free (shift_row);
+}
+
+/* list the components one after the other in every rank, so that
+ * connections of different components, which no longer meet once
+ * packed, are not counted as crossing
+ */
+static void
+separate_components (struct GraphLayout *gl, const gint * component)
+{
+  gint node_no;
+  gint rank;
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      node->key = (gdouble) component[node_no] * gl->nodes + node->order;
+    }
+  for (rank = 0; rank < gl->ranks; rank++)
+    sort_rank (&gl->rank_line[rank]);
+  gl->crossings = total_crossings (gl);
+}
+
+/* Set the number of threads laying out components in parallel, 0 uses
+ * one per processor and 1 lays them out on the calling thread
+ */
+void
+graph_layout_threads_set (struct GraphLayout *gl, gint threads)
+{
+  gl->threads = MAX (threads, 0);
+}
+
+gint
+graph_layout_threads_get (struct GraphLayout *gl)
+{
+  return gl->threads;
+}
+
+/********* Groups ************/
+
+/* A group is a node standing for a set of member nodes, which may be
+ * groups themselves. Each level of the hierarchy is laid out on its
+ * own, as the graph of its direct members in a private layout: an
+ * expanded group is as large as its content and a collapsed one keeps
+ * its own size, while connections crossing the boundary of a group
+ * attach to pads aggregated on it. Levels are laid out innermost
+ * first, and the content of an expanded group is kept relative to its
+ * center until something in it changes. Collapsed groups are not laid
+ * out at all, their members are hidden at the position of the
+ * outermost collapsed group, so the work done by a relayout follows
+ * what is visible rather than the size of the graph.
+ */
+
+#define GL_GROUP_MARGIN     8.0	/* around the content of a group */
+
+/* a connection crossing the boundary of a group */
+typedef struct
+{
+  gint group;			/* node_no of the group */
+  gint input;			/* entering the group */
+  gint connection;
+  gint inner;			/* node_no of the end inside the group */
+  gint pad;			/* pad of the inner end */
+  gdouble key;			/* x of the inner end within the group */
+} GroupPad;
+
+/* the hierarchy as of one relayout, indexed by node_no; the top level
+ * is numbered gl->nodes
+ */
+typedef struct
+{
+  gint *parent;			/* node_no of the group, or gl->nodes */
+  gint *depth;
+  gint *by_depth;		/* node_nos, outermost first */
+  gint *shown;			/* node_no of the outermost collapsed group
+				   around it, or itself */
+  gint *child_first;		/* members of each level, by level */
+  gint *child;
+  gint *conn_first;		/* connections laid out with each level */
+  gint *conn;
+  gint *level;			/* innermost level holding both ends, by
+				   connection */
+  gint *item_from;		/* the members of that level holding the */
+  gint *item_to;		/* ends */
+  gint *pad_from;		/* pads on those members */
+  gint *pad_to;
+  gint *local;			/* handle in the layout of a level */
+  GroupPad *pad;
+  gint pads;
+  gint *pad_first;		/* boundary crossings, by group */
+} GroupPass;
+
+/* the content of the groups holding a node has to be laid out again */
+static void
+group_touch (struct GraphLayout *gl, GraphLayoutNode * node)
+{
+  GraphLayoutNode *group;
+
+  for (group = id2node (gl, node->group); group;
+       group = id2node (gl, group->group))
+    group->meta->dirty = 1;
+}
+
+static void
+group_touch_connection (struct GraphLayout *gl,
+			GraphLayoutConnection * connection)
+{
+  GraphLayoutNode *from = id2node (gl, connection->from_node_id);
+  GraphLayoutNode *to = id2node (gl, connection->to_node_id);
+
+  if (from)
+    group_touch (gl, from);
+  if (to)
+    group_touch (gl, to);
+}
+
+static void
+group_pass_free (GroupPass * pass)
+{
+  free (pass->parent);
+  free (pass->depth);
+  free (pass->by_depth);
+  free (pass->shown);
+  free (pass->child_first);
+  free (pass->child);
+  free (pass->conn_first);
+  free (pass->conn);
+  free (pass->level);
+  free (pass->item_from);
+  free (pass->item_to);
+  free (pass->pad_from);
+  free (pass->pad_to);
+  free (pass->local);
+  free (pass->pad);
+  free (pass->pad_first);
+}
+
+/* bucket count items by key in 0..keys-1, first gets the start of
+ * every bucket and one past the end
+ */
+static void
+group_bucket (const gint * key, gint count, gint keys, gint * first,
+	      gint * sorted)
+{
+  gint i;
+
+  for (i = 0; i <= keys; i++)
+    first[i] = 0;
+  for (i = 0; i < count; i++)
+    first[key[i] + 1]++;
+  for (i = 0; i < keys; i++)
+    first[i + 1] += first[i];
+  for (i = 0; i < count; i++)
+    sorted[first[key[i]]++] = i;
+  for (i = keys; i > 0; i--)
+    first[i] = first[i - 1];
+  first[0] = 0;
+}
+
+/* work out the hierarchy: levels, depths and what is hidden
+ * return: -1 when out of memory
+ */
+static gint
+group_tree (struct GraphLayout *gl, GroupPass * pass)
+{
+  gint nodes = gl->nodes;
+  gint *stack = pass->by_depth;	/* free until sorted by depth */
+  gint *depth_first;
+  gint node_no;
+  gint i;
+
+  for (node_no = 0; node_no < nodes; node_no++)
+    {
+      gint group = id2no (gl, gl->node[node_no]->group);
+      pass->parent[node_no] = group == -1 ? nodes : group;
+      pass->depth[node_no] = -1;
+    }
+  for (node_no = 0; node_no < nodes; node_no++)
+    {
+      gint top = 0;
+      gint n = node_no;
+
+      while (n != nodes && pass->depth[n] == -1)
+	{
+	  stack[top++] = n;
+	  n = pass->parent[n];
+	}
+      for (i = n == nodes ? -1 : pass->depth[n]; top--;)
+	pass->depth[stack[top]] = ++i;
+    }
+
+  depth_first = malloc (sizeof (gint) * (nodes + 1));
+  if (!depth_first)
+    return -1;
+  group_bucket (pass->depth, nodes, nodes, depth_first, pass->by_depth);
+  free (depth_first);
+  group_bucket (pass->parent, nodes, nodes + 1, pass->child_first,
+		pass->child);
+
+  for (i = 0; i < nodes; i++)
+    {
+      gint n = pass->by_depth[i];
+      gint parent = pass->parent[n];
+
+      if (parent == nodes || pass->shown[parent] != parent)
+	pass->shown[n] = parent == nodes ? n : pass->shown[parent];
+      else
+	pass->shown[n] = gl->node[parent]->meta->collapsed ? parent : n;
+      gl->node[n]->hidden = pass->shown[n] != n;
+    }
+  return 0;
+}
+
+/* find the level every connection is laid out in, and the groups whose
+ * boundary it crosses
+ * return: -1 when out of memory
+ */
+static gint
+group_connections (struct GraphLayout *gl, GroupPass * pass)
+{
+  gint nodes = gl->nodes;
+  gint alloc = 0;
+  gint *group_of;
+  gint *sorted;
+  GroupPad *pad;
+  gint i;
+
+  pass->pads = 0;
+  for (i = 0; i < gl->connections; i++)
+    {
+      GraphLayoutConnection *connection = &gl->connection[i];
+      gint from = connection->from_node_no;
+      gint to = connection->to_node_no;
+      gint a = from;
+      gint b = to;
+      gint side;
+
+      connection->shown_from_id = connection->shown_to_id = 0;
+      pass->pad_from[i] = connection->from_pad;
+      pass->pad_to[i] = connection->to_pad;
+      if (a == b)		/* a node feeding itself */
+	a = b = pass->parent[a];
+      while (a != b)
+	{
+	  if (pass->depth[a] >= pass->depth[b])
+	    a = pass->parent[a];
+	  else
+	    b = pass->parent[b];
+	}
+      pass->level[i] = a;
+      if (pass->shown[from] != from && pass->shown[to] == pass->shown[from])
+	/* both ends hidden in the same collapsed group */
+	connection->shown_from_id = connection->shown_to_id =
+	  gl->node[pass->shown[from]]->id;
+
+      for (side = 0; side < 2; side++)
+	{
+	  gint inner = side ? to : from;
+	  gint n = inner;
+
+	  while (pass->parent[n] != pass->level[i])
+	    {
+	      GroupPad *crossing;
+
+	      if (pass->pads == alloc)
+		{
+		  GroupPad *newlist;
+		  alloc = alloc ? alloc * 2 : 64;
+		  newlist = realloc (pass->pad, sizeof (GroupPad) * alloc);
+		  if (!newlist)
+		    return -1;
+		  pass->pad = newlist;
+		}
+	      n = pass->parent[n];
+	      crossing = &pass->pad[pass->pads++];
+	      crossing->group = n;
+	      crossing->input = side;
+	      crossing->connection = i;
+	      crossing->inner = inner;
+	      crossing->pad = side ? connection->to_pad :
+		connection->from_pad;
+	    }
+	  if (side)
+	    pass->item_to[i] = n;
+	  else
+	    pass->item_from[i] = n;
+	}
+    }
+  group_bucket (pass->level, gl->connections, nodes + 1, pass->conn_first,
+		pass->conn);
+
+  /* order the crossings by group */
+  group_of = calloc (pass->pads + 1, sizeof (gint));
+  sorted = malloc (sizeof (gint) * (pass->pads + 1));
+  pad = malloc (sizeof (GroupPad) * (pass->pads + 1));
+  if (!group_of || !sorted || !pad)
+    {
+      free (group_of);
+      free (sorted);
+      free (pad);
+      return -1;
+    }
+  for (i = 0; i < pass->pads; i++)
+    group_of[i] = pass->pad[i].group;
+  group_bucket (group_of, pass->pads, nodes, pass->pad_first, sorted);
+  for (i = 0; i < pass->pads; i++)
+    pad[i] = pass->pad[sorted[i]];
+  free (pass->pad);
+  pass->pad = pad;
+  free (group_of);
+  free (sorted);
+  return 0;
+}
+
+static int
+group_pad_cmp (const void *a, const void *b)
+{
+  const GroupPad *pa = a;
+  const GroupPad *pb = b;
+
+  if (pa->input != pb->input)
+    return pa->input - pb->input;
+  if (pa->key != pb->key)
+    return pa->key < pb->key ? -1 : 1;
+  if (pa->inner != pb->inner)
+    return pa->inner - pb->inner;
+  if (pa->pad != pb->pad)
+    return pa->pad - pb->pad;
+  return pa->connection - pb->connection;
+}
+
+/* number the pads of a group, left to right by the position of the
+ * inner ends; an input pad per connection entering the group, an output
+ * pad per pad of a member feeding connections out of it
+ */
+static void
+group_pads (struct GraphLayout *gl, GroupPass * pass, gint group_no)
+{
+  GraphLayoutNode *group = gl->node[group_no];
+  GroupPad *first = pass->pad + pass->pad_first[group_no];
+  gint count = pass->pad_first[group_no + 1] - pass->pad_first[group_no];
+  gint inpads = 0;
+  gint outpads = 0;
+  gint i;
+
+  for (i = 0; i < count; i++)
+    {
+      gint n = first[i].inner;
+
+      first[i].key = 0.0;
+      for (; n != group_no; n = pass->parent[n])
+	first[i].key += gl->node[n]->group_x;
+    }
+  qsort (first, count, sizeof (GroupPad), group_pad_cmp);
+
+  for (i = 0; i < count; i++)
+    {
+      GroupPad *crossing = &first[i];
+      GraphLayoutConnection *connection =
+	&gl->connection[crossing->connection];
+      gint pad;
+
+      if (crossing->input)
+	pad = inpads++;
+      else
+	{
+	  if (!i || crossing[-1].inner != crossing->inner ||
+	      crossing[-1].pad != crossing->pad)
+	    outpads++;
+	  pad = outpads - 1;
+	}
+
+      if (crossing->input)
+	{
+	  if (pass->item_to[crossing->connection] == group_no)
+	    pass->pad_to[crossing->connection] = pad;
+	  if (pass->shown[crossing->inner] == group_no)
+	    {
+	      connection->shown_to_id = group->id;
+	      connection->shown_to_pad = pad;
+	    }
+	}
+      else
+	{
+	  if (pass->item_from[crossing->connection] == group_no)
+	    pass->pad_from[crossing->connection] = pad;
+	  if (pass->shown[crossing->inner] == group_no)
+	    {
+	      connection->shown_from_id = group->id;
+	      connection->shown_from_pad = pad;
+	    }
+	}
+    }
+  group->inpads = inpads;
+  group->outpads = outpads;
+}
+
+/* ranks are a fixed pitch apart, spread them out where expanded groups
+ * are taller than that
+ */
+static void
+group_rows_fit (struct GraphLayout *sub)
+{
+  gint low = G_MAXINT;
+  gint high = G_MININT;
+  gdouble *tall;
+  gint node_no;
+  gint row;
+
+  if (!sub->nodes)
+    return;
+  for (node_no = 0; node_no < sub->nodes; node_no++)
+    {
+      low = MIN (low, sub->node[node_no]->row);
+      high = MAX (high, sub->node[node_no]->row);
+    }
+  tall = calloc (high - low + 1, sizeof (gdouble));
+  if (!tall)
+    return;
+  for (node_no = 0; node_no < sub->nodes; node_no++)
+    {
+      gdouble *height = &tall[sub->node[node_no]->row - low];
+      *height = MAX (*height, sub->height[node_no]);
+    }
+  /* tall becomes the distance to the row above, then the y of each row */
+  for (row = high - low; row > 0; row--)
+    tall[row] = MAX (sub->ranksep, (tall[row - 1] + tall[row]) / 2 +
+		     sub->nodesep);
+  for (tall[0] = 0.0, row = 1; row <= high - low; row++)
+    tall[row] += tall[row - 1];
+  for (node_no = 0; node_no < sub->nodes; node_no++)
+    sub->y[node_no] = tall[sub->node[node_no]->row - low];
+  free (tall);
+  center_graph (sub);
+}
+
+/* lay out the members of a level, the top level being gl->nodes, as a
+ * graph of their own; the content of a group is centered on it
+ * return: -1 when out of memory
+ */
+static gint
+group_level (struct GraphLayout *gl, GroupPass * pass, gint level)
+{
+  struct GraphLayout *sub = layout_new_like (gl);
+  gint *member = pass->child + pass->child_first[level];
+  gint members = pass->child_first[level + 1] - pass->child_first[level];
+  gint top = level == gl->nodes;
+  gdouble left = 0.0;
+  gdouble top_y = 0.0;
+  gdouble right = 0.0;
+  gdouble bottom = 0.0;
+  gint i;
+
+  if (!sub)
+    return -1;
+  for (i = 0; i < members; i++)
+    {
+      GraphLayoutNode *node = gl->node[member[i]];
+      gint id = graph_layout_node_new (sub);
+      GraphLayoutNode *n = id2node (sub, id);
+
+      if (!n)
+	{
+	  graph_layout_free (sub);
+	  return -1;
+	}
+      pass->local[member[i]] = id;
+      n->inpads = node->inpads;
+      n->outpads = node->outpads;
+      n->done = node->done;
+      sub->width[n->no] = gl->width[node->no];
+      sub->height[n->no] = gl->height[node->no];
+      /* force directed layouts go on from where they are */
+      sub->x[n->no] = top ? gl->x[node->no] : node->group_x;
+      sub->y[n->no] = top ? gl->y[node->no] : node->group_y;
+    }
+  graph_layout_begin (sub);
+  for (i = pass->conn_first[level]; i < pass->conn_first[level + 1]; i++)
+    {
+      gint c = pass->conn[i];
+      if (pass->item_from[c] != pass->item_to[c])
+	graph_layout_connection_set (sub, pass->local[pass->item_from[c]],
+				     pass->pad_from[c],
+				     pass->local[pass->item_to[c]],
+				     pass->pad_to[c]);
+    }
+  graph_layout_commit (sub);
+  graph_layout_relayout (sub);
+  if (sub->rank_line)
+    group_rows_fit (sub);
+
+  /* the connections at this level are reversed like their copies */
+  for (i = pass->conn_first[level]; i < pass->conn_first[level + 1]; i++)
+    {
+      gint c = pass->conn[i];
+      gint copy;
+      if (pass->item_from[c] == pass->item_to[c])
+	{			/* from a node to itself */
+	  gl->connection[c].reversed = 1;
+	  continue;
+	}
+      copy = connection_at (sub, pass->local[pass->item_to[c]],
+			    pass->pad_to[c]);
+      gl->connection[c].reversed = copy >= 0 &&
+	sub->connection[copy].reversed;
+    }
+
+  for (i = 0; i < members; i++)
+    {
+      GraphLayoutNode *node = gl->node[member[i]];
+      GraphLayoutNode *n = id2node (sub, pass->local[member[i]]);
+      gdouble x = sub->x[n->no];
+      gdouble y = sub->y[n->no];
+
+      if (top)
+	{
+	  gl->x[node->no] = x;
+	  gl->y[node->no] = y;
+	  node->rank = n->rank;
+	  node->order = n->order;
+	  node->row = n->row;
+	}
+      node->group_x = x;
+      node->group_y = y;
+      node->done = 1;
+      left = MIN (left, x - sub->width[n->no] / 2);
+      right = MAX (right, x + sub->width[n->no] / 2);
+      top_y = MIN (top_y, y - sub->height[n->no] / 2);
+      bottom = MAX (bottom, y + sub->height[n->no] / 2);
+    }
+
+  if (top)
+    {				/* the ranks hold the top level */
+      rank_line *lines = calloc (sub->ranks + 1, sizeof (rank_line));
+      GraphLayoutNode **rank_node =
+	malloc (sizeof (GraphLayoutNode *) * (members + 1));
+      gint rank, j;
+
+      free_ranks (gl);
+      gl->crossings = sub->crossings;
+      if (sub->rank_line && lines && rank_node)
+	{
+	  gl->rank_line = lines;
+	  gl->rank_node = rank_node;
+	  gl->ranks = sub->ranks;
+	  for (rank = 0, j = 0; rank < sub->ranks; rank++)
+	    {
+	      lines[rank].node = rank_node + j;
+	      lines[rank].nodes = sub->rank_line[rank].nodes;
+	      j += lines[rank].nodes;
+	    }
+	  for (i = 0; i < members; i++)
+	    {
+	      GraphLayoutNode *node = gl->node[member[i]];
+	      lines[node->rank].node[node->order] = node;
+	    }
+	}
+      else
+	{
+	  free (lines);
+	  free (rank_node);
+	}
+    }
+  else
+    {				/* the layout of sub is centered */
+      GraphLayoutGroup *meta = gl->node[level]->meta;
+      meta->content_width = right - left + 2 * GL_GROUP_MARGIN;
+      meta->content_height = bottom - top_y + 2 * GL_GROUP_MARGIN;
+      meta->dirty = 0;
+    }
+  graph_layout_free (sub);
+  return 0;
+}
+
+/* Lay out the levels that need it and place every node, or when layout
+ * is 0 only work out the pads and positions from the cached layouts of
+ * the levels.
+ */
+static void
+group_relayout (struct GraphLayout *gl, gint layout)
+{
+  GroupPass pass;
+  gint nodes = gl->nodes;
+  gint connections = gl->connections;
+  gint i;
+
+  memset (&pass, 0, sizeof (GroupPass));
+  add_connection_no (gl);
+  pass.parent = malloc (sizeof (gint) * (nodes + 1));
+  pass.depth = malloc (sizeof (gint) * (nodes + 1));
+  pass.by_depth = malloc (sizeof (gint) * (nodes + 1));
+  pass.shown = malloc (sizeof (gint) * (nodes + 1));
+  pass.child_first = malloc (sizeof (gint) * (nodes + 2));
+  pass.child = malloc (sizeof (gint) * (nodes + 1));
+  pass.conn_first = malloc (sizeof (gint) * (nodes + 2));
+  pass.conn = malloc (sizeof (gint) * (connections + 1));
+  pass.level = malloc (sizeof (gint) * (connections + 1));
+  pass.item_from = malloc (sizeof (gint) * (connections + 1));
+  pass.item_to = malloc (sizeof (gint) * (connections + 1));
+  pass.pad_from = malloc (sizeof (gint) * (connections + 1));
+  pass.pad_to = malloc (sizeof (gint) * (connections + 1));
+  pass.local = malloc (sizeof (gint) * (nodes + 1));
+  pass.pad_first = malloc (sizeof (gint) * (nodes + 1));
+  if (!pass.parent || !pass.depth || !pass.by_depth || !pass.shown ||
+      !pass.child_first || !pass.child || !pass.conn_first || !pass.conn ||
+      !pass.level || !pass.item_from || !pass.item_to || !pass.pad_from ||
+      !pass.pad_to || !pass.local || !pass.pad_first)
+    goto fail;
+  pass.depth[nodes] = -1;
+  if (group_tree (gl, &pass) || group_connections (gl, &pass))
+    goto fail;
+
+  /* innermost first, so that the size and pads of a group are known
+   * when the level holding it is laid out */
+  for (i = nodes - 1; i >= 0; i--)
+    {
+      gint node_no = pass.by_depth[i];
+      GraphLayoutNode *node = gl->node[node_no];
+      GraphLayoutGroup *meta = node->meta;
+
+      if (!meta || node->hidden)
+	continue;
+      if (layout && !meta->collapsed && meta->dirty &&
+	  group_level (gl, &pass, node_no))
+	goto fail;
+      gl->width[node_no] = meta->collapsed ? meta->width :
+	meta->content_width;
+      gl->height[node_no] = meta->collapsed ? meta->height :
+	meta->content_height;
+      group_pads (gl, &pass, node_no);
+    }
+  if (layout && group_level (gl, &pass, nodes))
+    goto fail;
+
+  /* outermost first, members follow their group */
+  for (i = 0; i < nodes; i++)
+    {
+      gint node_no = pass.by_depth[i];
+      gint parent = pass.parent[node_no];
+      GraphLayoutNode *node = gl->node[node_no];
+
+      if (parent == nodes)
+	continue;
+      node->rank = gl->node[parent]->rank;
+      node->order = -1;
+      if (node->hidden)
+	{
+	  gl->x[node_no] = gl->x[pass.shown[node_no]];
+	  gl->y[node_no] = gl->y[pass.shown[node_no]];
+	}
+      else
+	{
+	  gl->x[node_no] = gl->x[parent] + node->group_x;
+	  gl->y[node_no] = gl->y[parent] + node->group_y;
+	}
+    }
+  group_pass_free (&pass);
+  return;
+
+fail:
+  fprintf (stderr, "graph_layout group mem error\n");
+  group_pass_free (&pass);
+}
+
+/* Create a group, see graph_layout.h
+ */
+gint
+graph_layout_group_new (struct GraphLayout *gl)
+{
+  gint group = graph_layout_node_new (gl);
+  GraphLayoutNode *node = id2node (gl, group);
+
+  if (!node)
+    return -1;
+  node->meta = calloc (1, sizeof (GraphLayoutGroup));
+  if (!node->meta)
+    {
+      fprintf (stderr, "graph_layout group mem error\n");
+      graph_layout_node_free (gl, group);
+      return -1;
+    }
+  node->meta->dirty = 1;
+  node->meta->width = gl->width[node->no];
+  node->meta->height = gl->height[node->no];
+  gl->groups++;
+  return group;
+}
+
+/* Make a node a member of a group, 0 takes it out of its group
+ */
+void
+graph_layout_node_group_set (struct GraphLayout *gl, gint node, gint group)
+{
+  GraphLayoutNode *n = id2node (gl, node);
+  GraphLayoutNode *g = id2node (gl, group);
+  GraphLayoutNode *up;
+
+  if (!n || n->group == group || (group && (!g || !g->meta)))
+    return;
+  for (up = g; up; up = id2node (gl, up->group))
+    if (up == n)
+      return;			/* a group can not end up inside itself */
+  gl->revision++;
+  group_touch (gl, n);
+  n->group = group;
+  group_touch (gl, n);
+}
+
+gint
+graph_layout_node_group_get (struct GraphLayout *gl, gint node)
+{
+  GraphLayoutNode *n = id2node (gl, node);
+  return n ? n->group : 0;
+}
+
+/* Collapse or expand a group, the size it takes changes at once
+ */
+void
+graph_layout_group_collapsed_set (struct GraphLayout *gl, gint group,
+				  gint collapsed)
+{
+  GraphLayoutNode *g = id2node (gl, group);
+  GraphLayoutGroup *meta;
+
+  if (!g || !g->meta || g->meta->collapsed == !!collapsed)
+    return;
+  meta = g->meta;
+  gl->revision++;
+  meta->collapsed = !!collapsed;
+  group_touch (gl, g);
+  if (meta->collapsed || meta->content_width > 0.0)
+    {
+      gl->width[g->no] = collapsed ? meta->width : meta->content_width;
+      gl->height[g->no] = collapsed ? meta->height : meta->content_height;
+      grid_extents (gl, g);
+    }
+}
+
+gint
+graph_layout_group_collapsed_get (struct GraphLayout *gl, gint group)
+{
+  GraphLayoutNode *g = id2node (gl, group);
+  return g && g->meta ? g->meta->collapsed : 0;
+}
+
+/* check whether the last layout showed a node, rather than hiding it
+ * in a collapsed group
+ */
+gint
+graph_layout_node_visible (struct GraphLayout *gl, gint node)
+{
+  GraphLayoutNode *n = id2node (gl, node);
+  return n ? !n->hidden : 0;
+}
+
+/* check whether the last layout showed a connection, rather than
+ * hiding it in a collapsed group
+ */
+gint
+graph_layout_connection_visible (struct GraphLayout *gl, gint connection_no)
+{
+  GraphLayoutConnection *connection;
+
+  if (connection_no < 0 || connection_no >= gl->connections)
+    return 0;
+  connection = &gl->connection[connection_no];
+  return !connection->shown_from_id ||
+    connection->shown_from_id != connection->shown_to_id;
+}
+
+/********* Layout cache ************/
+
+/* A cache file keeps the last layout computed for a graph along with a
+ * hash of the structure of that graph, so reopening an unchanged
+ * document takes the layout from the file. Every node record carries a
+ * hash of the node and the connections ending in it as well; when the
+ * graph changed a little, nodes whose record still matches keep their
+ * cached place and only the others are placed, by an incremental
+ * relayout. Nodes are matched by handle, which a graph rebuilt in the
+ * same order gets again. The file is in native byte order.
+ */
+
+#define GL_CACHE_MAGIC      0x474c4332	/* "GLC2" */
+
+typedef struct GraphLayoutCacheHeader
+{
+  guint32 magic;
+  gint32 nodes;
+  guint64 hash;
+  gint32 ranks;
+  gint32 unsorted_nodes;
+  gint64 crossings;
+  gdouble origin_y;
+  gdouble force_step;
+  gint32 reversed;		/* connections listed after the nodes */
+  gint32 unused;
+} GraphLayoutCacheHeader;
+
+typedef struct GraphLayoutCacheRecord
+{
+  guint64 hash;
+  gint32 id;
+  gint32 rank;
+  gint32 order;
+  gint32 row;
+  gint32 done;
+  gint32 group_dirty;
+  gdouble x;
+  gdouble y;
+  gdouble width;		/* groups are as large as their content */
+  gdouble height;
+  gdouble group_x;
+  gdouble group_y;
+  gdouble content_width;
+  gdouble content_height;
+} GraphLayoutCacheRecord;
+
+/* a reversed connection, an input pad has one connection at most */
+typedef struct GraphLayoutCacheReversed
+{
+  gint32 from_id;
+  gint32 to_id;
+  gint32 to_pad;
+} GraphLayoutCacheReversed;
+
+enum
+{
+  GL_CACHE_MISS,
+  GL_CACHE_PARTIAL,		/* part of the nodes are placed */
+  GL_CACHE_HIT
+};
+
+/* combine a value into a hash, the splitmix64 finalizer */
+static guint64
+hash_mix (guint64 hash, guint64 value)
+{
+  guint64 z = hash + value + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static guint64
+hash_double (guint64 hash, gdouble value)
+{
+  guint64 bits;
+  memcpy (&bits, &value, sizeof (bits));
+  return hash_mix (hash, bits);
+}
+
+/* hash what the layout of a node depends on: its size, pads and group,
+ * and the connections ending in it, the latter in any order
+ */
+static guint64
+node_hash (struct GraphLayout *gl, GraphLayoutNode * node)
+{
+  guint64 hash = hash_mix (0, node->id);
+  guint64 in = 0;
+  gint i;
+
+  if (node->meta)
+    {
+      hash = hash_mix (hash, node->meta->collapsed);
+      hash = hash_double (hash, node->meta->width);
+      hash = hash_double (hash, node->meta->height);
+    }
+  else
+    {
+      hash = hash_double (hash, gl->width[node->no]);
+      hash = hash_double (hash, gl->height[node->no]);
+    }
+  hash = hash_mix (hash, node->inpads);
+  hash = hash_mix (hash, node->outpads);
+  hash = hash_mix (hash, node->group);
+  for (i = 0; i < node->in.count; i++)
+    {
+      GraphLayoutConnection *connection = &gl->connection[node->in.conn[i]];
+      in += hash_mix (hash_mix (hash_mix (0, connection->from_node_id),
+				connection->from_pad), connection->to_pad);
+    }
+  return hash_mix (hash, in);
+}
+
+/* hash the settings the layout depends on and the nodes, in any order */
+static guint64
+layout_hash (struct GraphLayout *gl)
+{
+  guint64 hash = hash_mix (0, gl->nodes);
+  guint64 nodes = 0;
+  gint node_no;
+
+  hash = hash_double (hash, gl->nodesep);
+  hash = hash_double (hash, gl->ranksep);
+  hash = hash_mix (hash, gl->crossing_iterations);
+  hash = hash_mix (hash, gl->mode);
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    nodes += node_hash (gl, gl->node[node_no]);
+  return hash_mix (hash, nodes);
+}
+
+/* write the current layout to the cache file, through a temporary file
+ * so a failed write leaves the previous cache in place
+ */
+static gint
+cache_save (struct GraphLayout *gl)
+{
+  GraphLayoutCacheHeader header;
+  FILE *file;
+  gchar *path;
+  gint node_no;
+  gint failed;
+  gint i;
+
+  path = malloc (strlen (gl->cache_path) + 5);
+  if (!path)
+    return -1;
+  sprintf (path, "%s.tmp", gl->cache_path);
+  file = fopen (path, "wb");
+  if (!file)
+    {
+      fprintf (stderr, "graph_layout cache: can not write %s\n", path);
+      free (path);
+      return -1;
+    }
+
+  ranks_update (gl);
+  memset (&header, 0, sizeof (header));
+  header.magic = GL_CACHE_MAGIC;
+  header.nodes = gl->nodes;
+  header.hash = layout_hash (gl);
+  header.ranks = gl->rank_line ? gl->ranks : 0;
+  header.unsorted_nodes = gl->unsorted_nodes;
+  header.crossings = gl->crossings;
+  header.origin_y = gl->origin_y;
+  header.force_step = gl->force_step;
+  for (i = 0; i < gl->connections; i++)
+    header.reversed += gl->connection[i].reversed;
+  failed = fwrite (&header, sizeof (header), 1, file) != 1;
+
+  for (node_no = 0; node_no < gl->nodes && !failed; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      GraphLayoutCacheRecord record;
+
+      memset (&record, 0, sizeof (record));
+      record.hash = node_hash (gl, node);
+      record.id = node->id;
+      record.rank = node->rank;
+      record.order = node->order;
+      record.row = node->row;
+      record.done = node->done;
+      record.x = gl->x[node_no];
+      record.y = gl->y[node_no];
+      record.width = gl->width[node_no];
+      record.height = gl->height[node_no];
+      record.group_x = node->group_x;
+      record.group_y = node->group_y;
+      if (node->meta)
+	{
+	  record.group_dirty = node->meta->dirty;
+	  record.content_width = node->meta->content_width;
+	  record.content_height = node->meta->content_height;
+	}
+      failed = fwrite (&record, sizeof (record), 1, file) != 1;
+    }
+  for (i = 0; i < gl->connections && !failed; i++)
+    {
+      GraphLayoutConnection *connection = &gl->connection[i];
+      GraphLayoutCacheReversed reversed;
+
+      if (!connection->reversed)
+	continue;
+      reversed.from_id = connection->from_node_id;
+      reversed.to_id = connection->to_node_id;
+      reversed.to_pad = connection->to_pad;
+      failed = fwrite (&reversed, sizeof (reversed), 1, file) != 1;
+    }
+
+  if (fclose (file) || failed || rename (path, gl->cache_path))
+    {
+      fprintf (stderr, "graph_layout cache: can not write %s\n", path);
+      remove (path);
+      free (path);
+      return -1;
+    }
+  free (path);
+  return 0;
+}
+
+/* rebuild the rank lines from the rank and order of the nodes, members
+ * of groups have no order
+ */
+static void
+cache_ranks (struct GraphLayout *gl, gint ranks)
+{
+  gint node_no;
+  gint rank, i;
+
+  free_ranks (gl);
+  if (ranks <= 0)
+    return;
+  gl->rank_line = calloc (ranks, sizeof (rank_line));
+  gl->rank_node = malloc (sizeof (GraphLayoutNode *) * (gl->nodes + 1));
+  if (!gl->rank_line || !gl->rank_node)
+    {
+      free_ranks (gl);
+      return;
+    }
+  gl->ranks = ranks;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      if (node->order < 0)
+	continue;
+      if (node->rank < 0 || node->rank >= ranks)
+	{
+	  free_ranks (gl);
+	  return;
+	}
+      gl->rank_line[node->rank].nodes++;
+    }
+  for (rank = 0, i = 0; rank < ranks; rank++)
+    {
+      gl->rank_line[rank].node = gl->rank_node + i;
+      i += gl->rank_line[rank].nodes;
+      memset (gl->rank_line[rank].node, 0,
+	      sizeof (GraphLayoutNode *) * gl->rank_line[rank].nodes);
+    }
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      rank_line *line;
+      if (node->order < 0)
+	continue;
+      line = &gl->rank_line[node->rank];
+      if (node->order >= line->nodes || line->node[node->order])
+	{
+	  free_ranks (gl);
+	  return;
+	}
+      line->node[node->order] = node;
+    }
+}
+
+/* mark the listed connections reversed, when they still exist */
+static void
+cache_reversed (struct GraphLayout *gl, GraphLayoutCacheHeader * header,
+		GraphLayoutCacheReversed * reversed)
+{
+  gint i;
+
+  for (i = 0; i < gl->connections; i++)
+    gl->connection[i].reversed = 0;
+  for (i = 0; i < header->reversed; i++)
+    {
+      gint c = connection_at (gl, reversed[i].to_id, reversed[i].to_pad);
+      if (c >= 0 && gl->connection[c].from_node_id == reversed[i].from_id)
+	gl->connection[c].reversed = 1;
+    }
+  reversed_count (gl);
+}
+
+/* the graph is the one the cache was written for, take the layout over
+ * as it was, node order included
+ */
+static gint
+cache_hit (struct GraphLayout *gl, GraphLayoutCacheHeader * header,
+	   GraphLayoutCacheRecord * record,
+	   GraphLayoutCacheReversed * reversed)
+{
+  gint *order = calloc (gl->nodes + 1, sizeof (gint));
+  gint node_no;
+
+  if (!order)
+    return GL_CACHE_MISS;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    gl->node[node_no]->done = 0;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = id2node (gl, record[node_no].id);
+      if (!node || node->done)
+	{
+	  free (order);
+	  return GL_CACHE_MISS;
+	}
+      node->done = 1;
+      order[node_no] = node->no;
+    }
+  if (node_permute (gl, order))
+    {
+      free (order);
+      return GL_CACHE_MISS;
+    }
+  free (order);
+  add_connection_no (gl);
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      GraphLayoutCacheRecord *r = &record[node_no];
+      gl->x[node_no] = r->x;
+      gl->y[node_no] = r->y;
+      node->rank = r->rank;
+      node->order = r->order;
+      node->row = r->row;
+      node->done = r->done;
+      node->group_x = r->group_x;
+      node->group_y = r->group_y;
+      if (node->meta)
+	{
+	  gl->width[node_no] = r->width;
+	  gl->height[node_no] = r->height;
+	  node->meta->dirty = r->group_dirty;
+	  node->meta->content_width = r->content_width;
+	  node->meta->content_height = r->content_height;
+	}
+    }
+  cache_ranks (gl, header->ranks);
+  cache_reversed (gl, header, reversed);
+  gl->unsorted_nodes = header->unsorted_nodes;
+  gl->crossings = header->crossings;
+  gl->origin_y = header->origin_y;
+  gl->force_step = header->force_step;
+  gl->force_revision = gl->revision;
+  if (gl->groups)
+    group_relayout (gl, 0);
+  rows_init (gl);
+  grid_build (gl);
+  routes_check (gl);
+  dirty_clear (gl);
+  gl->laid_out = 1;
+  return GL_CACHE_HIT;
+}
+
+/* the graph changed since the cache was written, place the nodes whose
+ * record still matches where they were, in their cached rank, and mark
+ * the others dirty. The graph is sorted again for its own cycles. A
+ * force directed layout continues from the cached positions instead,
+ * and groups are always laid out again, as is a graph cached without
+ * ranks.
+ */
+static gint
+cache_partial (struct GraphLayout *gl, GraphLayoutCacheHeader * header,
+	       GraphLayoutCacheRecord * record)
+{
+  gint matched = 0;
+  gint node_no;
+  gint i;
+
+  if (gl->groups || header->ranks <= 0)
+    return GL_CACHE_MISS;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      gl->node[node_no]->done = 0;
+      gl->node[node_no]->rank = -1;
+      gl->node[node_no]->order = -1;
+    }
+  for (i = 0; i < header->nodes; i++)
+    {
+      GraphLayoutNode *node = id2node (gl, record[i].id);
+      if (!node || node->done || node_hash (gl, node) != record[i].hash)
+	continue;
+      gl->x[node->no] = record[i].x;
+      gl->y[node->no] = record[i].y;
+      node->rank = record[i].rank;
+      node->order = record[i].order;
+      node->row = record[i].row;
+      node->done = 1;
+      matched++;
+    }
+  if (gl->mode == GRAPH_LAYOUT_FORCE ||
+      (gl->nodes - matched) * 4 > gl->nodes)
+    return GL_CACHE_MISS;
+
+  toposort (gl);
+  free_ranks (gl);
+  gl->ranks_stale = 1;
+  gl->crossings = 0;
+  gl->origin_y = header->origin_y;
+  gl->laid_out = 1;
+  dirty_clear (gl);
+  for (node_no = 0; node_no < gl->nodes && gl->laid_out; node_no++)
+    if (!gl->node[node_no]->done)
+      mark_dirty (gl, gl->node[node_no]);
+  if (!gl->laid_out)
+    return GL_CACHE_MISS;
+  rows_init (gl);
+  grid_build (gl);
+  routes_check (gl);
+  return GL_CACHE_PARTIAL;
+}
+
+/* look the graph up in the cache file */
+static gint
+cache_load (struct GraphLayout *gl)
+{
+  GraphLayoutCacheHeader header;
+  GraphLayoutCacheRecord *record;
+  GraphLayoutCacheReversed *reversed;
+  FILE *file;
+  gint result;
+
+  file = fopen (gl->cache_path, "rb");
+  if (!file)			/* nothing cached yet */
+    return GL_CACHE_MISS;
+  if (fread (&header, sizeof (header), 1, file) != 1 ||
+      header.magic != GL_CACHE_MAGIC || header.nodes < 0 ||
+      header.reversed < 0)
+    {
+      fclose (file);
+      return GL_CACHE_MISS;
+    }
+  record = malloc (sizeof (GraphLayoutCacheRecord) * (header.nodes + 1));
+  reversed = malloc (sizeof (GraphLayoutCacheReversed) *
+		     (header.reversed + 1));
+  if (!record || !reversed ||
+      fread (record, sizeof (GraphLayoutCacheRecord), header.nodes,
+	     file) != (gsize) header.nodes ||
+      fread (reversed, sizeof (GraphLayoutCacheReversed), header.reversed,
+	     file) != (gsize) header.reversed)
+    {
+      fprintf (stderr, "graph_layout cache: can not read %s\n",
+	       gl->cache_path);
+      free (record);
+      free (reversed);
+      fclose (file);
+      return GL_CACHE_MISS;
+    }
+  fclose (file);
+
+  if (header.nodes == gl->nodes && header.hash == layout_hash (gl))
+    result = cache_hit (gl, &header, record, reversed);
+  else
+    result = cache_partial (gl, &header, record);
+  free (record);
+  free (reversed);
+  return result;
+}
+
+/* Keep layouts in a cache file, see above; NULL stops caching
+ */
+void
+graph_layout_cache_set (struct GraphLayout *gl, const gchar * path)
+{
+  free (gl->cache_path);
+  gl->cache_path = path ? strdup (path) : NULL;
+}
+
+/* Write the current layout to the cache file, for instance after
+ * incremental relayouts, which do not write it themselves
+ * return: 0 on success, -1 on failure or without a layout or cache
+ */
+gint
+graph_layout_cache_save (struct GraphLayout *gl)
+{
+  if (!gl->cache_path || !gl->laid_out)
+    return -1;
+  batch_flush (gl);
+  return cache_save (gl);
+}
+
+/* get the structural hash of the graph, which changes with anything the
+ * layout depends on
+ */
+unsigned long long
+graph_layout_hash (struct GraphLayout *gl)
+{
+  batch_flush (gl);
+  return layout_hash (gl);
+}
+
+static void
+layout_compute (struct GraphLayout *gl)
+{
+  gint *component = NULL;
+  gint components = 0;
+
+  if (gl->groups)
+    {
+      gl->unsorted_nodes = 0;
+      group_relayout (gl, 1);
+      reversed_count (gl);
+      free (gl->row_right);
+      gl->row_right = NULL;
+      gl->rows = 0;
+      grid_build (gl);
+      routes_check (gl);
+      dirty_clear (gl);
+      gl->laid_out = 1;
+      return;
+    }
+  if (gl->mode == GRAPH_LAYOUT_FORCE)
+    {
+      gint i;
+
+      free_ranks (gl);
+      gl->unsorted_nodes = 0;
+      gl->crossings = 0;
+      for (i = 0; i < gl->connections; i++)	/* nothing is reversed */
+	gl->connection[i].reversed = 0;
+      gl->reversed_connections = 0;
+      force_run (gl, GL_FORCE_ITERATIONS);
+      center_graph (gl);
+      free (gl->row_right);
+      gl->row_right = NULL;
+      gl->rows = 0;
+      grid_build (gl);
+      routes_check (gl);
+      dirty_clear (gl);
+      gl->laid_out = 1;
+      return;
+    }
+  toposort (gl);
+  assign_ranks (gl);
+  if (!gl->component_job && gl->nodes)
+    {
+      component = malloc (sizeof (gint) * gl->nodes);
+      if (component)
+	components = find_components (gl, component);
+    }
+
+  if (components < 2 || !gl->rank_line ||
+      !layout_components (gl, component, components))
+    {
+      initial_order (gl);
+      if (gl->rank_line)
+	{
+	  initial_rank_order (gl);
+	  reduce_crossings (gl);
+	  place_ranks (gl);
+	  if (components > 1)
+	    separate_components (gl, component);
+	}
+    }
+  if (components > 1 && gl->rank_line)
+    pack_components (gl, component, components);
+  free (component);
+
+  gl->origin_y = 0.0;
+  center_graph (gl);
+  rows_init (gl);
+  grid_build (gl);
+  routes_check (gl);
+  dirty_clear (gl);
+  gl->laid_out = 1;
+  return;
+}
+
+/* take the first layout of a graph from the cache file, placing the
+ * nodes that changed since it was written
+ * return: non zero when the graph is laid out
+ */
+static gint
+cache_relayout (struct GraphLayout *gl)
+{
+  if (!gl->cache_path || gl->laid_out)
+    return 0;
+  switch (cache_load (gl))
+    {
+    case GL_CACHE_HIT:
+      return 1;
+    case GL_CACHE_PARTIAL:
+      graph_layout_relayout_incremental (gl);
+      cache_save (gl);
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+void
+graph_layout_relayout (struct GraphLayout *gl)
+{
+  batch_flush (gl);
+  if (cache_relayout (gl))
+    return;
+  layout_compute (gl);
+  if (gl->cache_path)
+    cache_save (gl);
+}
+
+/********* Asynchronous relayout ************/
+
+/* The graph is copied on the calling thread, the copy is laid out on a
+ * worker thread and the result is handed back through an idle handler
+ * in the default main context. Every edit bumps gl->revision; a result
+ * computed for an older revision, or superseded by a newer request, is
+ * dropped. Jobs run one at a time, and jobs superseded before they
+ * start skip the layout altogether.
+ */
+
+typedef struct GraphLayoutJob
+{
+  struct GraphLayout *gl;
+  struct GraphLayout *snapshot;
+  gint *local;			/* handle in the snapshot, by node_no */
+  gint *conn_map;		/* connection number in the snapshot */
+  glong revision;		/* revision of gl when the snapshot was made */
+  gint cancelled;		/* set from the main loop, read atomically */
+  GraphLayoutDoneFunc done;
+  gpointer data;
+} GraphLayoutJob;
+
+static void
+job_free (GraphLayoutJob * job)
+{
+  if (job->snapshot)
+    graph_layout_free (job->snapshot);
+  free (job->local);
+  free (job->conn_map);
+  free (job);
+}
+
+/* take over the layout of the snapshot, the graphs are known to be
+ * identical, node for node, since nothing was edited in between
+ * return: 0 on success, -1 when the old layout is kept
+ */
+static gint
+job_adopt (GraphLayoutJob * job)
+{
+  struct GraphLayout *gl = job->gl;
+  struct GraphLayout *sub = job->snapshot;
+  gint *order = calloc (gl->nodes + 1, sizeof (gint));
+  GraphLayoutNode **rank_node = malloc (sizeof (GraphLayoutNode *) *
+					(gl->nodes + 1));
+  rank_line *lines = calloc (sub->ranks + 1, sizeof (rank_line));
+  gint node_no;
+  gint rank, i;
+
+  if (!order || !rank_node || !lines)
+    goto fail;
+
+  /* take over the node order of the snapshot */
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    order[id2no (sub, job->local[node_no])] = node_no;
+  if (node_permute (gl, order))
+    goto fail;
+  add_connection_no (gl);
+  for (i = 0; i < gl->connections; i++)
+    gl->connection[i].reversed =
+      sub->connection[job->conn_map[i]].reversed;
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      GraphLayoutNode *n = sub->node[node_no];
+      gl->x[node_no] = sub->x[node_no];
+      gl->y[node_no] = sub->y[node_no];
+      node->rank = n->rank;
+      node->order = n->order;
+      node->row = n->row;
+      node->done = n->done;
+      node->group_x = n->group_x;
+      node->group_y = n->group_y;
+      if (node->meta && n->meta)
+	{
+	  node->meta->dirty = n->meta->dirty;
+	  node->meta->content_width = n->meta->content_width;
+	  node->meta->content_height = n->meta->content_height;
+	}
+    }
+
+  free_ranks (gl);
+  if (sub->rank_line)
+    {
+      gl->rank_line = lines;
+      gl->rank_node = rank_node;
+      gl->ranks = sub->ranks;
+      for (rank = 0, i = 0; rank < sub->ranks; rank++)
+	{
+	  lines[rank].node = rank_node + i;
+	  lines[rank].nodes = sub->rank_line[rank].nodes;
+	  i += lines[rank].nodes;
+	}
+      for (node_no = 0; node_no < gl->nodes; node_no++)
+	{
+	  GraphLayoutNode *node = gl->node[node_no];
+	  if (node->order >= 0)	/* members of groups are not ranked */
+	    lines[node->rank].node[node->order] = node;
+	}
+    }
+  else
+    {				/* a force directed layout has no ranks */
+      free (lines);
+      free (rank_node);
+    }
+
+  gl->unsorted_nodes = sub->unsorted_nodes;
+  gl->reversed_connections = sub->reversed_connections;
+  gl->crossings = sub->crossings;
+  gl->origin_y = sub->origin_y;
+  if (gl->groups)
+    group_relayout (gl, 0);
+  rows_init (gl);
+  grid_build (gl);
+  routes_check (gl);
+  dirty_clear (gl);
+  gl->laid_out = 1;
+
+  free (order);
+  return 0;
+
+fail:				/* keep the old layout */
+  free (order);
+  free (rank_node);
+  free (lines);
+  return -1;
+}
+
+static gboolean
+job_deliver (gpointer data)
+{
+  GraphLayoutJob *job = data;
+  struct GraphLayout *gl = job->gl;
+
+  if (!job->cancelled)
+    {
+      gl->job = NULL;
+      if (job->revision == gl->revision)
+	{
+	  if (job->snapshot && !job_adopt (job) && gl->cache_path)
+	    cache_save (gl);
+	  if (job->done)
+	    job->done (gl, job->data);
+	}
+    }
+  job_free (job);
+  return FALSE;
+}
+
+static void
+job_run (gpointer data, gpointer user_data)
+{
+  GraphLayoutJob *job = data;
+  (void) user_data;
+
+  if (!g_atomic_int_get (&job->cancelled))
+    {
+      job->snapshot->cancelled = &job->cancelled;
+      graph_layout_relayout (job->snapshot);
+    }
+  g_idle_add (job_deliver, job);
+}
+
+/* Drop the result of the pending asynchronous relayout, if any
+ */
+void
+graph_layout_relayout_cancel (struct GraphLayout *gl)
+{
+  if (!gl->job)
+    return;
+  g_atomic_int_set (&gl->job->cancelled, 1);
+  gl->job = NULL;
+}
+
+/* Lay out the graph on a worker thread, superseding any pending
+ * asynchronous relayout. When the result arrives in the main loop it
+ * is applied, written to the cache file if any, and done is called,
+ * unless the graph was edited in the meantime, in which case it is
+ * dropped. A layout found in the cache file is applied at once, and
+ * done is called from the main loop all the same.
+ * return: 0 on success, -1 when the job could not be started
+ */
+gint
+graph_layout_relayout_async (struct GraphLayout *gl,
+			     GraphLayoutDoneFunc done, gpointer data)
+{
+  GraphLayoutJob *job;
+  gint *node;
+  gint i;
+
+  graph_layout_relayout_cancel (gl);
+  batch_flush (gl);
+  if (cache_relayout (gl))
+    {				/* nothing to compute, a job without snapshot */
+      job = calloc (1, sizeof (GraphLayoutJob));
+      if (!job)
+	{
+	  fprintf (stderr, "graph_layout_relayout_async() mem error\n");
+	  return -1;
+	}
+      job->gl = gl;
+      job->revision = gl->revision;
+      job->done = done;
+      job->data = data;
+      g_idle_add (job_deliver, job);
+      gl->job = job;
+      return 0;
+    }
+  if (!gl->job_worker)
+    gl->job_worker = g_thread_pool_new (job_run, NULL, 1, FALSE, NULL);
+  job = calloc (1, sizeof (GraphLayoutJob));
+  node = malloc (sizeof (gint) * (gl->nodes + 1));
+  if (!gl->job_worker || !job || !node)
+    goto fail;
+  job->local = malloc (sizeof (gint) * (gl->nodes + 1));
+  job->conn_map = malloc (sizeof (gint) * (gl->connections + 1));
+  if (!job->local || !job->conn_map)
+    goto fail;
+  for (i = 0; i < gl->nodes; i++)
+    node[i] = i;
+  job->snapshot = layout_copy (gl, node, gl->nodes, job->local,
+			       job->conn_map);
+  if (!job->snapshot)
+    goto fail;
+  free (node);
+
+  job->gl = gl;
+  job->revision = gl->revision;
+  job->done = done;
+  job->data = data;
+  if (!g_thread_pool_push (gl->job_worker, job, NULL))
+    {
+      job_free (job);
+      return -1;
+    }
+  gl->job = job;
+  return 0;
+
+fail:
+  fprintf (stderr, "graph_layout_relayout_async() mem error\n");
+  free (node);
+  if (job)
+    job_free (job);
+  return -1;
+}
+
+/* check whether an asynchronous relayout is still to be delivered
+ */
+gint
+graph_layout_relayout_pending (struct GraphLayout *gl)
+{
+  return gl->job != NULL;
+}
+
+/********* Spatial index ************/
+
+/* Nodes are bucketed in a uniform grid by their center, each cell
+ * holding a doubly linked list so that moving a node is O(1). Queries
+ * widen their area by the largest half extents of any node, so nodes
+ * overlapping a neighbouring cell are still found.
+ */
+
+static gint
+grid_cell (struct GraphLayout *gl, gdouble x, gdouble y)
+{
+  GraphLayoutGrid *grid = &gl->grid;
+  gdouble col = (x - grid->left) / grid->size;
+  gdouble row = (y - grid->top) / grid->size;
+
+  col = CLAMP (col, 0, grid->cols - 1);
+  row = CLAMP (row, 0, grid->rows - 1);
+  return (gint) row * grid->cols + (gint) col;
+}
+
+static void
+grid_unlink (struct GraphLayout *gl, GraphLayoutNode * node)
+{
+  if (node->cell == -1)
+    return;
+  if (node->cell_prev)
+    node->cell_prev->cell_next = node->cell_next;
+  else
+    gl->grid.cell[node->cell] = node->cell_next;
+  if (node->cell_next)
+    node->cell_next->cell_prev = node->cell_prev;
+  node->cell = -1;
+  node->cell_next = node->cell_prev = NULL;
+}
+
+static void
+grid_extents (struct GraphLayout *gl, GraphLayoutNode * node)
+{
+  if (gl->width[node->no] / 2 > gl->grid.half_width)
+    gl->grid.half_width = gl->width[node->no] / 2;
+  if (gl->height[node->no] / 2 > gl->grid.half_height)
+    gl->grid.half_height = gl->height[node->no] / 2;
+}
+
+/* file a node under the cell of its current position, called whenever
+ * a node has been moved outside of a full relayout
+ */
+static void
+grid_update (struct GraphLayout *gl, GraphLayoutNode * node)
+{
+  gint cell;
+
+  if (!gl->grid.cell)
+    return;
+  if (node->hidden || (node->meta && !node->meta->collapsed))
+    {				/* only what is drawn on its own is filed */
+      grid_unlink (gl, node);
+      return;
+    }
+  grid_extents (gl, node);
+  cell = grid_cell (gl, gl->x[node->no], gl->y[node->no]);
+  if (cell == node->cell)
+    return;
+  grid_unlink (gl, node);
+  node->cell = cell;
+  node->cell_prev = NULL;
+  node->cell_next = gl->grid.cell[cell];
+  if (node->cell_next)
+    node->cell_next->cell_prev = node;
+  gl->grid.cell[cell] = node;
+}
+
+static void
+grid_free (struct GraphLayout *gl)
+{
+  gint node_no;
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      node->cell = -1;
+      node->cell_next = node->cell_prev = NULL;
+    }
+  free (gl->grid.cell);
+  gl->grid.cell = NULL;
+}
+
+/* Size the grid to the bounding box of the nodes with cells about
+ * twice the average node size, and at most two cells per node. A span
+ * is counted as one cell at least, so that nodes all on one line, or a
+ * node moved far away, do not leave the other axis unbounded.
+ */
+static void
+grid_build (struct GraphLayout *gl)
+{
+  GraphLayoutGrid *grid = &gl->grid;
+  gdouble left = G_MAXDOUBLE;
+  gdouble top = G_MAXDOUBLE;
+  gdouble right = -G_MAXDOUBLE;
+  gdouble bottom = -G_MAXDOUBLE;
+  gdouble extent = 0.0;
+  gint node_no;
+
+  grid_free (gl);
+  grid->half_width = 0.0;
+  grid->half_height = 0.0;
+  if (!gl->nodes)
+    return;
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      left = MIN (left, gl->x[node_no]);
+      top = MIN (top, gl->y[node_no]);
+      right = MAX (right, gl->x[node_no]);
+      bottom = MAX (bottom, gl->y[node_no]);
+      extent += gl->width[node_no] + gl->height[node_no];
+      grid_extents (gl, gl->node[node_no]);
+    }
+
+  grid->size = MAX (extent / gl->nodes, 1.0);
+  while (MAX (right - left, grid->size) / grid->size
+	 * MAX (bottom - top, grid->size) / grid->size > 2.0 * gl->nodes)
+    grid->size *= 2;
+  grid->left = left;
+  grid->top = top;
+  grid->cols = (right - left) / grid->size + 1;
+  grid->rows = (bottom - top) / grid->size + 1;
+  grid->cell = calloc ((gsize) grid->cols * (gsize) grid->rows,
+		       sizeof (GraphLayoutNode *));
+  if (!grid->cell)
+    return;
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    grid_update (gl, gl->node[node_no]);
+}
+
+static gint
+node_hit (struct GraphLayout *gl, gint node_no,
+	  gdouble x0, gdouble y0, gdouble x1, gdouble y1)
+{
+  gdouble half_width = gl->width[node_no] / 2;
+  gdouble half_height = gl->height[node_no] / 2;
+
+  return gl->x[node_no] + half_width >= x0
+    && gl->x[node_no] - half_width <= x1
+    && gl->y[node_no] + half_height >= y0
+    && gl->y[node_no] - half_height <= y1;
+}
+
+/* call func for every node whose bounding box intersects the given
+ * rectangle, stops early when func returns non zero
+ */
+static void
+grid_query (struct GraphLayout *gl,
+	    gdouble x0, gdouble y0, gdouble x1, gdouble y1,
+	    gint (*func) (struct GraphLayout * gl, GraphLayoutNode * node,
+			  gpointer data),
+	    gpointer data)
+{
+  GraphLayoutGrid *grid = &gl->grid;
+  gint col0, row0, col1, row1;
+  gint row, col;
+
+  if (!grid->cell)
+    grid_build (gl);
+  if (!grid->cell)
+    return;
+
+  col0 = grid_cell (gl, x0 - grid->half_width, y0) % grid->cols;
+  row0 = grid_cell (gl, x0, y0 - grid->half_height) / grid->cols;
+  col1 = grid_cell (gl, x1 + grid->half_width, y1) % grid->cols;
+  row1 = grid_cell (gl, x1, y1 + grid->half_height) / grid->cols;
+
+  for (row = row0; row <= row1; row++)
+    for (col = col0; col <= col1; col++)
+      {
+	GraphLayoutNode *node = grid->cell[row * grid->cols + col];
+	for (; node; node = node->cell_next)
+	  if (node_hit (gl, node->no, x0, y0, x1, y1)
+	      && func (gl, node, data))
+	    return;
+      }
+}
+
+static gint
+pick_first (struct GraphLayout *gl, GraphLayoutNode * node, gpointer data)
+{
+  (void) gl;
+  *(gint *) data = node->id;
+  return 1;
+}
+
+typedef struct
+{
+  gint *nodes;
+  gint max;
+  gint count;
+} RectQuery;
+
+static gint
+collect_node (struct GraphLayout *gl, GraphLayoutNode * node, gpointer data)
+{
+  RectQuery *query = data;
+  (void) gl;
+  if (query->count < query->max)
+    query->nodes[query->count] = node->id;
+  query->count++;
+  return 0;
+}
+
+/* query the nodes whose bounding box intersect a rectangle, up to max
+ * handles are stored in nodes; the number of intersecting nodes is
+ * returned, which may be larger than max
+ */
+gint
+graph_layout_nodes_in_rect (struct GraphLayout *gl,
+			    gdouble x0, gdouble y0,
+			    gdouble x1, gdouble y1, gint * nodes, gint max)
+{
+  RectQuery query = { nodes, nodes ? max : 0, 0 };
+
+  grid_query (gl, MIN (x0, x1), MIN (y0, y1), MAX (x0, x1), MAX (y0, y1),
+	      collect_node, &query);
+  return query.count;
+}
+
+typedef struct
+{
+  gdouble x;
+  gdouble y;
+  gdouble best;			/* squared distance of the best pad */
+  gint node;
+  gint pad;
+  gint input;
+} PadQuery;
+
+static gint
+nearest_pad (struct GraphLayout *gl, GraphLayoutNode * node, gpointer data)
+{
+  PadQuery *query = data;
+  gint pad;
+
+  for (pad = 0; pad < node->inpads + node->outpads; pad++)
+    {
+      gint input = pad < node->inpads;
+      gdouble px = gl->x[node->no] + (input ?
+			      pad_offset (gl->width[node->no], pad,
+					  node->inpads) :
+			      pad_offset (gl->width[node->no], pad - node->inpads,
+					  node->outpads));
+      gdouble py = gl->y[node->no] +
+	(input ? -gl->height[node->no] : gl->height[node->no]) / 2;
+      gdouble distance = (px - query->x) * (px - query->x) +
+	(py - query->y) * (py - query->y);
+
+      if (distance <= query->best)
+	{
+	  query->best = distance;
+	  query->node = node->id;
+	  query->input = input;
+	  query->pad = input ? pad : pad - node->inpads;
+	}
+    }
+  return 0;
+}
+
+/* find the pad closest to a position within radius, pads are placed on
+ * the top (inputs) and bottom (outputs) edges of the node the same way
+ * graph_layout_connection_get_coords() attaches connections.
+ * return: node handle, with pad and input filled in
+ *        -1 no pad within radius
+ */
+gint
+graph_layout_pad_resolve (struct GraphLayout *gl,
+			  gdouble x, gdouble y, gdouble radius,
+			  gint * pad, gint * input)
+{
+  PadQuery query = { x, y, radius * radius, -1, 0, 0 };
+
+  grid_query (gl, x - radius, y - radius, x + radius, y + radius,
+	      nearest_pad, &query);
+  if (query.node != -1)
+    {
+      if (pad)
+	*pad = query.pad;
+      if (input)
+	*input = query.input;
+    }
+  return query.node;
+}
+
+/********* Edge routing ************/
+
+/* Connections are routed orthogonally through the channels between
+ * rows: down from the output pad to the channel below the source, along
+ * vertical lanes to the channel above the destination and over to the
+ * input pad. Lanes are picked a row at a time among the x positions no
+ * node blocks, found through the spatial index, so connections spanning
+ * several rows, or going back up, pass around the nodes in their way.
+ * Splines round the corners of the same path.
+ *
+ * Routes are cached with the connection and only dropped once a node at
+ * either end moves, is resized or has its pads changed.
+ */
+
+/* kappa, places the control points of a bezier approximating a quarter
+ * circle */
+#define GL_ROUTE_KAPPA      0.5523
+
+/* the node a connection is drawn from, or to when input is set, which
+ * is the collapsed group standing in for a hidden end, and its pad
+ */
+static GraphLayoutNode *
+connection_end (struct GraphLayout *gl, GraphLayoutConnection * connection,
+		gint input, gint * pad)
+{
+  GraphLayoutNode *shown = id2node (gl, input ? connection->shown_to_id :
+				    connection->shown_from_id);
+  if (shown)
+    {
+      *pad = input ? connection->shown_to_pad : connection->shown_from_pad;
+      return shown;
+    }
+  *pad = input ? connection->to_pad : connection->from_pad;
+  return id2node (gl, input ? connection->to_node_id :
+		  connection->from_node_id);
+}
+
+/* positions of the output and input pad a connection is drawn between
+ * return: -1 when the connection refers to a freed node or is hidden
+ *         in a collapsed group
+ */
+static gint
+connection_ends (struct GraphLayout *gl, GraphLayoutConnection * connection,
+		 gdouble * x0, gdouble * y0, gdouble * x1, gdouble * y1)
+{
+  gint from_pad, to_pad;
+  GraphLayoutNode *from = connection_end (gl, connection, 0, &from_pad);
+  GraphLayoutNode *to = connection_end (gl, connection, 1, &to_pad);
+
+  if (!from || !to || (connection->shown_from_id &&
+		       connection->shown_from_id == connection->shown_to_id))
+    return -1;
+  *x0 = gl->x[from->no] + pad_offset (gl->width[from->no],
+				      from_pad, from->outpads);
+  *y0 = gl->y[from->no] + gl->height[from->no] / 2;
+  *x1 = gl->x[to->no] + pad_offset (gl->width[to->no],
+				    to_pad, to->inpads);
+  *y1 = gl->y[to->no] - gl->height[to->no] / 2;
+  return 0;
+}
+
+/* drop the cached routes of the connections of a node that moved */
+static void
+routes_invalidate (struct GraphLayout *gl, GraphLayoutNode * node)
+{
+  gint i;
+
+  for (i = 0; i < node->in.count; i++)
+    gl->connection[node->in.conn[i]].route_points = 0;
+  for (i = 0; i < node->out.count; i++)
+    gl->connection[node->out.conn[i]].route_points = 0;
+}
+
+/* drop the cached routes whose end points moved in a relayout */
+static void
+routes_check (struct GraphLayout *gl)
+{
+  gint i;
+
+  for (i = 0; i < gl->connections; i++)
+    {
+      GraphLayoutConnection *connection = &gl->connection[i];
+      gdouble *last;
+      gdouble x0, y0, x1, y1;
+
+      if (!connection->route_points)
+	continue;
+      last = connection->route + 2 * (connection->route_points - 1);
+      if (connection_ends (gl, connection, &x0, &y0, &x1, &y1) ||
+	  connection->route[0] != x0 || connection->route[1] != y0 ||
+	  last[0] != x1 || last[1] != y1)
+	connection->route_points = 0;
+    }
+}
+
+typedef struct
+{
+  GraphLayoutNode *from;	/* nodes that are not in the way */
+  GraphLayoutNode *to;
+  gint count;
+  gint failed;
+} ObstacleQuery;
+
+/* file the horizontal extent of a node, with clearance, as a pair of
+ * doubles in gl->obstacle */
+static gint
+collect_obstacle (struct GraphLayout *gl, GraphLayoutNode * node,
+		  gpointer data)
+{
+  ObstacleQuery *query = data;
+  gdouble half_width = gl->width[node->no] / 2 + gl->nodesep / 4;
+
+  if (node == query->from || node == query->to)
+    return 0;
+  if (query->count == gl->alloc_obstacles)
+    {
+      gint alloc = gl->alloc_obstacles ? gl->alloc_obstacles * 2 : 16;
+      gdouble *newlist = realloc (gl->obstacle, sizeof (gdouble) * 2 * alloc);
+      if (!newlist)
+	{
+	  query->failed = 1;
+	  return 1;
+	}
+      gl->obstacle = newlist;
+      gl->alloc_obstacles = alloc;
+    }
+  gl->obstacle[2 * query->count] = gl->x[node->no] - half_width;
+  gl->obstacle[2 * query->count + 1] = gl->x[node->no] + half_width;
+  query->count++;
+  return 0;
+}
+
+static gint
+compare_obstacles (const void *a, const void *b)
+{
+  gdouble left_a = *(const gdouble *) a;
+  gdouble left_b = *(const gdouble *) b;
+  return left_a < left_b ? -1 : left_a > left_b;
+}
+
+static gint
+lane_clear (struct GraphLayout *gl, gint obstacles, gdouble x)
+{
+  gint i;
+
+  for (i = 0; i < obstacles; i++)
+    if (gl->obstacle[2 * i] < x && gl->obstacle[2 * i + 1] > x)
+      return 0;
+  return 1;
+}
+
+/* Find the x of a vertical lane from y0 to y1 that no node blocks: a
+ * when it is clear, or else the clear x closest to b. The nodes around
+ * b are looked up in a window that widens until a clear x is found
+ * within it.
+ */
+static gdouble
+route_lane (struct GraphLayout *gl, ObstacleQuery * query,
+	    gdouble a, gdouble b, gdouble y0, gdouble y1)
+{
+  gdouble margin = gl->nodesep / 4;
+  gdouble reach = MAX (gl->grid.size, 1.0);
+  gint tries;
+
+  query->count = 0;
+  query->failed = 0;
+  grid_query (gl, a - margin, MIN (y0, y1), a + margin, MAX (y0, y1),
+	      collect_obstacle, query);
+  if (!query->failed && lane_clear (gl, query->count, a))
+    return a;
+
+  for (tries = 0; tries < 32; tries++, reach *= 2)
+    {
+      gdouble best = b;
+      gdouble best_distance = G_MAXDOUBLE;
+      gint i;
+
+      query->count = 0;
+      query->failed = 0;
+      grid_query (gl, b - reach, MIN (y0, y1), b + reach, MAX (y0, y1),
+		  collect_obstacle, query);
+      if (query->failed)
+	break;
+      if (lane_clear (gl, query->count, b))
+	return b;
+
+      /* the edges of overlapping extents, merged, are clear */
+      qsort (gl->obstacle, query->count, sizeof (gdouble) * 2,
+	     compare_obstacles);
+      for (i = 0; i < query->count;)
+	{
+	  gdouble left = gl->obstacle[2 * i];
+	  gdouble right = gl->obstacle[2 * i + 1];
+
+	  for (i++; i < query->count && gl->obstacle[2 * i] <= right; i++)
+	    right = MAX (right, gl->obstacle[2 * i + 1]);
+	  if (left >= b - reach && fabs (left - b) < best_distance)
+	    {
+	      best = left;
+	      best_distance = fabs (left - b);
+	    }
+	  if (right <= b + reach && fabs (right - b) < best_distance)
+	    {
+	      best = right;
+	      best_distance = fabs (right - b);
+	    }
+	}
+      if (best_distance < G_MAXDOUBLE)
+	return best;
+    }
+  return a;
+}
+
+/* append a corner to the path in gl->route_path, leaving out repeated
+ * points and corners halfway along a straight line
+ * return: the number of corners, -1 when out of memory, which is
+ *         passed on by further calls
+ */
+static gint
+route_append (struct GraphLayout *gl, gint corners, gdouble x, gdouble y)
+{
+  gdouble *prev;
+
+  if (corners < 0)
+    return corners;
+  if (corners == gl->alloc_route_path)
+    {
+      gint alloc = gl->alloc_route_path ? gl->alloc_route_path * 2 : 16;
+      gdouble *newlist = realloc (gl->route_path, sizeof (gdouble) * 2 * alloc);
+      if (!newlist)
+	return -1;
+      gl->route_path = newlist;
+      gl->alloc_route_path = alloc;
+    }
+  prev = gl->route_path + 2 * corners - 2;
+  if (corners && x == prev[0] && y == prev[1])
+    return corners;
+  if (corners > 1 &&
+      ((prev[0] == prev[-2] && x == prev[0]) ||
+       (prev[1] == prev[-1] && y == prev[1])))
+    corners--;
+  gl->route_path[2 * corners] = x;
+  gl->route_path[2 * corners + 1] = y;
+  return corners + 1;
+}
+
+/* Route a connection as an orthogonal path into gl->route_path. The
+ * span between the channels at its ends is crossed a row at a time,
+ * keeping to the same lane while it is clear and otherwise jogging in
+ * the channel to the clear lane closest to the straight line between
+ * the pads.
+ * return: the number of corners, 0 when the connection is invalid
+ */
+static gint
+route_compute (struct GraphLayout *gl, GraphLayoutConnection * connection)
+{
+  gint pad;
+  GraphLayoutNode *from = connection_end (gl, connection, 0, &pad);
+  GraphLayoutNode *to = connection_end (gl, connection, 1, &pad);
+  gdouble x0, y0, x1, y1;
+  gdouble c0, c1;
+  gdouble lane;
+  gint corners = 0;
+
+  if (connection_ends (gl, connection, &x0, &y0, &x1, &y1))
+    return 0;
+
+  /* the channels halfway between rows, or right at the pads of nodes
+   * taller than a row */
+  c0 = MAX (gl->y[from->no] + gl->ranksep / 2, y0);
+  c1 = MIN (gl->y[to->no] - gl->ranksep / 2, y1);
+
+  corners = route_append (gl, corners, x0, y0);
+  corners = route_append (gl, corners, x0, c0);
+  lane = x0;
+  if (c0 != c1)
+    {				/* a connection going back up has to avoid its
+				   own ends as well */
+      ObstacleQuery query = { c1 > c0 ? from : NULL, c1 > c0 ? to : NULL,
+	0, 0
+      };
+      gint bands = 1;
+      gint band;
+
+      if (gl->ranksep > 0)
+	bands = MAX (1, (gint) (fabs (c1 - c0) / gl->ranksep + 0.5));
+      for (band = 0; band < bands; band++)
+	{
+	  gdouble ya = c0 + (c1 - c0) * band / bands;
+	  gdouble yb = c0 + (c1 - c0) * (band + 1) / bands;
+
+	  lane = route_lane (gl, &query, lane,
+			     x0 + (x1 - x0) * (band + 0.5) / bands, ya, yb);
+	  corners = route_append (gl, corners, lane, ya);
+	  corners = route_append (gl, corners, lane, yb);
+	}
+    }
+  corners = route_append (gl, corners, x1, c1);
+  corners = route_append (gl, corners, x1, y1);
+  if (corners == 1)
+    {				/* both ends in the same spot */
+      gl->route_path[2] = x1;
+      gl->route_path[3] = y1;
+      corners = 2;
+    }
+  return MAX (corners, 0);
+}
+
+/* append a straight line to a bezier path, as a curve */
+static gint
+route_line (gdouble * point, gint count, gdouble x, gdouble y)
+{
+  gdouble x0 = point[2 * count - 2];
+  gdouble y0 = point[2 * count - 1];
+
+  if (x == x0 && y == y0)
+    return count;
+  point[2 * count] = x0 + (x - x0) / 3;
+  point[2 * count + 1] = y0 + (y - y0) / 3;
+  point[2 * count + 2] = x0 + (x - x0) * 2 / 3;
+  point[2 * count + 3] = y0 + (y - y0) * 2 / 3;
+  point[2 * count + 4] = x;
+  point[2 * count + 5] = y;
+  return count + 3;
+}
+
+/* turn a polyline into a bezier path, each corner is replaced by a
+ * quarter circle no larger than half of the segments around it
+ */
+static gint
+route_round (const gdouble * path, gint corners, gdouble radius,
+	     gdouble * point)
+{
+  gint count = 1;
+  gint i;
+
+  point[0] = path[0];
+  point[1] = path[1];
+  for (i = 1; i < corners - 1; i++)
+    {
+      const gdouble *p = path + 2 * i;
+      gdouble dx0 = p[0] - p[-2];
+      gdouble dy0 = p[1] - p[-1];
+      gdouble dx1 = p[2] - p[0];
+      gdouble dy1 = p[3] - p[1];
+      gdouble length0 = sqrt (dx0 * dx0 + dy0 * dy0);
+      gdouble length1 = sqrt (dx1 * dx1 + dy1 * dy1);
+      gdouble r = MIN (radius, MIN (length0, length1) / 2);
+      gdouble ax = p[0] - dx0 / length0 * r;
+      gdouble ay = p[1] - dy0 / length0 * r;
+      gdouble bx = p[0] + dx1 / length1 * r;
+      gdouble by = p[1] + dy1 / length1 * r;
+
+      count = route_line (point, count, ax, ay);
+      point[2 * count] = ax + (p[0] - ax) * GL_ROUTE_KAPPA;
+      point[2 * count + 1] = ay + (p[1] - ay) * GL_ROUTE_KAPPA;
+      point[2 * count + 2] = bx + (p[0] - bx) * GL_ROUTE_KAPPA;
+      point[2 * count + 3] = by + (p[1] - by) * GL_ROUTE_KAPPA;
+      point[2 * count + 4] = bx;
+      point[2 * count + 5] = by;
+      count += 3;
+    }
+  return route_line (point, count, path[2 * corners - 2],
+		     path[2 * corners - 1]);
+}
+
+/* Set how the connections are routed, invalidating the cached routes
+ */
+void
+graph_layout_routing_set (struct GraphLayout *gl, GraphLayoutRouting routing)
+{
+  gint i;
+
+  if (gl->routing == routing)
+    return;
+  gl->routing = routing;
+  for (i = 0; i < gl->connections; i++)
+    gl->connection[i].route_points = 0;
+}
+
+GraphLayoutRouting
+graph_layout_routing_get (struct GraphLayout *gl)
+{
+  return gl->routing;
+}
+
+/* get the route of a connection, computing it only when it is not
+ * cached yet
+ */
+gint
+graph_layout_connection_get_route (struct GraphLayout *gl,
+				   gint connection_no, const gdouble ** points)
+{
+  GraphLayoutConnection *connection;
+
+  if (connection_no < 0 || connection_no >= gl->connections)
+    return 0;
+  connection = &gl->connection[connection_no];
+  if (!connection->route_points)
+    {
+      gint corners = route_compute (gl, connection);
+      gint count = corners;
+
+      if (!corners)
+	return 0;
+      if (gl->routing == GRAPH_LAYOUT_ROUTE_SPLINE)
+	count = 1 + 3 * (2 * (corners - 2) + 1);
+      if (count > connection->route_alloc)
+	{
+	  gdouble *route = realloc (connection->route,
+				    sizeof (gdouble) * 2 * count);
+	  if (!route)
+	    {
+	      fprintf (stderr, "graph_layout route mem error\n");
+	      return 0;
+	    }
+	  connection->route = route;
+	  connection->route_alloc = count;
+	}
+      if (gl->routing == GRAPH_LAYOUT_ROUTE_SPLINE)
+	count = route_round (gl->route_path, corners, gl->ranksep / 2,
+			     connection->route);
+      else
+	memcpy (connection->route, gl->route_path,
+		sizeof (gdouble) * 2 * corners);
+      connection->route_points = count;
+    }
+  if (points)
+    *points = connection->route;
+  return connection->route_points;
+}
+
+/********* Incremental relayout ************/
+
+/* remember that a node needs to be placed again by the next
+ * incremental relayout
+ */
+static void
+mark_dirty (struct GraphLayout *gl, GraphLayoutNode * node)
+{
+  if (node->dirty || !gl->laid_out)
+    return;
+  if (gl->dirty_nodes == gl->alloc_dirty)
+    {
+      gint alloc = gl->alloc_dirty ? gl->alloc_dirty * 2 : 16;
+      gint *newlist = realloc (gl->dirty, sizeof (gint) * alloc);
+      if (!newlist)
+	{			/* fall back to a full layout */
+	  gl->laid_out = 0;
+	  return;
+	}
+      gl->dirty = newlist;
+      gl->alloc_dirty = alloc;
+    }
+  gl->dirty[gl->dirty_nodes++] = node->id;
+  node->dirty = gl->dirty_nodes;
+}
+
+static void
+dirty_clear (struct GraphLayout *gl)
+{
+  gint i;
+  for (i = 0; i < gl->dirty_nodes; i++)
+    {
+      GraphLayoutNode *node = id2node (gl, gl->dirty[i]);
+      if (node)
+	node->dirty = 0;
+    }
+  gl->dirty_nodes = 0;
+}
+
+/* get the right edge of the rightmost node in a row, growing the row table
+ * as needed
+ */
+static gdouble *
+row_right (struct GraphLayout *gl, gint row)
+{
+  if (row < gl->row_first || row >= gl->row_first + gl->rows)
+    {
+      gint first = row;
+      gint rows = 1;
+      gdouble *newlist;
+      gint i;
+
+      if (gl->rows)
+	{
+	  gint low = MIN (row, gl->row_first);
+	  gint high = MAX (row + 1, gl->row_first + gl->rows);
+	  rows = MAX (high - low, gl->rows * 2);
+	  first = row < gl->row_first ? high - rows : low;
+	}
+      newlist = malloc (sizeof (gdouble) * rows);
+      if (!newlist)
+	return NULL;
+      for (i = 0; i < rows; i++)
+	newlist[i] = -G_MAXDOUBLE;
+      if (gl->rows)
+	memcpy (newlist + (gl->row_first - first), gl->row_right,
+		sizeof (gdouble) * gl->rows);
+      free (gl->row_right);
+      gl->row_right = newlist;
+      gl->row_first = first;
+      gl->rows = rows;
+    }
+  return &gl->row_right[row - gl->row_first];
+}
+
+static void
+rows_init (struct GraphLayout *gl)
+{
+  gint node_no;
+
+  free (gl->row_right);
+  gl->row_right = NULL;
+  gl->rows = 0;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      gdouble *right;
+      if (!node->done)
+	continue;
+      right = row_right (gl, node->row);
+      if (right && gl->x[node->no] + gl->width[node->no] / 2 > *right)
+	*right = gl->x[node->no] + gl->width[node->no] / 2;
+    }
+}
+
+/* a connection from source to dest was made, the consumer only has
+ * to move when it is not already below the provider; a dirty provider
+ * pulls its consumers along when it is placed
+ */
+static void
+connection_changed (struct GraphLayout *gl,
+		    GraphLayoutNode * source, GraphLayoutNode * dest)
+{
+  if (source->dirty || dest->dirty)
+    return;
+  if (source->done && dest->done && dest->row > source->row)
+    return;
+  mark_dirty (gl, dest);
+}
+
+/* place a dirty node next to the nodes it is connected to, the row is
+ * taken from placed providers, or failing that placed consumers
+ */
+static void
+place_incremental (struct GraphLayout *gl, GraphLayoutNode * node)
+{
+  GraphLayoutNode *anchor = NULL;
+  gint row = 0;
+  gint rank = 0;
+  gdouble *right;
+  gint i;
+
+  for (i = 0; i < node->in.count; i++)
+    {
+      GraphLayoutNode *from =
+	id2node (gl, gl->connection[node->in.conn[i]].from_node_id);
+      if (!from->done)
+	continue;
+      rank = MAX (rank, from->rank + 1);
+      if (!anchor || from->row + 1 > row)
+	{
+	  row = from->row + 1;
+	  anchor = from;
+	}
+    }
+  if (!anchor)
+    for (i = 0; i < node->out.count; i++)
+      {
+	GraphLayoutNode *to =
+	  id2node (gl, gl->connection[node->out.conn[i]].to_node_id);
+	if (to->done && (!anchor || to->row - 1 < row))
+	  {
+	    row = to->row - 1;
+	    rank = MAX (to->rank - 1, 0);
+	    anchor = to;
+	  }
+      }
+
+  right = row_right (gl, row);
+  node->row = row;
+  gl->y[node->no] = gl->origin_y + row * gl->ranksep;
+  gl->x[node->no] = (right && *right > -G_MAXDOUBLE) ?
+    *right + gl->nodesep + gl->width[node->no] / 2 : 0.0;
+  if (anchor && gl->x[node->no] < gl->x[anchor->no])
+    gl->x[node->no] = gl->x[anchor->no];
+  if (right && gl->x[node->no] + gl->width[node->no] / 2 > *right)
+    *right = gl->x[node->no] + gl->width[node->no] / 2;
+  node->rank = rank;
+  node->order = G_MAXINT;	/* at the end of its rank, see ranks_rebuild() */
+  node->done = 1;
+  gl->ranks_stale = 1;
+}
+
+/* Only the nodes changed since the last layout are placed again, the
+ * others keep their coordinates so the canvas stays stable while
+ * editing. Consumers left at or above a moved provider are pulled
+ * along, so the cost is proportional to the affected part of the
+ * graph. Falls back to a full relayout when there is no previous
+ * layout or most of the graph changed.
+ */
+void
+graph_layout_relayout_incremental (struct GraphLayout *gl)
+{
+  GraphLayoutNode **work;
+  gint *indegree;
+  gint head = 0;
+  gint tail = 0;
+  gint count = 0;
+  gint i, j;
+
+  batch_flush (gl);
+  if (!gl->laid_out || gl->dirty_nodes * 4 > gl->nodes ||
+      gl->mode == GRAPH_LAYOUT_FORCE || gl->groups)
+    {
+      graph_layout_relayout (gl);
+      return;
+    }
+  if (!gl->dirty_nodes)
+    return;
+
+  /* drop handles of nodes freed since they were marked */
+  for (i = 0; i < gl->dirty_nodes; i++)
+    {
+      GraphLayoutNode *node = id2node (gl, gl->dirty[i]);
+      if (!node)
+	continue;
+      gl->dirty[count++] = gl->dirty[i];
+      node->dirty = count;
+      node->done = 0;
+    }
+  gl->dirty_nodes = count;
+
+  /* order the dirty nodes topologically among themselves, so that new
+   * chains grow away from the part of the graph already placed */
+  work = malloc (sizeof (GraphLayoutNode *) * (gl->nodes + 1));
+  indegree = calloc (count + 1, sizeof (gint));
+  if (!work || !indegree)
+    {
+      free (work);
+      free (indegree);
+      graph_layout_relayout (gl);
+      return;
+    }
+  for (i = 0; i < count; i++)
+    {
+      GraphLayoutNode *node = id2node (gl, gl->dirty[i]);
+      for (j = 0; j < node->in.count; j++)
+	if (id2node (gl,
+		     gl->connection[node->in.conn[j]].from_node_id)->dirty)
+	  indegree[i]++;
+      if (!indegree[i])
+	work[tail++] = node;
+    }
+  for (head = 0; head < tail; head++)
+    {
+      GraphLayoutNode *node = work[head];
+      for (j = 0; j < node->out.count; j++)
+	{
+	  GraphLayoutNode *to =
+	    id2node (gl, gl->connection[node->out.conn[j]].to_node_id);
+	  if (to->dirty && --indegree[to->dirty - 1] == 0)
+	    work[tail++] = to;
+	}
+    }
+  if (tail < count)		/* cycles among the dirty nodes */
+    for (i = 0; i < count; i++)
+      if (indegree[i])
+	work[tail++] = id2node (gl, gl->dirty[i]);
+  free (indegree);
+
+  for (head = 0; head < tail; head++)
+    {
+      GraphLayoutNode *node = work[head];
+
+      place_incremental (gl, node);
+      grid_update (gl, node);
+      routes_invalidate (gl, node);
+      for (j = 0; j < node->out.count; j++)
+	{
+	  GraphLayoutNode *to =
+	    id2node (gl, gl->connection[node->out.conn[j]].to_node_id);
+	  if (to->done && !to->dirty && to->row <= node->row)
+	    {			/* consumer is no longer below, move it */
+	      mark_dirty (gl, to);
+	      if (!to->dirty)
+		continue;
+	      to->done = 0;
+	      work[tail++] = to;
+	    }
+	}
+    }
+  free (work);
+  dirty_clear (gl);
+}
+
+/* Instantiate a new graph layout engine
+ */
+struct GraphLayout *
+graph_layout_new (void)
+{
+  GraphLayout *gl = calloc (1, sizeof (GraphLayout));
+
+  gl->nodes = 0;
+  gl->connections = 0;
+  if (node_storage_resize (gl, 8))
+    {
+      free (gl);
+      return NULL;
+    }
+  gl->node[0] = NULL;
+  gl->alloc_connections = 8;
+  gl->connection =
+    malloc (sizeof (struct GraphLayoutConnection) * gl->alloc_connections);
+  gl->slots = 1;
+  gl->free_slot = 0;
+  gl->crossing_iterations = 24;
+  gl->crossing_time = 250;
+
+  return gl;
+}
+
+/* Remove all node data within graph
+ */
+void
+graph_layout_clear (struct GraphLayout *gl)
+{
+  gint node_no;
+  gint i;
+
+  grid_free (gl);
+  for (i = 0; i < gl->connections; i++)
+    free (gl->connection[i].route);
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      free (node->in.conn);
+      free (node->out.conn);
+      free (node->meta);
+      slot_retire (gl, node);
+    }
+  gl->node[0] = NULL;
+  gl->nodes = 0;
+  gl->connections = 0;
+  gl->pending_connections = 0;
+  gl->groups = 0;
+
+  free_ranks (gl);
+  gl->unsorted_nodes = 0;
+  gl->reversed_connections = 0;
+  gl->crossings = 0;
+  gl->dirty_nodes = 0;
+  free (gl->row_right);
+  gl->row_right = NULL;
+  gl->rows = 0;
+  gl->laid_out = 0;
+  gl->revision++;
+}
+
+/* Dispose of a graph layout engine
+ */
+void
+graph_layout_free (struct GraphLayout *gl)
+{
+  glong chunk;
+
+  graph_layout_clear (gl);
+  free (gl->node);
+  free (gl->x);
+  free (gl->y);
+  free (gl->width);
+  free (gl->height);
+  free (gl->connection);
+  free (gl->pending);
+  free (gl->obstacle);
+  free (gl->quad);
+  free (gl->route_path);
+  free (gl->cache_path);
+  for (chunk = 0; chunk < gl->pool_chunks; chunk++)
+    free (gl->pool[chunk]);
+  free (gl->pool);
+  free_ranks (gl);
+  free (gl->dirty);
+  free (gl->row_right);
+  grid_free (gl);
+  if (gl->workers)
+    g_thread_pool_free (gl->workers, FALSE, TRUE);
+  graph_layout_relayout_cancel (gl);
+  if (gl->job_worker)		/* superseded jobs only need to be finished */
+    g_thread_pool_free (gl->job_worker, FALSE, TRUE);
+  free (gl);
+}
+
+/* Set the minimum nodeseperation used in the layout
+ */
+void
+graph_layout_nodesep_set (struct GraphLayout *gl, gdouble nodesep)
+{
+  gl->nodesep = nodesep;
+}
+
+/* Set the nodeseperation used in the layout
+ */
+void
+graph_layout_ranksep_set (struct GraphLayout *gl, gdouble ranksep)
 {
   gl->ranksep = ranksep;
 }
@@ -308,73 +4807,582 @@ graph_layout_ranksep_get (struct GraphLayout * gl)
   return gl->ranksep;
 }
 
+/* Set the number of ordering sweeps used to reduce edge crossings,
+ * 0 disables crossing reduction
+ */
+void
+graph_layout_crossing_iterations_set (struct GraphLayout *gl,
+				      gint iterations)
+{
+  gl->crossing_iterations = iterations;
+}
+
+gint
+graph_layout_crossing_iterations_get (struct GraphLayout *gl)
+{
+  return gl->crossing_iterations;
+}
+
+/* Set the time budget in milliseconds for crossing reduction,
+ * 0 for no limit
+ */
+void
+graph_layout_crossing_time_set (struct GraphLayout *gl, gint msecs)
+{
+  gl->crossing_time = msecs;
+}
+
+gint
+graph_layout_crossing_time_get (struct GraphLayout *gl)
+{
+  return gl->crossing_time;
+}
+
+/* Get the number of crossings between connections of adjacent ranks
+ * left by the last layout
+ */
+glong
+graph_layout_crossings_get (struct GraphLayout *gl)
+{
+  return gl->crossings;
+}
+
 /* Add a new node to the layout, an integer handle used for
  * referencing the node within the instance is returned.
  */
 gint
 graph_layout_node_new (struct GraphLayout * gl)
 {
+  GraphLayoutNode *node;
+  gint generation;
+  gint slot_no;
+
   if (gl->alloc_nodes < gl->nodes + 2)
     {				/* need to allocate new space,
 				   the sentinel padding node takes space as well */
-      GraphLayoutNode **newlist =
-	malloc (sizeof (struct GraphLayoutNode *) * gl->alloc_nodes * 2);
-      if (!newlist)
+      if (node_storage_resize (gl, gl->alloc_nodes * 2))
 	{
 	  fprintf (stderr, "graph_layout_new() mem error\n");
 	  return -1;
 	}
-      memcpy (newlist, gl->node,
-	      sizeof (struct GraphLayoutNode *) * gl->alloc_nodes);
-      gl->alloc_nodes *= 2;
-      free (gl->node);
-      gl->node = newlist;
     }
-  {				/* do real insertion */
-    GraphLayoutNode *node = calloc (1, sizeof (GraphLayoutNode));
-    if (!node)
+  if (!gl->free_slot && gl->slots > GL_SLOT_MASK)
+    {
+      fprintf (stderr, "graph_layout_new() out of node handles\n");
       return -1;
+    }
+  if (!gl->free_slot && (gl->slots >> GL_CHUNK_BITS) >= gl->pool_chunks)
+    {				/* the pool needs another chunk */
+      GraphLayoutNode **newpool =
+	realloc (gl->pool, sizeof (GraphLayoutNode *) * (gl->pool_chunks + 1));
+      if (!newpool)
+	{
+	  fprintf (stderr, "graph_layout_new() mem error\n");
+	  return -1;
+	}
+      gl->pool = newpool;
+      gl->pool[gl->pool_chunks] =
+	calloc (GL_CHUNK_SIZE, sizeof (GraphLayoutNode));
+      if (!gl->pool[gl->pool_chunks])
+	{
+	  fprintf (stderr, "graph_layout_new() mem error\n");
+	  return -1;
+	}
+      if (!gl->pool_chunks)
+	gl->pool[0][0].no = -1;	/* the reserved slot 0 */
+      gl->pool_chunks++;
+    }
+
+  if (gl->free_slot)
+    {
+      slot_no = gl->free_slot;
+      gl->free_slot = slot2node (gl, slot_no)->next_free;
+    }
+  else
+    slot_no = gl->slots++;
+
+  /* do real insertion */
+  gl->revision++;
+  node = slot2node (gl, slot_no);
+  generation = node->generation;
+  memset (node, 0, sizeof (GraphLayoutNode));
+  node->generation = generation;
+  node->id = (generation << GL_SLOT_BITS) | slot_no;
+  node->inpads = 0;
+  node->outpads = 0;
+  node->cell = -1;
+
+  node_set_no (gl, gl->nodes, node);
+  gl->x[gl->nodes] = 0.0;
+  gl->y[gl->nodes] = 0.0;
+  gl->width[gl->nodes] = 32;
+  gl->height[gl->nodes] = 32;
+  gl->nodes++;
+  gl->node[gl->nodes] = NULL;
+  mark_dirty (gl, node);
+  grid_update (gl, node);
+  return node->id;
+}
+
+/* Remove a node from the layout, this will also remove connections
+ * that either are going into, or going out from the node
+ */
+void
+graph_layout_node_free (struct GraphLayout *gl, gint node)
+{
+  gint node_no;
+  GraphLayoutNode *n;
+
+  batch_flush (gl);
+  node_no = id2no (gl, node);
+  if (node_no == -1)
+    return;
+  gl->revision++;
+  n = gl->node[node_no];
+  free_ranks (gl);
+  group_touch (gl, n);
+  if (n->meta)
+    {				/* the members move to the enclosing group */
+      gint i;
+      for (i = 0; i < gl->nodes; i++)
+	if (gl->node[i]->group == node)
+	  gl->node[i]->group = n->group;
+      free (n->meta);
+      n->meta = NULL;
+      gl->groups--;
+    }
+
+  /* remove connections referencing this node */
+  while (n->in.count)
+    remove_connection (gl, n->in.conn[0]);
+  while (n->out.count)
+    remove_connection (gl, n->out.conn[0]);
+  free (n->in.conn);
+  free (n->out.conn);
+  grid_unlink (gl, n);
+
+  slot_retire (gl, n);
+
+  if (node_no != gl->nodes - 1)
+    node_move (gl, gl->nodes - 1, node_no);
+  gl->node[gl->nodes - 1] = NULL;
+  gl->nodes--;
+
+  /* give back storage once it is mostly unused, the node structs stay
+   * in the pool for reuse */
+  if (gl->alloc_nodes > 8 && gl->nodes + 2 < gl->alloc_nodes / 4)
+    node_storage_resize (gl, gl->alloc_nodes / 2);
+}
+
+static void
+connection_set_now (struct GraphLayout *gl,
+		    gint source_node,
+		    gint source_pad, gint dest_node, gint dest_pad)
+{
+  GraphLayoutNode *dest = id2node (gl, dest_node);
+  GraphLayoutNode *source = NULL;
+  gint i;
+
+  if (!dest || dest->meta)
+    return;			/* groups only have the pads of their members */
+  if (source_node != 0)
+    {
+      source = id2node (gl, source_node);
+      if (!source || source->meta)
+	return;
+    }
+
+  i = edges_search (gl, &dest->in, dest_pad, 1);
+  if (i < dest->in.count &&
+      gl->connection[dest->in.conn[i]].to_pad == dest_pad)
+    {
+      gint connection_no = dest->in.conn[i];
+      GraphLayoutConnection *connection = &gl->connection[connection_no];
+      if (source_node == 0)
+	{			/* remove connection */
+	  remove_connection (gl, connection_no);
+	  return;
+	}
+      else
+	{
+	  gl->revision++;
+	  group_touch_connection (gl, connection);
+	  group_touch (gl, source);
+	  edges_remove (&id2node (gl, connection->from_node_id)->out,
+			connection_no);
+	  connection->from_node_id = source_node;
+	  connection->from_pad = source_pad;
+	  connection->route_points = 0;
+	  edges_insert (gl, &source->out, connection_no, 0);
+	  connection_changed (gl, source, dest);
+	  return;
+	}
+    }
+
+  if (source_node == 0)		/* trying to remove non existant connection */
+    return;
+
+  if (gl->alloc_connections < gl->connections + 1)
+    {				/* need to allocate new space */
+      GraphLayoutConnection *newlist =
+	realloc (gl->connection, sizeof (struct GraphLayoutConnection) *
+		 gl->alloc_connections * 2);
+      if (!newlist)
+	{
+	  fprintf (stderr, "graph_layout connection mem error\n");
+	  return;
+	}
+      gl->alloc_connections *= 2;
+      gl->connection = newlist;
+    }
+  {				/* do real insertion */
+    GraphLayoutConnection *connection = &gl->connection[gl->connections];
+
+    gl->revision++;
+    memset (connection, 0, sizeof (GraphLayoutConnection));
+    connection->from_node_id = source_node;
+    connection->from_pad = source_pad;
+    connection->to_node_id = dest_node;
+    connection->to_pad = dest_pad;
 
-    node->id = ++gl->max_nodeid;
-    node->x = 0.0;
-    node->y = 0.0;
-    node->width = 32;
-    node->height = 32;
-    node->inpads = 0;
-    node->outpads = 0;
-
-    gl->node[gl->nodes++] = node;
-    gl->node[gl->nodes] = NULL;
-    return node->id;
+    if (edges_insert (gl, &source->out, gl->connections, 0) ||
+	edges_insert (gl, &dest->in, gl->connections, 1))
+      {
+	edges_remove (&source->out, gl->connections);
+	return;
+      }
+    gl->connections++;
+    group_touch_connection (gl, connection);
+    connection_changed (gl, source, dest);
   }
-  return -1;
 }
 
-/* Remove a node from the layout, this will also remove connections
- * that either are going into, or going out from the node
+/********* Batched edits ************/
+
+/* Between graph_layout_begin() and graph_layout_commit() new
+ * connections are only recorded. Committing a batch that is large
+ * compared to the graph appends all of them, settles which connection
+ * owns each input pad and rebuilds the edge lists in two counting sort
+ * passes, linear in the size of the graph instead of inserting the
+ * connections one by one. Small batches are simply replayed.
+ */
+
+static void
+batch_record (struct GraphLayout *gl,
+	      gint source_node, gint source_pad, gint dest_node, gint dest_pad)
+{
+  GraphLayoutConnection *connection;
+
+  if (gl->pending_connections == gl->alloc_pending)
+    {
+      glong alloc = gl->alloc_pending ? gl->alloc_pending * 2 : 64;
+      GraphLayoutConnection *newlist =
+	realloc (gl->pending, sizeof (GraphLayoutConnection) * alloc);
+      if (!newlist)
+	{			/* no room to defer it */
+	  connection_set_now (gl, source_node, source_pad, dest_node,
+			      dest_pad);
+	  return;
+	}
+      gl->pending = newlist;
+      gl->alloc_pending = alloc;
+    }
+  connection = &gl->pending[gl->pending_connections++];
+  memset (connection, 0, sizeof (GraphLayoutConnection));
+  connection->from_node_id = source_node;
+  connection->from_pad = source_pad;
+  connection->to_node_id = dest_node;
+  connection->to_pad = dest_pad;
+}
+
+/* Order the connections by node_no and pad at their destination, or at
+ * their source, ties keeping the connection order. The from_node_no
+ * and to_node_no fields have to be up to date.
+ */
+static gint
+sort_connections (struct GraphLayout *gl, gint incoming, gint * order)
+{
+  gint *count;
+  gint *tmp;
+  gint min_pad = G_MAXINT;
+  gint max_pad = G_MININT;
+  glong range;
+  gint i, key;
+
+  if (!gl->connections)
+    return 0;
+  for (i = 0; i < gl->connections; i++)
+    {
+      gint pad = edge_pad (gl, i, incoming);
+      min_pad = MIN (min_pad, pad);
+      max_pad = MAX (max_pad, pad);
+    }
+  range = (glong) max_pad - min_pad + 1;
+  if (range > gl->connections + gl->nodes)
+    return -1;			/* pads are too spread out to bucket */
+
+  count = malloc (sizeof (gint) * (MAX (range, gl->nodes) + 1));
+  tmp = malloc (sizeof (gint) * gl->connections);
+  if (!count || !tmp)
+    {
+      free (count);
+      free (tmp);
+      return -1;
+    }
+
+  /* by pad */
+  memset (count, 0, sizeof (gint) * (range + 1));
+  for (i = 0; i < gl->connections; i++)
+    count[edge_pad (gl, i, incoming) - min_pad + 1]++;
+  for (key = 0; key < range; key++)
+    count[key + 1] += count[key];
+  for (i = 0; i < gl->connections; i++)
+    tmp[count[edge_pad (gl, i, incoming) - min_pad]++] = i;
+
+  /* then stable by node */
+  memset (count, 0, sizeof (gint) * (gl->nodes + 1));
+  for (i = 0; i < gl->connections; i++)
+    count[(incoming ? gl->connection[i].to_node_no :
+	   gl->connection[i].from_node_no) + 1]++;
+  for (key = 0; key < gl->nodes; key++)
+    count[key + 1] += count[key];
+  for (i = 0; i < gl->connections; i++)
+    {
+      GraphLayoutConnection *connection = &gl->connection[tmp[i]];
+      key = incoming ? connection->to_node_no : connection->from_node_no;
+      order[count[key]++] = tmp[i];
+    }
+
+  free (count);
+  free (tmp);
+  return 0;
+}
+
+/* fill the in or out edge lists of all nodes from a sorted order */
+static gint
+edges_rebuild (struct GraphLayout *gl, gint incoming, const gint * order)
+{
+  gint node_no;
+  gint i;
+
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      (incoming ? &node->in : &node->out)->count = 0;
+    }
+  for (i = 0; i < gl->connections; i++)
+    {
+      GraphLayoutConnection *connection = &gl->connection[order[i]];
+      GraphLayoutNode *node = gl->node[incoming ? connection->to_node_no :
+				       connection->from_node_no];
+      (incoming ? &node->in : &node->out)->count++;
+    }
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      GraphLayoutNode *node = gl->node[node_no];
+      GraphLayoutEdges *edges = incoming ? &node->in : &node->out;
+      if (edges->count > edges->alloc)
+	{
+	  gint *newlist = realloc (edges->conn, sizeof (gint) * edges->count);
+	  if (!newlist)
+	    return -1;
+	  edges->conn = newlist;
+	  edges->alloc = edges->count;
+	}
+      edges->count = 0;
+    }
+  for (i = 0; i < gl->connections; i++)
+    {
+      GraphLayoutConnection *connection = &gl->connection[order[i]];
+      GraphLayoutNode *node = gl->node[incoming ? connection->to_node_no :
+				       connection->from_node_no];
+      GraphLayoutEdges *edges = incoming ? &node->in : &node->out;
+      edges->conn[edges->count++] = order[i];
+    }
+  return 0;
+}
+
+/* append the recorded connections and index them all at once
+ * return: -1 when out of memory, before anything was changed
+ */
+static gint
+batch_index (struct GraphLayout *gl)
+{
+  glong total = gl->connections + gl->pending_connections;
+  gint first = gl->connections;
+  gint *order;
+  gint *renumber;
+  gint count;
+  gint i;
+
+  if (total > gl->alloc_connections)
+    {
+      GraphLayoutConnection *newlist =
+	realloc (gl->connection, sizeof (GraphLayoutConnection) * total);
+      if (!newlist)
+	return -1;
+      gl->connection = newlist;
+      gl->alloc_connections = total;
+    }
+  order = malloc (sizeof (gint) * (total + 1));
+  renumber = malloc (sizeof (gint) * (total + 1));
+  if (!order || !renumber)
+    {
+      free (order);
+      free (renumber);
+      return -1;
+    }
+
+  for (i = 0; i < gl->pending_connections; i++)
+    {
+      GraphLayoutConnection *connection = &gl->pending[i];
+      GraphLayoutNode *from = id2node (gl, connection->from_node_id);
+      GraphLayoutNode *to = id2node (gl, connection->to_node_id);
+      if (from && to && !from->meta && !to->meta)
+	gl->connection[gl->connections++] = *connection;
+    }
+  add_connection_no (gl);
+  if (sort_connections (gl, 1, order))
+    {				/* leave it to the one by one path */
+      gl->connections = first;
+      free (order);
+      free (renumber);
+      return -1;
+    }
+  gl->pending_connections = 0;
+  gl->revision++;
+
+  /* the last connection set for an input pad wins */
+  for (i = 0; i < gl->connections; i++)
+    renumber[i] = 0;
+  for (i = 0; i < gl->connections; i++)
+    {
+      GraphLayoutConnection *connection = &gl->connection[order[i]];
+      if (i + 1 < gl->connections)
+	{
+	  GraphLayoutConnection *next = &gl->connection[order[i + 1]];
+	  if (next->to_node_no == connection->to_node_no &&
+	      next->to_pad == connection->to_pad)
+	    renumber[order[i]] = -1;
+	}
+    }
+  for (i = 0, count = 0; i < gl->connections; i++)
+    {
+      if (gl->groups && (renumber[i] == -1 || i >= first))
+	group_touch_connection (gl, &gl->connection[i]);
+      if (renumber[i] == -1)
+	{
+	  free (gl->connection[i].route);
+	  continue;
+	}
+      if (i >= first && gl->laid_out)
+	connection_changed (gl, gl->node[gl->connection[i].from_node_no],
+			    gl->node[gl->connection[i].to_node_no]);
+      renumber[i] = count;
+      gl->connection[count++] = gl->connection[i];
+    }
+  for (i = 0; i < gl->connections; i++)
+    order[i] = renumber[order[i]];
+  for (i = 0, count = 0; i < gl->connections; i++)
+    if (order[i] != -1)
+      order[count++] = order[i];
+  gl->connections = count;
+
+  if (edges_rebuild (gl, 1, order) ||
+      sort_connections (gl, 0, order) || edges_rebuild (gl, 0, order))
+    fprintf (stderr, "graph_layout batch mem error\n");
+  free (order);
+  free (renumber);
+  return 0;
+}
+
+/* index the connections recorded so far */
+static void
+batch_flush (struct GraphLayout *gl)
+{
+  GraphLayoutConnection *pending = gl->pending;
+  glong count = gl->pending_connections;
+  glong i;
+
+  if (!count)
+    return;
+  if (count * 8 > gl->connections && !batch_index (gl))
+    return;
+  gl->pending_connections = 0;
+  for (i = 0; i < count; i++)
+    connection_set_now (gl, pending[i].from_node_id, pending[i].from_pad,
+			pending[i].to_node_id, pending[i].to_pad);
+}
+
+/* Start a batch of edits, see graph_layout.h
+ */
+void
+graph_layout_begin (struct GraphLayout *gl)
+{
+  gl->batch++;
+}
+
+/* End a batch of edits, indexing the connections recorded by the
+ * outermost batch
+ */
+void
+graph_layout_commit (struct GraphLayout *gl)
+{
+  if (gl->batch > 0 && --gl->batch == 0)
+    batch_flush (gl);
+}
+
+/* Make room for the given number of nodes and connections on top of
+ * the ones already there
  */
 void
-graph_layout_node_free (struct GraphLayout *gl, gint node)
+graph_layout_reserve (struct GraphLayout *gl, gint nodes, gint connections)
 {
-  gint node_no = id2no (gl, node);
-  gint connection_no = 0;
+  glong alloc_nodes = gl->nodes + MAX (nodes, 0) + 2;
+  glong alloc_connections = gl->connections + MAX (connections, 0);
 
-  /* remove connections referencing this node */
-  for (connection_no = 0; connection_no < gl->connections; connection_no++)
+  if (alloc_nodes > gl->alloc_nodes)
+    node_storage_resize (gl, alloc_nodes);
+  if (alloc_connections > gl->alloc_connections)
     {
-      GraphLayoutConnection *connection = gl->connection[connection_no];
-      if (connection->from_node_id == node || connection->to_node_id == node)
+      GraphLayoutConnection *newlist =
+	realloc (gl->connection,
+		 sizeof (GraphLayoutConnection) * alloc_connections);
+      if (newlist)
 	{
-	  remove_connection (gl, connection_no);
+	  gl->connection = newlist;
+	  gl->alloc_connections = alloc_connections;
+	}
+    }
+  if (gl->batch && connections > gl->alloc_pending - gl->pending_connections)
+    {
+      glong alloc = gl->pending_connections + connections;
+      GraphLayoutConnection *newlist =
+	realloc (gl->pending, sizeof (GraphLayoutConnection) * alloc);
+      if (newlist)
+	{
+	  gl->pending = newlist;
+	  gl->alloc_pending = alloc;
 	}
     }
+}
 
-  free (gl->node[node_no]);
-  gl->node[node_no] = gl->node[gl->nodes - 1];
-  gl->node[gl->nodes - 1] = NULL;
-  gl->nodes--;
+/* Add count nodes, storing their handles in nodes
+ * return: the number of nodes added
+ */
+gint
+graph_layout_nodes_new (struct GraphLayout *gl, gint count, gint * nodes)
+{
+  gint i;
 
-  /* FIXME: add code to reallocate the storage down as well? */
+  graph_layout_reserve (gl, count, 0);
+  for (i = 0; i < count; i++)
+    {
+      nodes[i] = graph_layout_node_new (gl);
+      if (nodes[i] == -1)
+	break;
+    }
+  return i;
 }
 
 /* Assign an connection, one pad can only be bound to one other node
@@ -386,64 +5394,32 @@ graph_layout_connection_set (struct GraphLayout *gl,
 			     gint source_node,
 			     gint source_pad, gint dest_node, gint dest_pad)
 {
-  gint connection_no = 0;
-
-  while (gl->connection[connection_no])
+  if (gl->batch && source_node != 0)
     {
-      GraphLayoutConnection *connection = gl->connection[connection_no];
-      if (connection->to_node_id == dest_node
-	  && connection->to_pad == dest_pad)
-	{
-	  if (source_node == 0)
-	    {			/* remove connection */
-	      remove_connection (gl, connection_no);
-	      return;
-	    }
-	  else
-	    {
-	      connection->from_node_id = source_node;
-	      connection->from_pad = source_pad;
-	      return;
-	    }
-	}
-      connection_no++;
-    }
-
-  if (source_node == 0)		/* trying to remove non existant connection */
-    return;
-
-  if (gl->alloc_connections < gl->connections + 2)
-    {				/* need to allocate new space,
-				   the sentinel padding connection takes space as well */
-      GraphLayoutConnection **newlist =
-	malloc (sizeof (struct GraphLayoutConnection *) *
-		gl->alloc_connections * 2);
-      if (!newlist)
-	{
-	  fprintf (stderr, "graph_layout connection mem error\n");
-	  return;
-	}
-      memcpy (newlist, gl->connection,
-	      sizeof (struct GraphLayoutConnection *) *
-	      gl->alloc_connections);
-      gl->alloc_connections *= 2;
-      free (gl->connection);
-      gl->connection = newlist;
+      batch_record (gl, source_node, source_pad, dest_node, dest_pad);
+      return;
     }
-  {				/* do real insertion */
-    GraphLayoutConnection *connection =
-      calloc (1, sizeof (GraphLayoutConnection));
-    if (!connection)
-      fprintf (stderr, "err!\n");
+  batch_flush (gl);
+  connection_set_now (gl, source_node, source_pad, dest_node, dest_pad);
+}
 
-    connection->from_node_id = source_node;
-    connection->from_pad = source_pad;
-    connection->to_node_id = dest_node;
-    connection->to_pad = dest_pad;
+/* Assign count connections from arrays, as one batch
+ */
+void
+graph_layout_connections_set (struct GraphLayout *gl,
+			      gint count,
+			      const gint * source_node,
+			      const gint * source_pad,
+			      const gint * dest_node, const gint * dest_pad)
+{
+  gint i;
 
-    gl->connection[gl->connections++] = connection;
-    gl->connection[gl->connections] = NULL;
-  }
+  graph_layout_begin (gl);
+  graph_layout_reserve (gl, 0, count);
+  for (i = 0; i < count; i++)
+    graph_layout_connection_set (gl, source_node[i], source_pad[i],
+				 dest_node[i], dest_pad[i]);
+  graph_layout_commit (gl);
 }
 
 /* get the position of the center of a node using it's handle
@@ -469,9 +5445,9 @@ graph_layout_node_no_getpos (struct GraphLayout *gl,
       return;
     }
   if (x)
-    *x = gl->node[node_no]->x;
+    *x = gl->x[node_no];
   if (y)
-    *y = gl->node[node_no]->y;
+    *y = gl->y[node_no];
 }
 
 /* query if a node is at given position
@@ -481,17 +5457,26 @@ graph_layout_node_no_getpos (struct GraphLayout *gl,
 gint
 graph_layout_node_resolve (struct GraphLayout *gl, gdouble x, gdouble y)
 {
-  gint no = 0;
-  while (gl->node[no])
-    {
-      GraphLayoutNode *node = gl->node[no];
-      if (x >= node->x - node->width / 2 &&
-	  y >= node->y - node->height / 2 &&
-	  x <= node->x + node->width / 2 && y <= node->y + node->height / 2)
-	return node->id;
-      no++;
-    }
-  return -1;
+  gint node = -1;
+  grid_query (gl, x, y, x, y, pick_first, &node);
+  return node;
+}
+
+/* move a node, for instance while it is dragged on the canvas, the
+ * spatial index follows
+ */
+void
+graph_layout_node_setpos (struct GraphLayout *gl,
+			  gint node, gdouble x, gdouble y)
+{
+  GraphLayoutNode *n = id2node (gl, node);
+  if (!n)
+    return;
+  gl->revision++;
+  gl->x[n->no] = x;
+  gl->y[n->no] = y;
+  grid_update (gl, n);
+  routes_invalidate (gl, n);
 }
 
 /* query which node handles are involved in an connection
@@ -502,12 +5487,12 @@ graph_layout_connection_get_nodes (struct GraphLayout *gl,
 				   gint connection_no,
 				   gint * from_node, gint * to_node)
 {
-  if (connection_no > gl->connections)
+  if (connection_no < 0 || connection_no >= gl->connections)
     return;
   if (from_node)
-    *from_node = gl->connection[connection_no]->from_node_id;
+    *from_node = gl->connection[connection_no].from_node_id;
   if (to_node)
-    *to_node = gl->connection[connection_no]->to_node_id;
+    *to_node = gl->connection[connection_no].to_node_id;
 }
 
 /* query which node handles are involved in an connection
@@ -520,16 +5505,16 @@ graph_layout_connection_get_nodes_pads (struct GraphLayout *gl,
 					gint * from_pad,
 					gint * to_node, gint * to_pad)
 {
-  if (connection_no > gl->connections)
+  if (connection_no < 0 || connection_no >= gl->connections)
     return;
   if (from_node)
-    *from_node = gl->connection[connection_no]->from_node_id;
+    *from_node = gl->connection[connection_no].from_node_id;
   if (to_node)
-    *to_node = gl->connection[connection_no]->to_node_id;
+    *to_node = gl->connection[connection_no].to_node_id;
   if (from_pad)
-    *from_pad = gl->connection[connection_no]->from_pad;
+    *from_pad = gl->connection[connection_no].from_pad;
   if (to_pad)
-    *to_pad = gl->connection[connection_no]->to_pad;
+    *to_pad = gl->connection[connection_no].to_pad;
 }
 
 /* query the coordinates of connection end-points
@@ -540,37 +5525,9 @@ graph_layout_connection_get_coords (struct GraphLayout *gl,
 				    gdouble * x0,
 				    gdouble * y0, gdouble * x1, gdouble * y1)
 {
-  gint from_node;
-  gint to_node;
-  gint from_pad;
-  gint to_pad;
-
-  if (connection_no > gl->connections)
+  if (connection_no < 0 || connection_no >= gl->connections)
     return;
-
-  graph_layout_connection_get_nodes_pads (gl, connection_no, &from_node,
-					  &from_pad, &to_node, &to_pad);
-
-  graph_layout_node_getpos (gl, from_node, x0, y0);
-  graph_layout_node_getpos (gl, to_node, x1, y1);
-
-  *y0 += graph_layout_node_height_get (gl, from_node) / 2;
-  *y1 -= graph_layout_node_height_get (gl, to_node) / 2;
-
-  {
-    gdouble from_width = graph_layout_node_width_get (gl, from_node);
-    gint from_pads = graph_layout_node_outpads_get (gl, from_node);
-
-    gdouble to_width = graph_layout_node_width_get (gl, to_node);
-    gint to_pads = graph_layout_node_inpads_get (gl, to_node);
-
-    *x0 +=
-      -from_width * 0.9 / 2 + (from_width * 0.9 / from_pads) * (from_pad +
-								0.5);
-    *x1 += -to_width * 0.9 / 2 + (to_width * 0.9 / to_pads) * (to_pad + 0.5);
-
-  }
-
+  connection_ends (gl, &gl->connection[connection_no], x0, y0, x1, y1);
 }
 
 /* get number of nodes in graph
@@ -589,77 +5546,229 @@ graph_layout_connection_count (struct GraphLayout * gl)
   return gl->connections;
 }
 
+/* check whether a node handle still refers to a node in the layout
+ */
+gint
+graph_layout_node_valid (struct GraphLayout *gl, gint node)
+{
+  return id2no (gl, node) != -1;
+}
+
 void
 graph_layout_node_width_set (struct GraphLayout *gl, gint node, gdouble width)
 {
-  gl->node[id2no (gl, node)]->width = width;
+  GraphLayoutNode *n = id2node (gl, node);
+  if (n)
+    {
+      gl->revision++;
+      group_touch (gl, n);
+      if (n->meta)
+	n->meta->width = width;
+      if (!n->meta || n->meta->collapsed)
+	gl->width[n->no] = width;
+      grid_extents (gl, n);
+      routes_invalidate (gl, n);
+    }
 }
 
 void
 graph_layout_node_height_set (struct GraphLayout *gl,
 			      gint node, gdouble height)
 {
-  gl->node[id2no (gl, node)]->height = height;
+  GraphLayoutNode *n = id2node (gl, node);
+  if (n)
+    {
+      gl->revision++;
+      group_touch (gl, n);
+      if (n->meta)
+	n->meta->height = height;
+      if (!n->meta || n->meta->collapsed)
+	gl->height[n->no] = height;
+      grid_extents (gl, n);
+      routes_invalidate (gl, n);
+    }
 }
 
 gdouble
 graph_layout_node_width_get (struct GraphLayout *gl, gint node)
 {
+  GraphLayoutNode *n;
   assert (gl);
-  assert (node >= 0);
-  return gl->node[id2no (gl, node)]->width;
+  n = id2node (gl, node);
+  return n ? gl->width[n->no] : 0.0;
 }
 
 gdouble
 graph_layout_node_height_get (struct GraphLayout * gl, gint node)
 {
+  GraphLayoutNode *n;
   assert (gl);
-  assert (node >= 0);
-  return gl->node[id2no (gl, node)]->height;
+  n = id2node (gl, node);
+  return n ? gl->height[n->no] : 0.0;
 }
 
 void
 graph_layout_node_inpads_set (struct GraphLayout *gl, gint node, gint inpads)
 {
-  gl->node[id2no (gl, node)]->inpads = inpads;
+  GraphLayoutNode *n = id2node (gl, node);
+  if (n)
+    {
+      gl->revision++;
+      group_touch (gl, n);
+      n->inpads = inpads;
+      routes_invalidate (gl, n);
+    }
 }
 
 gint
 graph_layout_node_inpads_get (struct GraphLayout *gl, gint node)
 {
-  return gl->node[id2no (gl, node)]->inpads;
+  GraphLayoutNode *n = id2node (gl, node);
+  return n ? n->inpads : 0;
 }
 
 void
 graph_layout_node_outpads_set (struct GraphLayout *gl,
 			       gint node, gint outpads)
 {
-  gl->node[id2no (gl, node)]->outpads = outpads;
+  GraphLayoutNode *n = id2node (gl, node);
+  if (n)
+    {
+      gl->revision++;
+      group_touch (gl, n);
+      n->outpads = outpads;
+      routes_invalidate (gl, n);
+    }
 }
 
 gint
 graph_layout_node_outpads_get (struct GraphLayout *gl, gint node)
 {
-  return gl->node[id2no (gl, node)]->outpads;
+  GraphLayoutNode *n = id2node (gl, node);
+  return n ? n->outpads : 0;
 }
 
+/* resolve a node handle to its current index in gl->node[], -1 is
+ * returned for handles that are malformed or refer to a freed node
+ */
 static gint
 id2no (struct GraphLayout *gl, glong id)
 {
-  gint no = 0;
-  while (gl->node[no])
+  GraphLayoutNode *node = id2node (gl, id);
+  return node ? node->no : -1;
+}
+
+static GraphLayoutNode *
+slot2node (struct GraphLayout *gl, glong slot_no)
+{
+  return &gl->pool[slot_no >> GL_CHUNK_BITS][slot_no & (GL_CHUNK_SIZE - 1)];
+}
+
+static GraphLayoutNode *
+id2node (struct GraphLayout *gl, glong id)
+{
+  glong slot_no = id & GL_SLOT_MASK;
+  GraphLayoutNode *node;
+
+  if (id <= 0 || slot_no >= gl->slots)
+    return NULL;
+  node = slot2node (gl, slot_no);
+  if (node->generation != (id >> GL_SLOT_BITS) || node->no == -1)
+    return NULL;
+  return node;
+}
+
+/* store node at index node_no of gl->node[]
+ */
+static void
+node_set_no (struct GraphLayout *gl, gint node_no, GraphLayoutNode * node)
+{
+  gl->node[node_no] = node;
+  node->no = node_no;
+}
+
+/* retire the handle of a node, slots whose generation would wrap
+ * around are never reused so that a stale handle can not alias a later
+ * node
+ */
+static void
+slot_retire (struct GraphLayout *gl, GraphLayoutNode * node)
+{
+  node->no = -1;
+  if (node->generation < GL_GENERATION_MAX)
     {
-      if (gl->node[no]->id == id)
-	return no;
-      no++;
+      node->generation++;
+      node->next_free = gl->free_slot;
+      gl->free_slot = node->id & GL_SLOT_MASK;
     }
-  return -1;
 }
 
+/* move the node at index from to index to, along with its geometry
+ */
+static void
+node_move (struct GraphLayout *gl, gint from, gint to)
+{
+  node_set_no (gl, to, gl->node[from]);
+  gl->x[to] = gl->x[from];
+  gl->y[to] = gl->y[from];
+  gl->width[to] = gl->width[from];
+  gl->height[to] = gl->height[from];
+}
+
+/* reorder the nodes so that the node at index order[i] ends up at
+ * index i, along with its geometry
+ */
 static gint
-no2id (struct GraphLayout *gl, gint no)
+node_permute (struct GraphLayout *gl, const gint * order)
 {
-  return gl->node[no]->id;
+  GraphLayoutNode **node = malloc (sizeof (GraphLayoutNode *) * gl->nodes);
+  gdouble *scratch = malloc (sizeof (gdouble) * gl->nodes);
+  gdouble *field[4] = { gl->x, gl->y, gl->width, gl->height };
+  gint i, f;
+
+  if (!node || !scratch)
+    {
+      free (node);
+      free (scratch);
+      return -1;
+    }
+  for (i = 0; i < gl->nodes; i++)
+    node[i] = gl->node[order[i]];
+  for (i = 0; i < gl->nodes; i++)
+    node_set_no (gl, i, node[i]);
+  for (f = 0; f < 4; f++)
+    {
+      memcpy (scratch, field[f], sizeof (gdouble) * gl->nodes);
+      for (i = 0; i < gl->nodes; i++)
+	field[f][i] = scratch[order[i]];
+    }
+  free (scratch);
+  free (node);
+  return 0;
+}
+
+/* grow or shrink the arrays indexed by node number
+ */
+static gint
+node_storage_resize (struct GraphLayout *gl, glong alloc)
+{
+  GraphLayoutNode **node;
+  gdouble **field[4] = { &gl->x, &gl->y, &gl->width, &gl->height };
+  gint f;
+
+  node = realloc (gl->node, sizeof (GraphLayoutNode *) * alloc);
+  if (!node)
+    return -1;
+  gl->node = node;
+  for (f = 0; f < 4; f++)
+    {
+      gdouble *values = realloc (*field[f], sizeof (gdouble) * alloc);
+      if (!values)
+	return -1;
+      *field[f] = values;
+    }
+  gl->alloc_nodes = alloc;
+  return 0;
 }
 
 gint
@@ -671,9 +5780,23 @@ graph_layout_node_no2id (struct GraphLayout * gl, gint no)
 static void
 remove_connection (struct GraphLayout *gl, gint connection_no)
 {
-  free (gl->connection[connection_no]);
-  gl->connection[connection_no] = gl->connection[gl->connections - 1];
-  gl->connection[gl->connections - 1] = NULL;
+  GraphLayoutConnection *connection = &gl->connection[connection_no];
+  gint last = gl->connections - 1;
+
+  gl->revision++;
+  group_touch_connection (gl, connection);
+  edges_remove (&id2node (gl, connection->from_node_id)->out, connection_no);
+  edges_remove (&id2node (gl, connection->to_node_id)->in, connection_no);
+  free (connection->route);
+
+  if (connection_no != last)
+    {				/* the last connection takes its place */
+      *connection = gl->connection[last];
+      edges_renumber (&id2node (gl, connection->from_node_id)->out,
+		      last, connection_no);
+      edges_renumber (&id2node (gl, connection->to_node_id)->in,
+		      last, connection_no);
+    }
   gl->connections--;
 }
 
@@ -720,122 +5843,415 @@ add_connection_no (struct GraphLayout *gl)
 
   for (i = 0; i < gl->connections; i++)
     {
-      gl->connection[i]->from_node_no =
-	id2no (gl, gl->connection[i]->from_node_id);
-      gl->connection[i]->to_node_no =
-	id2no (gl, gl->connection[i]->to_node_id);
+      gl->connection[i].from_node_no =
+	id2no (gl, gl->connection[i].from_node_id);
+      gl->connection[i].to_node_no =
+	id2no (gl, gl->connection[i].to_node_id);
     }
 }
 
 
+/* the nodes still to be ordered by feedback_order(), kept in buckets
+ * by the number of connections they have among themselves
+ */
+typedef struct FeedbackPass
+{
+  gint *in;			/* incoming connections, by local index */
+  gint *out;			/* outgoing connections */
+  gint *bucket;			/* current bucket, -1 once ordered */
+  gint *next;			/* list of the nodes in a bucket */
+  gint *prev;
+  gint *head;			/* first node of each bucket, -1 for none */
+  gint degree;			/* buckets 0 .. 2 * degree are by out - in */
+  gint sinks;			/* bucket of the nodes without outgoing */
+  gint sources;			/* and of those with only outgoing ones */
+  gint top;			/* no bucket by out - in above is used */
+} FeedbackPass;
+
 static gint
-inputs_done (struct GraphLayout *gl,
-	     GraphLayoutNode * node, gint * connection_done)
+feedback_bucket (FeedbackPass * pass, gint i)
 {
-  gint i;
+  if (!pass->out[i])
+    return pass->sinks;
+  if (!pass->in[i])
+    return pass->sources;
+  return pass->out[i] - pass->in[i] + pass->degree;
+}
 
-  for (i = 0; i < gl->connections; i++)
-    if (gl->connection[i]->to_node_id == node->id)
-      if (!connection_done[i])
-	return 0;
-  return 1;
+static void
+feedback_link (FeedbackPass * pass, gint i)
+{
+  gint bucket = feedback_bucket (pass, i);
+
+  pass->bucket[i] = bucket;
+  pass->prev[i] = -1;
+  pass->next[i] = pass->head[bucket];
+  if (pass->next[i] >= 0)
+    pass->prev[pass->next[i]] = i;
+  pass->head[bucket] = i;
+  if (bucket < pass->sinks && bucket > pass->top)
+    pass->top = bucket;
 }
 
 static void
-mark_outputsdone (struct GraphLayout *gl,
-		  GraphLayoutNode * node, int *connection_done)
+feedback_unlink (FeedbackPass * pass, gint i)
 {
-  gint i;
+  if (pass->prev[i] >= 0)
+    pass->next[pass->prev[i]] = pass->next[i];
+  else
+    pass->head[pass->bucket[i]] = pass->next[i];
+  if (pass->next[i] >= 0)
+    pass->prev[pass->next[i]] = pass->prev[i];
+}
 
-  for (i = 0; i < gl->connections; i++)
-    if (gl->connection[i]->from_node_id == node->id)
-      connection_done[i] = 1;
+/* Eades, Lin and Smyth's greedy heuristic for a small feedback arc
+ * set, linear in the size of the graph: sinks are taken off to the end
+ * of the order, sources to the front, and when there are neither the
+ * node with the largest excess of outgoing over incoming connections
+ * goes to the front. Orders queue[first..] of the nodes left by a
+ * topological sort, considering the connections among them only.
+ * return: 0 on success, -1 when out of memory
+ */
+static gint
+feedback_order (struct GraphLayout *gl, gint * queue, gint first)
+{
+  FeedbackPass pass;
+  gint count = gl->nodes - first;
+  gint *local = malloc (sizeof (gint) * (gl->nodes + 1));
+  gint *node = malloc (sizeof (gint) * (count + 1));
+  gint front = first;
+  gint back = gl->nodes;
+  gint result = -1;
+  gint i, j, side;
+
+  memset (&pass, 0, sizeof (FeedbackPass));
+  pass.in = malloc (sizeof (gint) * (count + 1));
+  pass.out = malloc (sizeof (gint) * (count + 1));
+  pass.bucket = malloc (sizeof (gint) * (count + 1));
+  pass.next = malloc (sizeof (gint) * (count + 1));
+  pass.prev = malloc (sizeof (gint) * (count + 1));
+  if (!local || !node || !pass.in || !pass.out || !pass.bucket ||
+      !pass.next || !pass.prev)
+    goto done;
+
+  for (i = 0; i < gl->nodes; i++)
+    local[i] = -1;
+  for (i = 0; i < count; i++)
+    {
+      node[i] = queue[first + i];
+      local[node[i]] = i;
+    }
+  /* connections of a node to itself do not count */
+  for (i = 0; i < count; i++)
+    {
+      GraphLayoutNode *n = gl->node[node[i]];
+      pass.in[i] = pass.out[i] = 0;
+      for (j = 0; j < n->in.count; j++)
+	{
+	  gint from = gl->connection[n->in.conn[j]].from_node_no;
+	  pass.in[i] += from != node[i] && local[from] >= 0;
+	}
+      for (j = 0; j < n->out.count; j++)
+	{
+	  gint to = gl->connection[n->out.conn[j]].to_node_no;
+	  pass.out[i] += to != node[i] && local[to] >= 0;
+	}
+      pass.degree = MAX (pass.degree, MAX (pass.in[i], pass.out[i]));
+    }
+  pass.sinks = 2 * pass.degree + 1;
+  pass.sources = pass.sinks + 1;
+  pass.head = malloc (sizeof (gint) * (pass.sources + 1));
+  if (!pass.head)
+    goto done;
+  for (i = 0; i <= pass.sources; i++)
+    pass.head[i] = -1;
+  for (i = 0; i < count; i++)
+    feedback_link (&pass, i);
+
+  while (front < back)
+    {
+      GraphLayoutNode *n;
+      gint pick;
+
+      if (pass.head[pass.sinks] >= 0)
+	pick = pass.head[pass.sinks];
+      else if (pass.head[pass.sources] >= 0)
+	pick = pass.head[pass.sources];
+      else
+	{			/* a node gaining a source only moves up */
+	  while (pass.head[pass.top] < 0)
+	    pass.top--;
+	  pick = pass.head[pass.top];
+	}
+      if (pass.bucket[pick] == pass.sinks)
+	queue[--back] = node[pick];
+      else
+	queue[front++] = node[pick];
+      feedback_unlink (&pass, pick);
+      pass.bucket[pick] = -1;
+
+      /* its neighbours still to be ordered lose a connection */
+      n = gl->node[node[pick]];
+      for (side = 0; side < 2; side++)
+	{
+	  GraphLayoutEdges *edges = side ? &n->out : &n->in;
+	  for (j = 0; j < edges->count; j++)
+	    {
+	      GraphLayoutConnection *connection =
+		&gl->connection[edges->conn[j]];
+	      gint other = local[side ? connection->to_node_no :
+				 connection->from_node_no];
+	      if (other < 0 || other == pick || pass.bucket[other] < 0)
+		continue;
+	      if (side)
+		pass.in[other]--;
+	      else
+		pass.out[other]--;
+	      if (feedback_bucket (&pass, other) != pass.bucket[other])
+		{
+		  feedback_unlink (&pass, other);
+		  feedback_link (&pass, other);
+		}
+	    }
+	}
+    }
+  result = 0;
+
+done:
+  free (local);
+  free (node);
+  free (pass.in);
+  free (pass.out);
+  free (pass.bucket);
+  free (pass.next);
+  free (pass.prev);
+  free (pass.head);
+  return result;
 }
 
+/* Kahn's algorithm; nodes are moved to the front of gl->node[] in
+ * topological order. Nodes that are part of, or downstream of, a
+ * cycle can not be sorted, they are counted in gl->unsorted_nodes and
+ * put at the end of gl->node[] in an order that leaves few connections
+ * pointing backwards. Those connections, and connections from a node
+ * to itself, are marked reversed; the layout treats them as pointing
+ * the other way. A layout of part of another one keeps the reversed
+ * connections it was given.
+ */
 static void
 toposort (struct GraphLayout *gl)
 {
-  gint *connection_done = NULL;
-  gint nodes_done = 0;
-  gint prev_nodes_done = 0;
+  gint *indegree;
+  gint *queue;
+  gint head = 0;
+  gint tail = 0;
+  gint node_no;
+  gint i;
 
+  gl->unsorted_nodes = 0;
   if (!gl->nodes)
     return;
 
-  connection_done = calloc (1, sizeof (int) * gl->connections);
+  add_connection_no (gl);
+  if (!gl->component_job)
+    for (i = 0; i < gl->connections; i++)
+      gl->connection[i].reversed = 0;
 
-  while (nodes_done < gl->nodes)
+  indegree = malloc (sizeof (gint) * gl->nodes);
+  queue = malloc (sizeof (gint) * gl->nodes);
+  if (!indegree || !queue)
     {
+      fprintf (stderr, "graph_layout toposort mem error\n");
+      free (indegree);
+      free (queue);
+      return;
+    }
 
-      int node_no;
-    eek:
-
-      node_no = nodes_done;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    indegree[node_no] = 0;
+  for (i = 0; i < gl->connections; i++)
+    {
+      GraphLayoutConnection *connection = &gl->connection[i];
+      if (!connection->reversed)
+	indegree[connection->to_node_no]++;
+      else if (connection->from_node_no != connection->to_node_no)
+	indegree[connection->from_node_no]++;
+    }
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    if (!indegree[node_no])
+      queue[tail++] = node_no;
 
-      while (node_no < gl->nodes)
+  while (head < tail)
+    {
+      GraphLayoutNode *node = gl->node[queue[head++]];
+      for (i = 0; i < node->out.count; i++)
+	{
+	  GraphLayoutConnection *connection = &gl->connection[node->out.conn[i]];
+	  if (!connection->reversed && --indegree[connection->to_node_no] == 0)
+	    queue[tail++] = connection->to_node_no;
+	}
+      for (i = 0; i < node->in.count; i++)
 	{
-	  prev_nodes_done = nodes_done;
+	  GraphLayoutConnection *connection = &gl->connection[node->in.conn[i]];
+	  if (connection->reversed &&
+	      connection->from_node_no != connection->to_node_no &&
+	      --indegree[connection->from_node_no] == 0)
+	    queue[tail++] = connection->from_node_no;
+	}
+    }
 
-	  if (inputs_done (gl, gl->node[node_no], connection_done))
+  gl->unsorted_nodes = gl->nodes - tail;
+  if (gl->unsorted_nodes)
+    {
+      gint first = tail;
+      for (node_no = 0; node_no < gl->nodes; node_no++)
+	if (indegree[node_no])
+	  queue[tail++] = node_no;
+      if (!feedback_order (gl, queue, first))
+	{			/* connections pointing backwards are reversed */
+	  gint *position = indegree;
+	  for (i = 0; i < gl->nodes; i++)
+	    position[queue[i]] = i;
+	  for (i = 0; i < gl->connections; i++)
 	    {
-	      GraphLayoutNode *temp;
-
-	      mark_outputsdone (gl, gl->node[node_no], connection_done);
-	      temp = gl->node[node_no];
-	      gl->node[node_no] = gl->node[nodes_done];
-	      gl->node[nodes_done] = temp;
-	      nodes_done++;
-	      goto eek;
+	      GraphLayoutConnection *connection = &gl->connection[i];
+	      if (position[connection->from_node_no] >=
+		  position[connection->to_node_no])
+		connection->reversed = 1;
 	    }
-	  node_no++;
-	}
-      if (nodes_done == prev_nodes_done)
-	{
-	  free (connection_done);
-	  return;
 	}
     }
 
-  free (connection_done);
+  node_permute (gl, queue);
+
+  free (queue);
+  free (indegree);
 
   add_connection_no (gl);
+  reversed_count (gl);
+}
+
+/* count the connections marked reversed */
+static void
+reversed_count (struct GraphLayout *gl)
+{
+  gint i;
+
+  gl->reversed_connections = 0;
+  for (i = 0; i < gl->connections; i++)
+    gl->reversed_connections += gl->connection[i].reversed;
+}
+
+/* check whether the last layout reversed a connection to break a cycle
+ */
+gint
+graph_layout_connection_reversed (struct GraphLayout *gl, gint connection_no)
+{
+  if (connection_no < 0 || connection_no >= gl->connections)
+    return 0;
+  return gl->connection[connection_no].reversed;
+}
+
+/* get the number of connections reversed by the last layout
+ */
+gint
+graph_layout_reversed_count (struct GraphLayout *gl)
+{
+  return gl->reversed_connections;
+}
+
+/* get the number of nodes the last layout could not order because
+ * they are on, or downstream of, a cycle
+ */
+gint
+graph_layout_unsorted_count (struct GraphLayout *gl)
+{
+  return gl->unsorted_nodes;
+}
+
+/* get the handle of the n'th node that could not be ordered
+ */
+gint
+graph_layout_unsorted_get (struct GraphLayout *gl, gint n)
+{
+  if (n < 0 || n >= gl->unsorted_nodes || gl->unsorted_nodes > gl->nodes)
+    return -1;
+  return gl->node[gl->nodes - gl->unsorted_nodes + n]->id;
+}
+
+/* get the number of ranks computed by the last layout
+ */
+gint
+graph_layout_rank_count (struct GraphLayout *gl)
+{
+  ranks_update (gl);
+  return gl->ranks;
+}
+
+/* get the number of nodes in a rank
+ */
+gint
+graph_layout_rank_size (struct GraphLayout *gl, gint rank)
+{
+  ranks_update (gl);
+  if (rank < 0 || rank >= gl->ranks)
+    return 0;
+  return gl->rank_line[rank].nodes;
+}
+
+/* get the handle of the n'th node within a rank
+ */
+gint
+graph_layout_rank_get (struct GraphLayout *gl, gint rank, gint n)
+{
+  ranks_update (gl);
+  if (rank < 0 || rank >= gl->ranks || n < 0 ||
+      n >= gl->rank_line[rank].nodes)
+    return -1;
+  return gl->rank_line[rank].node[n]->id;
+}
+
+/* get the rank assigned to a node by the last layout
+ */
+gint
+graph_layout_node_rank_get (struct GraphLayout *gl, gint node)
+{
+  GraphLayoutNode *n = id2node (gl, node);
+  return n ? n->rank : -1;
 }
 
 static void
 center_graph (struct GraphLayout *gl)
 {
   gint node_no;
-#define BIG_DOUBLE 300000.0
-  gdouble left = BIG_DOUBLE;
-  gdouble top = BIG_DOUBLE;
-  gdouble right = -BIG_DOUBLE;
-  gdouble bottom = -BIG_DOUBLE;
+  gdouble left = G_MAXDOUBLE;
+  gdouble top = G_MAXDOUBLE;
+  gdouble right = -G_MAXDOUBLE;
+  gdouble bottom = -G_MAXDOUBLE;
 
   gdouble shift_x, shift_y;	/* amount of shifting to center layout */
 
-  for (node_no = 0; gl->node[node_no]; node_no++)
-    {
-      GraphLayoutNode *node = gl->node[node_no];
+  if (!gl->nodes)
+    return;
 
-      if (node->x - node->width / 2 < left)
-	left = node->x - node->width / 2;
-      if (node->y - node->height / 2 < top)
-	top = node->y - node->height / 2;
+  for (node_no = 0; node_no < gl->nodes; node_no++)
+    {
+      gdouble half_width = gl->width[node_no] / 2;
+      gdouble half_height = gl->height[node_no] / 2;
 
-      if (node->x + node->width / 2 > right)
-	right = node->x + node->width / 2;
-      if (node->y + node->height / 2 > bottom)
-	bottom = node->y + node->height / 2;
+      left = MIN (left, gl->x[node_no] - half_width);
+      top = MIN (top, gl->y[node_no] - half_height);
+      right = MAX (right, gl->x[node_no] + half_width);
+      bottom = MAX (bottom, gl->y[node_no] + half_height);
     }
 
   shift_x = (left + right) / 2;
   shift_y = (top + bottom) / 2;
 
-  for (node_no = 0; gl->node[node_no]; node_no++)
+  for (node_no = 0; node_no < gl->nodes; node_no++)
     {
-      GraphLayoutNode *node = gl->node[node_no];
-
-      node->x -= shift_x;
-      node->y -= shift_y;
+      gl->x[node_no] -= shift_x;
+      gl->y[node_no] -= shift_y;
     }
+  gl->origin_y -= shift_y;
 };
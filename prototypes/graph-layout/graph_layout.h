@@ -58,8 +58,73 @@ graph_layout_nodesep_get     (struct GraphLayout *gl);
 double
 graph_layout_ranksep_get     (struct GraphLayout *gl);
 
+/* Set the number of ordering sweeps used to reduce edge crossings,
+ * 0 disables crossing reduction
+ */
+void
+graph_layout_crossing_iterations_set (struct GraphLayout *gl,
+                                      int                 iterations);
+
+int
+graph_layout_crossing_iterations_get (struct GraphLayout *gl);
+
+/* Set the time budget in milliseconds for crossing reduction,
+ * 0 for no limit
+ */
+void
+graph_layout_crossing_time_set (struct GraphLayout *gl,
+                                int                 msecs);
+
+int
+graph_layout_crossing_time_get (struct GraphLayout *gl);
+
+/* Get the number of crossings between connections of adjacent ranks
+ * left by the last layout
+ */
+long
+graph_layout_crossings_get    (struct GraphLayout *gl);
+
+/* Set the number of threads laying out disconnected parts of the graph
+ * in parallel, 0 (the default) uses one per processor and 1 does all
+ * the work on the calling thread. The layout does not depend on it.
+ */
+void
+graph_layout_threads_set      (struct GraphLayout *gl,
+                               int                 threads);
+
+int
+graph_layout_threads_get      (struct GraphLayout *gl);
+
+typedef void (*GraphLayoutDoneFunc) (struct GraphLayout *gl,
+                                     void               *data);
+
+/* Lay out a snapshot of the graph on a worker thread and return at
+ * once, superseding any pending asynchronous relayout. The result is
+ * applied from an idle handler in the default main context, after
+ * which done is called; results for a graph that was edited in the
+ * meantime are dropped, so relayout again after editing. The cache
+ * file is looked up and written as by graph_layout_relayout().
+ * return: 0 on success, -1 when the job could not be started
+ */
+int
+graph_layout_relayout_async   (struct GraphLayout  *gl,
+                               GraphLayoutDoneFunc  done,
+                               void                *data);
+
+/* Drop the result of the pending asynchronous relayout, if any
+ */
+void
+graph_layout_relayout_cancel  (struct GraphLayout *gl);
+
+/* check whether an asynchronous relayout is still to be delivered
+ */
+int
+graph_layout_relayout_pending (struct GraphLayout *gl);
+
 /* Add a new node to the layout, an integer handle used for
- * referencing the node within the instance is returned.
+ * referencing the node within the instance is returned. Handles are
+ * always positive, resolve in constant time and stay valid until the
+ * node is freed, after which they are rejected rather than reused.
  */
 int
 graph_layout_node_new        (struct GraphLayout *gl);
@@ -70,6 +135,12 @@ graph_layout_node_new        (struct GraphLayout *gl);
 void
 graph_layout_node_free       (struct GraphLayout *gl, int node);
 
+/* Check whether a handle refers to a live node, returns 0 for handles
+ * of freed nodes. Setters ignore such handles and getters return 0.
+ */
+int
+graph_layout_node_valid      (struct GraphLayout *gl, int node);
+
 void
 graph_layout_node_width_set  (struct GraphLayout *gl,
                               int                 node,
@@ -121,21 +192,93 @@ graph_layout_connection_set   (struct GraphLayout *gl,
                                int                 dest_node,
                                int                 dest_pad);
 
+/* Start a batch of edits. Connections set until the matching
+ * graph_layout_commit() are only recorded, and are checked and indexed
+ * all at once when the outermost batch is committed; the last one set
+ * for an input pad wins. They are not visible to the connection
+ * queries before that, removing a connection, freeing a node or
+ * relaying out commits what was recorded so far. Batches nest.
+ */
+void
+graph_layout_begin            (struct GraphLayout *gl);
+
+void
+graph_layout_commit           (struct GraphLayout *gl);
+
+/* Make room for the given number of nodes and connections on top of
+ * the ones already in the graph
+ */
+void
+graph_layout_reserve          (struct GraphLayout *gl,
+                               int                 nodes,
+                               int                 connections);
+
+/* Add count nodes at once, their handles are stored in nodes
+ * return: the number of nodes added
+ */
+int
+graph_layout_nodes_new        (struct GraphLayout *gl,
+                               int                 count,
+                               int                *nodes);
+
+/* Assign count connections given as arrays, as a single batch
+ */
+void
+graph_layout_connections_set  (struct GraphLayout *gl,
+                               int                 count,
+                               const int          *source_node,
+                               const int          *source_pad,
+                               const int          *dest_node,
+                               const int          *dest_pad);
+
 /* get number of connections in graph
  */
 int
 graph_layout_connection_count (struct GraphLayout *gl);
 
-/* query if a node is at given position
+/* query if a node is at given position, using a spatial index
  * return: node handle
- *         0 no node present
- *        -1 error
+ *        -1 no node present
  */
 int
 graph_layout_node_resolve     (struct GraphLayout *gl,
                                double              x,
                                double              y);
 
+/* query the nodes whose bounding box intersects a rectangle, as for
+ * rubber band selection. Up to max handles are stored in nodes, the
+ * number of intersecting nodes is returned and may exceed max.
+ */
+int
+graph_layout_nodes_in_rect    (struct GraphLayout *gl,
+                               double              x0,
+                               double              y0,
+                               double              x1,
+                               double              y1,
+                               int                *nodes,
+                               int                 max);
+
+/* query the pad nearest to a position, within radius
+ * return: node handle, pad number and whether it is an input are
+ *         stored in pad and input
+ *        -1 no pad within radius
+ */
+int
+graph_layout_pad_resolve      (struct GraphLayout *gl,
+                               double              x,
+                               double              y,
+                               double              radius,
+                               int                *pad,
+                               int                *input);
+
+/* move a node, for instance while it is being dragged
+ */
+void
+graph_layout_node_setpos      (struct GraphLayout *gl,
+                               int                 node,
+                               double              x,
+                               double              y);
+
 /* query which node handles are involved in an connection
  * within the graph layout
  */
@@ -145,8 +288,8 @@ graph_layout_connection_get_nodes (struct GraphLayout *gl,
                                    int                *from_node,
                                    int                *to_node);
 
-/* query the coordinates of connection end-points, is returned as the
- * center of the nodes involved in the connection.
+/* query the coordinates of connection end-points, the output pad of
+ * the source node and the input pad of the destination node.
  */
 void
 graph_layout_connection_get_coords (struct GraphLayout *gl,
@@ -156,9 +299,219 @@ graph_layout_connection_get_coords (struct GraphLayout *gl,
                                     double             *x1,
                                     double             *y1);
 
+typedef enum
+{
+  GRAPH_LAYOUT_ROUTE_ORTHOGONAL,
+  GRAPH_LAYOUT_ROUTE_SPLINE
+} GraphLayoutRouting;
+
+/* Set how connections are routed around the nodes in their way, the
+ * default is GRAPH_LAYOUT_ROUTE_ORTHOGONAL
+ */
+void
+graph_layout_routing_set      (struct GraphLayout *gl,
+                               GraphLayoutRouting  routing);
+
+GraphLayoutRouting
+graph_layout_routing_get      (struct GraphLayout *gl);
+
+/* query the route of a connection, as count points stored as x, y
+ * pairs in a flat array owned by the layout, starting at the output pad
+ * and ending at the input pad. Orthogonal routes are polylines, spline
+ * routes are a start point followed by the two control points and the
+ * end point of each cubic bezier segment. Routes are cached and only
+ * computed again once a node at either end is moved, resized or has
+ * its pads changed; nodes moved in the way of a route do not reroute
+ * it. The array is valid until the graph is edited or laid out.
+ * return: the number of points, 0 for an invalid connection
+ */
+int
+graph_layout_connection_get_route (struct GraphLayout  *gl,
+                                   int                  connection_no,
+                                   const double       **points);
+
+typedef enum
+{
+  GRAPH_LAYOUT_RANKED,
+  GRAPH_LAYOUT_FORCE
+} GraphLayoutMode;
+
+/* Select how graph_layout_relayout() places the nodes. The default,
+ * GRAPH_LAYOUT_RANKED, puts them in rows along the direction of the
+ * connections. GRAPH_LAYOUT_FORCE simulates nodes repelling each other
+ * and connections pulling their ends together, starting from the
+ * current positions; it does not rank the nodes and lays out graphs
+ * with cycles just as well.
+ */
+void
+graph_layout_mode_set         (struct GraphLayout *gl,
+                               GraphLayoutMode     mode);
+
+GraphLayoutMode
+graph_layout_mode_get         (struct GraphLayout *gl);
+
+/* Run a number of iterations of the force directed layout, continuing
+ * from the current positions, for instance one per frame to animate
+ * the layout. Nodes that were never placed start out next to the
+ * nodes they are connected to.
+ * return: 1 while the layout is still moving, 0 once it has settled
+ */
+int
+graph_layout_force_step       (struct GraphLayout *gl,
+                               int                 iterations);
+
+/* Create a group, a node standing for the nodes made its members. A
+ * relayout lays out every group as the graph of its members and then
+ * the group as a single node among the others, as large as its content
+ * when expanded or the size set on it when collapsed. Members of
+ * collapsed groups are hidden, and the layout of a group is only
+ * computed again once it is expanded and something in it changed.
+ * Groups have no pads of their own: connections crossing the boundary
+ * of a group attach to pads aggregated on it, one input pad for every
+ * connection entering it and one output pad for every member pad
+ * feeding connections out of it. Freeing a group moves its members to
+ * the enclosing group.
+ * return: the node handle of the group, -1 on failure
+ */
+int
+graph_layout_group_new        (struct GraphLayout *gl);
+
+/* Make a node, or another group, a member of a group, 0 takes it out
+ * of its group; a group can not be put inside itself
+ */
+void
+graph_layout_node_group_set   (struct GraphLayout *gl,
+                               int                 node,
+                               int                 group);
+
+int
+graph_layout_node_group_get   (struct GraphLayout *gl,
+                               int                 node);
+
+/* Collapse or expand a group, the members are hidden or shown by the
+ * next relayout
+ */
+void
+graph_layout_group_collapsed_set (struct GraphLayout *gl,
+                                  int                 group,
+                                  int                 collapsed);
+
+int
+graph_layout_group_collapsed_get (struct GraphLayout *gl,
+                                  int                 group);
+
+/* check whether the last relayout showed a node, rather than hiding it
+ * inside a collapsed group. Hidden nodes are placed on the group and
+ * not found by the spatial queries, neither are expanded groups.
+ */
+int
+graph_layout_node_visible     (struct GraphLayout *gl,
+                               int                 node);
+
+/* check whether the last relayout showed a connection. A connection
+ * between the members of a collapsed group is hidden, it has no
+ * coordinates nor route; one leaving a collapsed group is drawn from
+ * the group.
+ */
+int
+graph_layout_connection_visible (struct GraphLayout *gl,
+                                 int                 connection_no);
+
 void
 graph_layout_relayout         (struct GraphLayout *gl);
 
+/* Place only the nodes added, or whose connections changed, since the
+ * last layout; other nodes keep their coordinates. Does a full
+ * relayout when there is no previous layout or most nodes changed.
+ */
+void
+graph_layout_relayout_incremental (struct GraphLayout *gl);
+
+/* Keep layouts in a cache file, NULL stops caching. The first relayout
+ * of a graph looks it up in the file: an unchanged graph takes the
+ * cached layout without computing anything, a graph that changed a
+ * little keeps the cached places of the nodes that did not change and
+ * only places the others. A computed layout is written back. Nodes are
+ * matched by handle, so rebuild the graph in the same order.
+ */
+void
+graph_layout_cache_set        (struct GraphLayout *gl,
+                               const char         *path);
+
+/* Write the current layout to the cache file, for instance after
+ * incremental relayouts, which do not write it themselves
+ * return: 0 on success, -1 on failure
+ */
+int
+graph_layout_cache_save       (struct GraphLayout *gl);
+
+/* get a hash of the structure of the graph: the nodes with their sizes,
+ * pads and groups, the connections and the settings of the layout
+ */
+unsigned long long
+graph_layout_hash             (struct GraphLayout *gl);
+
+/* Nodes that are part of a cycle, or only reachable through one, can
+ * not be sorted; they are ranked once the cycles are broken by
+ * reversing a few connections. After a relayout this returns how many
+ * nodes were left unsorted, 0 when the graph is acyclic.
+ */
+int
+graph_layout_unsorted_count   (struct GraphLayout *gl);
+
+/* get the handle of the n'th node left unsorted by the last relayout
+ */
+int
+graph_layout_unsorted_get     (struct GraphLayout *gl,
+                               int                 n);
+
+/* check whether the last relayout reversed a connection to break a
+ * cycle. A reversed connection points against the direction of the
+ * layout, from a higher rank to a lower one, and is best drawn as a
+ * feedback connection; connections from a node to itself count as
+ * reversed. Nothing is reversed by a force directed layout.
+ */
+int
+graph_layout_connection_reversed (struct GraphLayout *gl,
+                                  int                 connection_no);
+
+/* get the number of connections reversed by the last relayout
+ */
+int
+graph_layout_reversed_count   (struct GraphLayout *gl);
+
+/* Every node is assigned a rank by the layout, the length of the
+ * longest path leading into it. The ranks from the last relayout are
+ * kept until the next one, removing a node discards them. With groups
+ * the ranks hold the nodes and groups at the top level, members have
+ * the rank of their outermost group. An incremental relayout ranks the
+ * nodes it places one below their placed providers, or failing that
+ * one above their placed consumers, at the end of their rank; the
+ * other nodes keep their rank, so ranks are longest paths again only
+ * after a full relayout.
+ */
+int
+graph_layout_rank_count       (struct GraphLayout *gl);
+
+/* get the number of nodes in a rank
+ */
+int
+graph_layout_rank_size        (struct GraphLayout *gl,
+                               int                 rank);
+
+/* get the handle of the n'th node in a rank
+ */
+int
+graph_layout_rank_get         (struct GraphLayout *gl,
+                               int                 rank,
+                               int                 n);
+
+/* get the rank of a node, -1 for an invalid handle
+ */
+int
+graph_layout_node_rank_get    (struct GraphLayout *gl,
+                               int                 node);
+
 int
 graph_layout_node_no2id       (struct GraphLayout *gl,
                                int                 no);
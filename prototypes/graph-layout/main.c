@@ -7,23 +7,99 @@
 
 static const gint WIN_W = 640;
 static const gint WIN_H = 480;
+static const guint ANIMATION_MS = 400;
+static const gint NODES_PER_KEY = 20;
 
 typedef struct stuff_
 {
     ClutterActor *group;
     struct GraphLayout *layout;
+    GHashTable *actors; // node handle -> actor
+    GArray *nodes; // node handles, in creation order
 } Stuff;
 
+/**
+ * Called in the main loop once a background relayout is done, moves the
+ * actors over to their new positions.
+ */
+static void layout_done_cb(struct GraphLayout *layout, void *data)
+{
+    Stuff *self = (Stuff *) data;
+    gdouble left = 0.0, right = 0.0, top = 0.0, bottom = 0.0;
+    guint i;
+
+    for (i = 0; i < self->nodes->len; i++)
+    {
+        int node = g_array_index(self->nodes, int, i);
+        ClutterActor *actor = g_hash_table_lookup(self->actors, GINT_TO_POINTER(node));
+        gdouble x, y;
+        gdouble w = graph_layout_node_width_get(layout, node);
+        gdouble h = graph_layout_node_height_get(layout, node);
+
+        graph_layout_node_getpos(layout, node, &x, &y);
+        clutter_actor_animate(actor, CLUTTER_EASE_OUT_CUBIC, ANIMATION_MS,
+            "x", (gfloat) (x - w / 2), "y", (gfloat) (y - h / 2), NULL);
+        left = MIN(left, x - w / 2);
+        right = MAX(right, x + w / 2);
+        top = MIN(top, y - h / 2);
+        bottom = MAX(bottom, y + h / 2);
+    }
+
+    // the layout is centered on the origin, scale it down to fit the stage
+    gdouble scale = MIN(1.0, MIN(WIN_W / (right - left + 1.0), WIN_H / (bottom - top + 1.0)));
+    clutter_actor_animate(self->group, CLUTTER_EASE_OUT_CUBIC, ANIMATION_MS,
+        "scale-x", scale, "scale-y", scale, NULL);
+}
+
+/**
+ * Adds a node fed by one of the existing nodes, its actor starts out on
+ * top of the provider and moves away once the layout is done.
+ */
+static void stuff_add_node(Stuff *self)
+{
+    ClutterColor color = { 0x80, 0xc0, 0xff, 0xff };
+    int node = graph_layout_node_new(self->layout);
+    ClutterActor *actor = clutter_rectangle_new_with_color(&color);
+    gfloat x = 0.0, y = 0.0;
+
+    graph_layout_node_inpads_set(self->layout, node, 1);
+    graph_layout_node_outpads_set(self->layout, node, 2);
+    clutter_actor_set_size(actor, graph_layout_node_width_get(self->layout, node),
+        graph_layout_node_height_get(self->layout, node));
+    if (self->nodes->len)
+    {
+        int provider = g_array_index(self->nodes, int, g_random_int_range(0, self->nodes->len));
+        graph_layout_connection_set(self->layout, provider, g_random_int_range(0, 2), node, 0);
+        clutter_actor_get_position(g_hash_table_lookup(self->actors, GINT_TO_POINTER(provider)), &x, &y);
+    }
+    clutter_actor_set_position(actor, x, y);
+    clutter_container_add_actor(CLUTTER_CONTAINER(self->group), actor);
+    g_hash_table_insert(self->actors, GINT_TO_POINTER(node), actor);
+    g_array_append_val(self->nodes, node);
+}
+
+/**
+ * Grows the graph and lays it out in the background, a relayout still
+ * running for the previous edit is superseded.
+ */
+static void stuff_grow(Stuff *self, gint count)
+{
+    gint i;
+    for (i = 0; i < count; i++)
+        stuff_add_node(self);
+    graph_layout_relayout_async(self->layout, layout_done_cb, self);
+}
+
 static void key_event_cb(ClutterActor *actor, ClutterKeyEvent *event, gpointer data)
 {
     Stuff *self = (Stuff *) data;
-    (void) self; // unused
     switch (event->keyval)
     {
         case CLUTTER_Escape:
             clutter_main_quit();
             break;
         case CLUTTER_space:
+            stuff_grow(self, NODES_PER_KEY);
             break;
         default:
             break;
@@ -35,17 +111,16 @@ void stuff_init(Stuff *self)
     self->layout = graph_layout_new();
     //graph_layout_nodesep_set(self->layout, 2.0);
     //graph_layout_ranksep_set(self->layout, 2.0);
-    int first = graph_layout_node_new(self->layout);
-    int second = graph_layout_node_new(self->layout);
-    graph_layout_node_outpads_set(self->layout, first, 1);
-    graph_layout_node_inpads_set(self->layout, second, 1);
-    graph_layout_connection_set(self->layout, first, 0, second, 0);
-    graph_layout_relayout(self->layout);
+    self->actors = g_hash_table_new(g_direct_hash, g_direct_equal);
+    self->nodes = g_array_new(FALSE, FALSE, sizeof(int));
+    stuff_grow(self, 2);
 }
 
 void stuff_cleanup(Stuff *self)
 {
     graph_layout_free(self->layout);
+    g_hash_table_destroy(self->actors);
+    g_array_free(self->nodes, TRUE);
 }
 
 int main(int argc, char *argv[])
@@ -66,7 +141,9 @@ int main(int argc, char *argv[])
     Stuff *self = g_new0(Stuff, 1);
     self->group = clutter_group_new();
     clutter_container_add_actor(CLUTTER_CONTAINER(stage), self->group);
-    
+    clutter_actor_set_position(self->group, WIN_W / 2, WIN_H / 2);
+    stuff_init(self);
+
     g_signal_connect(stage, "key-press-event", G_CALLBACK(key_event_cb), self);
     clutter_actor_show(stage);
 
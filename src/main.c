@@ -2,9 +2,75 @@
 #include <clutter/clutter.h>
 #include <clutter-gtk/clutter-gtk.h>
 #include <stdlib.h>
+#include <string.h>
 #include "mikado.h"
 
 ClutterActor *stage = NULL;
+MikadoEngine *engine = NULL;
+
+/* Each element adds its own value to the one of its sinks, for now. */
+static void process(MikadoCanvas *canvas, MikadoElement element, gpointer *inputs, guint n_inputs,
+    gpointer *outputs, guint n_outputs, gpointer data)
+{
+    gdouble value = 1.0;
+    guint i;
+    (void) canvas;
+    (void) element;
+    (void) data;
+    for (i = 0; i < n_inputs; i++)
+        if (inputs[i])
+            value += *(gdouble *) inputs[i];
+    for (i = 0; i < n_outputs; i++)
+    {
+        outputs[i] = g_new(gdouble, 1);
+        *(gdouble *) outputs[i] = value;
+    }
+}
+
+static gpointer copy_output(gpointer output, gpointer data)
+{
+    gdouble *copy = g_new(gdouble, 1);
+    (void) data;
+    memcpy(copy, output, sizeof(gdouble));
+    return copy;
+}
+
+/* Reads what the engine has to say, in the main loop. */
+static gboolean on_engine_idle(gpointer user_data)
+{
+    static MikadoElement last = 0;
+    MikadoNotification notification;
+    (void) user_data;
+    while (mikado_engine_next_notification(engine, &notification))
+    {
+        switch (notification.type)
+        {
+        case MIKADO_NOTIFICATION_ELEMENT_ADDED:
+            if (last)
+                mikado_engine_connect(engine, last, 0, notification.element, 0);
+            mikado_engine_set_output(engine, notification.element, 0);
+            last = notification.element;
+            break;
+        case MIKADO_NOTIFICATION_RESULT:
+            if (notification.output)
+                g_print ("Result %f\n", *(gdouble *) notification.output);
+            g_free(notification.output);
+            break;
+        case MIKADO_NOTIFICATION_PROGRESS:
+            /* nothing shows it yet */
+            break;
+        }
+    }
+    return FALSE;
+}
+
+/* Called from the engine thread. */
+static void on_engine_notify(MikadoEngine *engine, gpointer user_data)
+{
+    (void) engine;
+    (void) user_data;
+    g_idle_add(on_engine_idle, NULL);
+}
 
 static gboolean on_button_clicked(GtkButton *button, gpointer user_data)
 {
@@ -31,8 +97,11 @@ static gboolean on_stage_button_press(ClutterStage *stage, ClutterEvent *event,
     (void) user_data;
     gfloat x = 0.0;
     gfloat y = 0.0;
+    static guint tag = 0;
     clutter_event_get_coords(event, &x, &y);
     g_print ("Stage clicked at (%f, %f)\n", x, y);
+    if (! mikado_engine_add_element(engine, tag++, x, y, 1, 1))
+        g_warning ("The engine is busy, the element is not added");
     return TRUE; /* Stop further handling of this event. */
 }
 
@@ -41,6 +110,7 @@ int main(int argc, char *argv[])
     ClutterColor stage_color = { 0x00, 0x00, 0x00, 0xff }; /* Black */
     gtk_clutter_init (&argc, &argv);
     mikado_hello();
+    engine = mikado_engine_new(process, copy_output, g_free, on_engine_notify, NULL);
     /* Create the window and some child widgets: */
     GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
     GtkWidget *vbox = gtk_vbox_new (FALSE, 6);
@@ -74,6 +144,7 @@ int main(int argc, char *argv[])
     gtk_widget_show (GTK_WIDGET (window));
     /* Start the main loop, so we can respond to events: */
     gtk_main ();
+    mikado_engine_free(engine);
     return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,322 @@
+/**
+ * Benchmark of the graph layout engine in prototypes/graph-layout.
+ *
+ * Synthetic graphs of every shape are built at sizes from 100 nodes up
+ * to the maximum, growing tenfold and ending at the maximum, and the
+ * time taken by the main entry points is printed as one tab separated
+ * line per operation:
+ *
+ *   shape nodes connections operation count total_ms ns_per_op
+ *
+ * usage: bench-graph-layout [-n max-nodes] [-s shape] [-r seed]
+ */
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "graph_layout.h"
+
+#define COMPONENT_NODES 8
+#define FORCE_STEPS 3
+#define MAX_QUERIES 100000
+#define NODESEP 16.0
+#define RANKSEP 64.0
+
+/* A generated graph, nodes and connections are given by index and are
+ * mapped to layout handles by the benchmark.
+ */
+typedef struct
+{
+    gint nodes;
+    gint *inpads;
+    gint *outpads;
+    gint connections;
+    gint *source;
+    gint *source_pad;
+    gint *dest;
+    gint *dest_pad;
+} Graph;
+
+typedef void (*GraphGenerator) (Graph *graph, GRand *rand);
+
+static void graph_init(Graph *graph, gint nodes, gint pads)
+{
+    gint i;
+    graph->nodes = nodes;
+    graph->inpads = g_new(gint, nodes);
+    graph->outpads = g_new(gint, nodes);
+    for (i = 0; i < nodes; i++)
+    {
+        graph->inpads[i] = pads;
+        graph->outpads[i] = pads;
+    }
+    graph->connections = 0;
+    /* no shape has more than two connections per node */
+    graph->source = g_new(gint, nodes * 2);
+    graph->source_pad = g_new(gint, nodes * 2);
+    graph->dest = g_new(gint, nodes * 2);
+    graph->dest_pad = g_new(gint, nodes * 2);
+}
+
+static void graph_cleanup(Graph *graph)
+{
+    g_free(graph->inpads);
+    g_free(graph->outpads);
+    g_free(graph->source);
+    g_free(graph->source_pad);
+    g_free(graph->dest);
+    g_free(graph->dest_pad);
+}
+
+static void graph_connect(Graph *graph, gint source, gint source_pad, gint dest, gint dest_pad)
+{
+    gint i = graph->connections++;
+    graph->source[i] = source;
+    graph->source_pad[i] = source_pad;
+    graph->dest[i] = dest;
+    graph->dest_pad[i] = dest_pad;
+}
+
+/* every node feeds the next one */
+static void generate_chain(Graph *graph, GRand *rand)
+{
+    gint i;
+    (void) rand;
+    for (i = 1; i < graph->nodes; i++)
+        graph_connect(graph, i - 1, 0, i, 0);
+}
+
+/* a source feeds one rank of all the other nodes, which all feed one
+ * sink with an input each
+ */
+static void generate_fan(Graph *graph, GRand *rand)
+{
+    gint sink = graph->nodes - 1;
+    gint i;
+    (void) rand;
+    if (sink < 1)
+        return;
+    graph->inpads[sink] = MAX(1, sink - 1);
+    for (i = 1; i < sink; i++)
+    {
+        graph_connect(graph, 0, 0, i, 0);
+        graph_connect(graph, i, 0, sink, i - 1);
+    }
+}
+
+/* every input is fed by a random earlier node */
+static void generate_random(Graph *graph, GRand *rand)
+{
+    gint i, pad;
+    for (i = 1; i < graph->nodes; i++)
+        for (pad = 0; pad < graph->inpads[i]; pad++)
+            graph_connect(graph, g_rand_int_range(rand, 0, i),
+                g_rand_int_range(rand, 0, graph->outpads[i]), i, pad);
+}
+
+/* a square grid where every node feeds the one below and the one to
+ * its right, giving many paths of equal length between two nodes
+ */
+static void generate_lattice(Graph *graph, GRand *rand)
+{
+    gint width = 1;
+    gint i;
+    (void) rand;
+    while (width * width < graph->nodes)
+        width++;
+    for (i = 0; i < graph->nodes; i++)
+    {
+        if (i >= width)
+            graph_connect(graph, i - width, 0, i, 0);
+        if (i % width)
+            graph_connect(graph, i - 1, 1, i, 1);
+    }
+}
+
+/* small random graphs that are not connected to each other */
+static void generate_components(Graph *graph, GRand *rand)
+{
+    gint i, pad;
+    for (i = 0; i < graph->nodes; i++)
+    {
+        gint first = i - i % COMPONENT_NODES;
+        if (i == first)
+            continue;
+        for (pad = 0; pad < graph->inpads[i]; pad++)
+            graph_connect(graph, g_rand_int_range(rand, first, i),
+                g_rand_int_range(rand, 0, graph->outpads[i]), i, pad);
+    }
+}
+
+static const struct
+{
+    const gchar *name;
+    GraphGenerator generate;
+    gint pads;
+} shapes[] =
+{
+    { "chain", generate_chain, 1 },
+    { "fan", generate_fan, 1 },
+    { "random", generate_random, 2 },
+    { "lattice", generate_lattice, 2 },
+    { "components", generate_components, 2 },
+};
+
+static void report(const gchar *shape, Graph *graph, const gchar *operation, gint count, gint64 usecs)
+{
+    printf("%s\t%d\t%d\t%s\t%d\t%.3f\t%.1f\n", shape, graph->nodes, graph->connections,
+        operation, count, usecs / 1000.0, count ? usecs * 1000.0 / count : 0.0);
+    fflush(stdout);
+}
+
+static void bench(const gchar *shape, Graph *graph, GRand *rand)
+{
+    struct GraphLayout *gl = graph_layout_new();
+    gint *handle = g_new(gint, graph->nodes);
+    gint queries = MIN(graph->nodes, MAX_QUERIES);
+    gdouble *qx = g_new(gdouble, queries);
+    gdouble *qy = g_new(gdouble, queries);
+    volatile gint sink = 0;
+    const gdouble *points;
+    gdouble x0, y0, x1, y1;
+    gint64 start;
+    gint connections;
+    gint i;
+
+    /* the default separations of 0 stack all ranks on one line */
+    graph_layout_nodesep_set(gl, NODESEP);
+    graph_layout_ranksep_set(gl, RANKSEP);
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < graph->nodes; i++)
+        handle[i] = graph_layout_node_new(gl);
+    report(shape, graph, "node_new", graph->nodes, g_get_monotonic_time() - start);
+
+    for (i = 0; i < graph->nodes; i++)
+    {
+        graph_layout_node_inpads_set(gl, handle[i], graph->inpads[i]);
+        graph_layout_node_outpads_set(gl, handle[i], graph->outpads[i]);
+    }
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < graph->connections; i++)
+        graph_layout_connection_set(gl, handle[graph->source[i]], graph->source_pad[i],
+            handle[graph->dest[i]], graph->dest_pad[i]);
+    report(shape, graph, "connection_set", graph->connections, g_get_monotonic_time() - start);
+
+    start = g_get_monotonic_time();
+    graph_layout_relayout(gl);
+    report(shape, graph, "relayout", 1, g_get_monotonic_time() - start);
+
+    /* query the centers of random nodes, so every lookup is a hit */
+    for (i = 0; i < queries; i++)
+        graph_layout_node_getpos(gl, handle[g_rand_int_range(rand, 0, graph->nodes)], &qx[i], &qy[i]);
+    start = g_get_monotonic_time();
+    for (i = 0; i < queries; i++)
+        sink += graph_layout_node_resolve(gl, qx[i], qy[i]);
+    report(shape, graph, "node_resolve", queries, g_get_monotonic_time() - start);
+
+    connections = graph_layout_connection_count(gl);
+    start = g_get_monotonic_time();
+    for (i = 0; i < connections; i++)
+    {
+        graph_layout_connection_get_coords(gl, i, &x0, &y0, &x1, &y1);
+        sink += x0 < x1;
+    }
+    report(shape, graph, "connection_get_coords", connections, g_get_monotonic_time() - start);
+
+    /* routes are computed on the first pass and read from the cache
+     * on the second one */
+    start = g_get_monotonic_time();
+    for (i = 0; i < connections; i++)
+        sink += graph_layout_connection_get_route(gl, i, &points);
+    report(shape, graph, "connection_get_route", connections, g_get_monotonic_time() - start);
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < connections; i++)
+        sink += graph_layout_connection_get_route(gl, i, &points);
+    report(shape, graph, "connection_get_route_cached", connections, g_get_monotonic_time() - start);
+
+    /* the force directed layout continues from the ranked one */
+    graph_layout_mode_set(gl, GRAPH_LAYOUT_FORCE);
+    start = g_get_monotonic_time();
+    for (i = 0; i < FORCE_STEPS; i++)
+        sink += graph_layout_force_step(gl, 1);
+    report(shape, graph, "force_step", FORCE_STEPS, g_get_monotonic_time() - start);
+
+    graph_layout_free(gl);
+    g_free(handle);
+    g_free(qx);
+    g_free(qy);
+}
+
+/* The sizes grow tenfold, the last one being the maximum itself, after
+ * which this gives 0. */
+static gint next_size(gint size, gint max)
+{
+    if (size >= max)
+        return 0;
+    return size > max / 10 ? max : size * 10;
+}
+
+static void usage(const gchar *name)
+{
+    guint i;
+    fprintf(stderr, "usage: %s [-n max-nodes] [-s shape] [-r seed]\nshapes:", name);
+    for (i = 0; i < G_N_ELEMENTS(shapes); i++)
+        fprintf(stderr, " %s", shapes[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    gint max_nodes = 1000000;
+    const gchar *only = NULL;
+    guint32 seed = 1;
+    gint nodes;
+    guint i;
+    gint arg;
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (!strcmp(argv[arg], "-n") && arg + 1 < argc)
+            max_nodes = atoi(argv[++arg]);
+        else if (!strcmp(argv[arg], "-s") && arg + 1 < argc)
+            only = argv[++arg];
+        else if (!strcmp(argv[arg], "-r") && arg + 1 < argc)
+            seed = strtoul(argv[++arg], NULL, 10);
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    for (i = 0; only && i < G_N_ELEMENTS(shapes); i++)
+        if (!strcmp(only, shapes[i].name))
+            break;
+    if (i == G_N_ELEMENTS(shapes))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("#shape\tnodes\tconnections\toperation\tcount\ttotal_ms\tns_per_op\n");
+    for (i = 0; i < G_N_ELEMENTS(shapes); i++)
+    {
+        if (only && strcmp(only, shapes[i].name))
+            continue;
+        for (nodes = 100; nodes && nodes <= max_nodes; nodes = next_size(nodes, max_nodes))
+        {
+            GRand *rand = g_rand_new_with_seed(seed);
+            Graph graph;
+
+            graph_init(&graph, nodes, shapes[i].pads);
+            shapes[i].generate(&graph, rand);
+            bench(shapes[i].name, &graph, rand);
+            graph_cleanup(&graph);
+            g_rand_free(rand);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,373 @@
+/**
+ * Benchmark of the libmikado graph model.
+ *
+ * Canvases of 1000 elements up to the maximum, growing tenfold and
+ * ending at the maximum, are filled with elements having one source and
+ * three sinks, every sink fed by a random earlier element, and the time
+ * taken by the main entry points is printed as one tab separated line
+ * per operation:
+ *
+ *   elements connections operation count total_ms ns_per_op
+ *
+ * followed by the memory held by the canvas. The scheduler then
+ * computes every element once, and again after each of a number of
+ * attribute changes, printing how many elements those had to recompute.
+ * A slider going back and forth over a few values is then followed
+ * without and with the output cache. A drag is played at one tick per
+ * millisecond, ten values per tick, printing the longest time a tick
+ * held the caller and how many frames completed. Everything is computed
+ * once more with several workers, printing the speedup over the first
+ * computation and the processor time the workers took, which stays
+ * close to the wall time times the speedup as long as idle workers do
+ * not spin. With the history on, a paste of up to 10000 connected
+ * elements is undone and redone, and the bytes the history takes per
+ * step are printed, for the paste and for single attribute changes.
+ * Last, elements are added through an engine, from this thread as a
+ * main loop would, printing the longest a command took to send. -c
+ * gives the elements some work to do, in rounds of a small loop.
+ *
+ * usage: bench-mikado [-n max-elements] [-r seed] [-w workers] [-c cost]
+ */
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mikado.h"
+
+#define SINKS 3
+#define MAX_QUERIES 100000
+#define TWEAKS 100
+#define PASTE 10000
+
+static guint workers = 0;
+static guint cost = 0;
+
+static void report(gint elements, gint connections, const gchar *operation, gint count, gint64 usecs)
+{
+    printf("%d\t%d\t%s\t%d\t%.3f\t%.1f\n", elements, connections,
+        operation, count, usecs / 1000.0, count ? usecs * 1000.0 / count : 0.0);
+    fflush(stdout);
+}
+
+/* Adds up the inputs and the opacity, the least an element can do. */
+static void process(MikadoCanvas *canvas, MikadoElement element, gpointer *inputs, guint n_inputs,
+    gpointer *outputs, guint n_outputs, gpointer data)
+{
+    gdouble value = mikado_attribute_get_value(canvas, mikado_element_get_attribute(canvas, element, "opacity"));
+    volatile gdouble work = 0.0;
+    guint i;
+
+    (void) data;
+    for (i = 0; i < cost; i++)
+        work += i * 0.5;
+    for (i = 0; i < n_inputs; i++)
+        if (inputs[i])
+            value += *(gdouble *) inputs[i];
+    for (i = 0; i < n_outputs; i++)
+    {
+        outputs[i] = g_new(gdouble, 1);
+        *(gdouble *) outputs[i] = value;
+    }
+}
+
+static gsize output_size(gpointer output, gpointer data)
+{
+    (void) output;
+    (void) data;
+    return sizeof(gdouble);
+}
+
+static void bench_scrub(MikadoScheduler *scheduler, MikadoCanvas *canvas, gint elements, gint connections,
+    MikadoElement element, MikadoPad *source, gboolean cached)
+{
+    MikadoAttribute attribute = mikado_element_get_attribute(canvas, element, "opacity");
+    guint evaluations = mikado_scheduler_get_evaluation_count(scheduler);
+    MikadoCacheStats stats;
+    gint64 start;
+    gint i, j;
+
+    mikado_scheduler_set_cache(scheduler, cached ? 64 << 20 : 0, output_size);
+    start = g_get_monotonic_time();
+    for (i = 0; i < TWEAKS; i++)
+    {
+        mikado_attribute_set_value(canvas, attribute, i % 4);
+        for (j = 0; j < elements; j++)
+            mikado_scheduler_pull(scheduler, source[j]);
+    }
+    report(elements, connections, cached ? "scrub_cached" : "scrub", TWEAKS, g_get_monotonic_time() - start);
+    mikado_scheduler_get_cache_stats(scheduler, &stats);
+    printf("# recomputed: %.1f elements per change, cache: %lu hits %lu misses %lu bytes\n",
+        (mikado_scheduler_get_evaluation_count(scheduler) - evaluations) / (gdouble) TWEAKS,
+        (gulong) stats.hits, (gulong) stats.misses, (gulong) stats.bytes);
+}
+
+static void bench_drag(MikadoScheduler *scheduler, MikadoCanvas *canvas, gint elements, gint connections,
+    MikadoElement element, MikadoPad output)
+{
+    MikadoAttribute attribute = mikado_element_get_attribute(canvas, element, "opacity");
+    MikadoFrameStats stats;
+    gint64 longest = 0;
+    gint64 total = 0;
+    gint i, j;
+
+    mikado_scheduler_set_output(scheduler, output, NULL, NULL);
+    for (i = 0; i < TWEAKS; i++)
+    {
+        gint64 start = g_get_monotonic_time();
+        for (j = 0; j < 10; j++)
+            mikado_scheduler_queue_value(scheduler, attribute, i * 10 + j);
+        mikado_scheduler_tick(scheduler);
+        start = g_get_monotonic_time() - start;
+        longest = MAX(longest, start);
+        total += start;
+        g_usleep(1000);
+    }
+    mikado_scheduler_wait(scheduler);
+    report(elements, connections, "tick", TWEAKS, total);
+    mikado_scheduler_get_frame_stats(scheduler, &stats);
+    printf("# longest tick: %.3f ms, frames: %u completed %u cancelled, %lu of %lu values superseded\n",
+        longest / 1000.0, stats.completed, stats.cancelled, (gulong) stats.superseded, (gulong) stats.values);
+}
+
+static void bench_scheduler(MikadoCanvas *canvas, gint elements, gint connections,
+    MikadoElement *element, MikadoPad *source, GRand *rand)
+{
+    MikadoScheduler *scheduler = mikado_scheduler_new(canvas, process, g_free, NULL);
+    guint evaluations;
+    gint64 serial;
+    gint64 start;
+    clock_t cpu;
+    gint i;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < elements; i++)
+        mikado_scheduler_pull(scheduler, source[i]);
+    serial = g_get_monotonic_time() - start;
+    report(elements, connections, "pull", elements, serial);
+
+    evaluations = mikado_scheduler_get_evaluation_count(scheduler);
+    start = g_get_monotonic_time();
+    for (i = 0; i < TWEAKS; i++)
+    {
+        gint n = g_rand_int_range(rand, 0, elements);
+        mikado_attribute_set_value(canvas, mikado_element_get_attribute(canvas, element[n], "opacity"), i);
+        mikado_scheduler_pull(scheduler, source[elements - 1]);
+    }
+    report(elements, connections, "pull_after_change", TWEAKS, g_get_monotonic_time() - start);
+    printf("# recomputed: %.1f elements per change\n",
+        (mikado_scheduler_get_evaluation_count(scheduler) - evaluations) / (gdouble) TWEAKS);
+
+    bench_scrub(scheduler, canvas, elements, connections, element[elements / 10], source, FALSE);
+    bench_scrub(scheduler, canvas, elements, connections, element[elements / 10], source, TRUE);
+    bench_drag(scheduler, canvas, elements, connections, element[0], source[elements - 1]);
+    mikado_scheduler_free(scheduler);
+
+    scheduler = mikado_scheduler_new(canvas, process, g_free, NULL);
+    mikado_scheduler_set_workers(scheduler, workers);
+    start = g_get_monotonic_time();
+    cpu = clock();
+    mikado_scheduler_pull(scheduler, source[elements - 1]);
+    for (i = 0; i < elements; i++)
+        mikado_scheduler_pull(scheduler, source[i]);
+    cpu = clock() - cpu;
+    start = g_get_monotonic_time() - start;
+    report(elements, connections, "pull_parallel", elements, start);
+    printf("# workers: %u, speedup over pull: %.2f, processor time: %.3f ms\n",
+        mikado_scheduler_get_workers(scheduler), start ? serial / (gdouble) start : 0.0,
+        cpu * 1000.0 / CLOCKS_PER_SEC);
+    mikado_scheduler_free(scheduler);
+}
+
+/* The paste is one step, undone and redone as a whole, which leaves the
+ * canvas as it was. */
+static void bench_history(MikadoCanvas *canvas, gint elements, gint connections,
+    MikadoElement *element, MikadoPad *source, GRand *rand)
+{
+    gint paste = MIN(elements, PASTE);
+    MikadoElement pasted;
+    gsize paste_size;
+    gsize size;
+    gint64 start;
+    gint i, j;
+
+    mikado_canvas_set_history_enabled(canvas, TRUE);
+    start = g_get_monotonic_time();
+    for (i = 0; i < paste; i++)
+    {
+        pasted = mikado_canvas_add_element(canvas);
+        mikado_element_add_source(canvas, pasted);
+        for (j = 0; j < SINKS; j++)
+            mikado_canvas_connect(canvas, source[g_rand_int_range(rand, 0, elements)],
+                mikado_element_add_sink(canvas, pasted));
+        mikado_element_set_attribute(canvas, pasted, "opacity", 1.0);
+        mikado_element_set_position(canvas, pasted, i, i);
+    }
+    mikado_canvas_end_step(canvas);
+    report(elements, connections, "paste", paste, g_get_monotonic_time() - start);
+    paste_size = mikado_canvas_get_history_size(canvas);
+
+    start = g_get_monotonic_time();
+    mikado_canvas_undo(canvas);
+    report(elements, connections, "undo_paste", paste, g_get_monotonic_time() - start);
+    start = g_get_monotonic_time();
+    mikado_canvas_redo(canvas);
+    report(elements, connections, "redo_paste", paste, g_get_monotonic_time() - start);
+
+    size = mikado_canvas_get_history_size(canvas);
+    for (i = 0; i < TWEAKS; i++)
+    {
+        gint n = g_rand_int_range(rand, 0, elements);
+        mikado_attribute_set_value(canvas, mikado_element_get_attribute(canvas, element[n], "opacity"), i + 2);
+        mikado_canvas_end_step(canvas);
+    }
+    printf("# history: %lu bytes for the paste, %.1f per element, %.1f per attribute change\n",
+        (gulong) paste_size, paste_size / (gdouble) paste,
+        (mikado_canvas_get_history_size(canvas) - size) / (gdouble) TWEAKS);
+    while (mikado_canvas_undo(canvas))
+        ;
+    mikado_canvas_set_history_enabled(canvas, FALSE);
+}
+
+/* Every element is sent as a command and waited for as a notification,
+ * retrying when the ring is full. */
+static void bench_engine(gint elements)
+{
+    MikadoEngine *engine = mikado_engine_new(process, NULL, g_free, NULL, NULL);
+    MikadoNotification notification;
+    gint64 longest = 0;
+    gint64 start;
+    gint sent = 0;
+    gint added = 0;
+
+    start = g_get_monotonic_time();
+    while (added < elements)
+    {
+        gint64 send = g_get_monotonic_time();
+        if (sent < elements && mikado_engine_add_element(engine, sent, 0, 0, 1, SINKS))
+            sent++;
+        longest = MAX(longest, g_get_monotonic_time() - send);
+        while (mikado_engine_next_notification(engine, &notification))
+            added++;
+    }
+    report(elements, 0, "engine_add_element", elements, g_get_monotonic_time() - start);
+    printf("# longest send: %.3f ms\n", longest / 1000.0);
+    mikado_engine_free(engine);
+}
+
+static void bench(gint elements, GRand *rand)
+{
+    MikadoCanvas *canvas;
+    MikadoElement *element = g_new(MikadoElement, elements);
+    MikadoPad *source = g_new(MikadoPad, elements);
+    MikadoPad *sink = g_new(MikadoPad, elements * SINKS);
+    gint queries = MIN(elements * SINKS, MAX_QUERIES);
+    MikadoConnection found[16];
+    volatile gint sink_total = 0;
+    gint connections;
+    gint64 start;
+    gint i, j;
+
+    start = g_get_monotonic_time();
+    canvas = mikado_canvas_new();
+    for (i = 0; i < elements; i++)
+    {
+        element[i] = mikado_canvas_add_element(canvas);
+        source[i] = mikado_element_add_source(canvas, element[i]);
+        for (j = 0; j < SINKS; j++)
+            sink[i * SINKS + j] = mikado_element_add_sink(canvas, element[i]);
+        mikado_element_set_attribute(canvas, element[i], "opacity", 1.0);
+    }
+    report(elements, 0, "add_element", elements, g_get_monotonic_time() - start);
+
+    start = g_get_monotonic_time();
+    for (i = 1; i < elements; i++)
+        for (j = 0; j < SINKS; j++)
+            mikado_canvas_connect(canvas, source[g_rand_int_range(rand, 0, i)], sink[i * SINKS + j]);
+    connections = mikado_canvas_get_connection_count(canvas);
+    report(elements, connections, "connect", connections, g_get_monotonic_time() - start);
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < queries; i++)
+    {
+        gint n = g_rand_int_range(rand, SINKS, elements * SINKS);
+        sink_total += mikado_pad_is_connected_with(canvas, sink[n], source[g_rand_int_range(rand, 0, n / SINKS)]);
+    }
+    report(elements, connections, "is_connected_with", queries, g_get_monotonic_time() - start);
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < elements; i++)
+        sink_total += mikado_pad_get_connections(canvas, source[i], found, G_N_ELEMENTS(found));
+    report(elements, connections, "get_connections", elements, g_get_monotonic_time() - start);
+
+    printf("# canvas memory: %lu bytes, %.1f per element\n",
+        (gulong) mikado_canvas_get_memory_size(canvas),
+        mikado_canvas_get_memory_size(canvas) / (gdouble) elements);
+
+    bench_scheduler(canvas, elements, connections, element, source, rand);
+    bench_history(canvas, elements, connections, element, source, rand);
+
+    /* every tenth element, with its connections */
+    start = g_get_monotonic_time();
+    for (i = 0; i < elements; i += 10)
+        mikado_canvas_remove_element(canvas, element[i]);
+    report(elements, connections, "remove_element", (elements + 9) / 10, g_get_monotonic_time() - start);
+
+    start = g_get_monotonic_time();
+    mikado_canvas_free(canvas);
+    report(elements, connections, "canvas_free", 1, g_get_monotonic_time() - start);
+
+    bench_engine(elements);
+
+    g_free(element);
+    g_free(source);
+    g_free(sink);
+}
+
+/* The sizes grow tenfold, the last one being the maximum itself, after
+ * which this gives 0. */
+static gint next_size(gint size, gint max)
+{
+    if (size >= max)
+        return 0;
+    return size > max / 10 ? max : size * 10;
+}
+
+static void usage(const gchar *name)
+{
+    fprintf(stderr, "usage: %s [-n max-elements] [-r seed] [-w workers] [-c cost]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    gint max_elements = 100000;
+    guint32 seed = 1;
+    gint elements;
+    gint arg;
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (!strcmp(argv[arg], "-n") && arg + 1 < argc)
+            max_elements = atoi(argv[++arg]);
+        else if (!strcmp(argv[arg], "-r") && arg + 1 < argc)
+            seed = strtoul(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "-w") && arg + 1 < argc)
+            workers = strtoul(argv[++arg], NULL, 10);
+        else if (!strcmp(argv[arg], "-c") && arg + 1 < argc)
+            cost = strtoul(argv[++arg], NULL, 10);
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    printf("#elements\tconnections\toperation\tcount\ttotal_ms\tns_per_op\n");
+    for (elements = 1000; elements && elements <= max_elements; elements = next_size(elements, max_elements))
+    {
+        GRand *rand = g_rand_new_with_seed(seed);
+        bench(elements, rand);
+        g_rand_free(rand);
+    }
+    return 0;
+}
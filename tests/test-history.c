@@ -0,0 +1,245 @@
+/**
+ * Tests of the undo history of the libmikado canvas: a step undone puts
+ * the canvas back as it was, handles and list orders included, and
+ * redoing it gives the state it had made.
+ */
+#include <glib.h>
+#include <string.h>
+#include "mikado.h"
+
+#define MAX_PADS 8
+
+/* What can be seen of an element through the public API. */
+typedef struct _Snapshot
+{
+    guint elements;
+    guint connections;
+    gboolean valid;
+    MikadoPad sources[MAX_PADS];
+    guint n_sources;
+    MikadoPad sinks[MAX_PADS];
+    guint n_sinks;
+    MikadoConnection links[MAX_PADS][MAX_PADS]; /* of every source, then every sink */
+    guint n_links[MAX_PADS];
+    MikadoAttribute attributes[MAX_PADS];
+    guint n_attributes;
+    gdouble x;
+    gdouble y;
+    gchar *label;
+} Snapshot;
+
+static void snapshot_take(MikadoCanvas *canvas, MikadoElement element, Snapshot *snapshot)
+{
+    guint i;
+
+    memset(snapshot, 0, sizeof(Snapshot));
+    snapshot->elements = mikado_canvas_get_element_count(canvas);
+    snapshot->connections = mikado_canvas_get_connection_count(canvas);
+    snapshot->valid = mikado_element_is_valid(canvas, element);
+    snapshot->n_sources = mikado_element_get_sources(canvas, element, snapshot->sources, MAX_PADS);
+    snapshot->n_sinks = mikado_element_get_sinks(canvas, element, snapshot->sinks, MAX_PADS);
+    g_assert_cmpuint(snapshot->n_sources + snapshot->n_sinks, <=, MAX_PADS);
+    for (i = 0; i < snapshot->n_sources + snapshot->n_sinks; i++)
+    {
+        MikadoPad pad = i < snapshot->n_sources ? snapshot->sources[i] : snapshot->sinks[i - snapshot->n_sources];
+        snapshot->n_links[i] = mikado_pad_get_connections(canvas, pad, snapshot->links[i], MAX_PADS);
+    }
+    snapshot->n_attributes = mikado_element_get_attributes(canvas, element, snapshot->attributes, MAX_PADS);
+    mikado_element_get_position(canvas, element, &snapshot->x, &snapshot->y);
+    snapshot->label = g_strdup(mikado_element_get_label(canvas, element));
+}
+
+static void snapshot_assert_equal(Snapshot *a, Snapshot *b)
+{
+    guint i;
+
+    g_assert_cmpuint(a->elements, ==, b->elements);
+    g_assert_cmpuint(a->connections, ==, b->connections);
+    g_assert_cmpint(a->valid, ==, b->valid);
+    g_assert_cmpuint(a->n_sources, ==, b->n_sources);
+    g_assert_cmpuint(a->n_sinks, ==, b->n_sinks);
+    g_assert_true(memcmp(a->sources, b->sources, sizeof(a->sources)) == 0);
+    g_assert_true(memcmp(a->sinks, b->sinks, sizeof(a->sinks)) == 0);
+    for (i = 0; i < a->n_sources + a->n_sinks; i++)
+    {
+        g_assert_cmpuint(a->n_links[i], ==, b->n_links[i]);
+        g_assert_true(memcmp(a->links[i], b->links[i], sizeof(a->links[i])) == 0);
+    }
+    g_assert_cmpuint(a->n_attributes, ==, b->n_attributes);
+    g_assert_true(memcmp(a->attributes, b->attributes, sizeof(a->attributes)) == 0);
+    g_assert_cmpfloat(a->x, ==, b->x);
+    g_assert_cmpfloat(a->y, ==, b->y);
+    g_assert_cmpstr(a->label, ==, b->label);
+}
+
+static void snapshot_clear(Snapshot *snapshot)
+{
+    g_free(snapshot->label);
+}
+
+static void test_remove_element(void)
+{
+    MikadoCanvas *canvas = mikado_canvas_new();
+    MikadoElement upstream = mikado_canvas_add_element(canvas);
+    MikadoElement element = mikado_canvas_add_element(canvas);
+    MikadoElement downstream = mikado_canvas_add_element(canvas);
+    MikadoPad up = mikado_element_add_source(canvas, upstream);
+    MikadoPad down = mikado_element_add_sink(canvas, downstream);
+    MikadoPad sources[2];
+    MikadoPad sinks[3];
+    Snapshot before, after, now;
+    guint i;
+
+    for (i = 0; i < 2; i++)
+        sources[i] = mikado_element_add_source(canvas, element);
+    for (i = 0; i < 3; i++)
+    {
+        sinks[i] = mikado_element_add_sink(canvas, element);
+        mikado_canvas_connect(canvas, up, sinks[i]);
+    }
+    mikado_canvas_connect(canvas, sources[1], down);
+    mikado_element_set_attribute(canvas, element, "opacity", 0.5);
+    mikado_element_set_attribute(canvas, element, "size", 3.0);
+    mikado_element_set_position(canvas, element, 10, 20);
+    mikado_element_set_label(canvas, element, "blur");
+
+    mikado_canvas_set_history_enabled(canvas, TRUE);
+    snapshot_take(canvas, element, &before);
+    mikado_canvas_remove_element(canvas, element);
+    mikado_canvas_end_step(canvas);
+    snapshot_take(canvas, element, &after);
+    g_assert_false(after.valid);
+    g_assert_cmpuint(after.elements, ==, 2);
+    g_assert_cmpuint(after.connections, ==, 0);
+    g_assert_cmpuint(mikado_canvas_get_undo_count(canvas), ==, 1);
+
+    g_assert_true(mikado_canvas_undo(canvas));
+    snapshot_take(canvas, element, &now);
+    snapshot_assert_equal(&before, &now);
+    snapshot_clear(&now);
+    /* the neighbours got their connections back, in their order */
+    g_assert_true(mikado_pad_is_connected_with(canvas, down, sources[1]));
+    g_assert_cmpuint(mikado_pad_get_connections(canvas, up, NULL, 0), ==, 3);
+    g_assert_false(mikado_canvas_undo(canvas));
+
+    g_assert_true(mikado_canvas_redo(canvas));
+    snapshot_take(canvas, element, &now);
+    snapshot_assert_equal(&after, &now);
+    snapshot_clear(&now);
+    g_assert_false(mikado_canvas_redo(canvas));
+
+    snapshot_clear(&before);
+    snapshot_clear(&after);
+    mikado_canvas_free(canvas);
+}
+
+/* A sink takes one connection: connecting it again removes the one it
+ * had, in the same step. */
+static void test_connect_replacing_connect(void)
+{
+    MikadoCanvas *canvas = mikado_canvas_new();
+    MikadoElement a = mikado_canvas_add_element(canvas);
+    MikadoElement b = mikado_canvas_add_element(canvas);
+    MikadoElement c = mikado_canvas_add_element(canvas);
+    MikadoPad from_a = mikado_element_add_source(canvas, a);
+    MikadoPad from_b = mikado_element_add_source(canvas, b);
+    MikadoPad to = mikado_element_add_sink(canvas, c);
+    MikadoConnection first;
+    MikadoConnection second;
+
+    mikado_canvas_set_history_enabled(canvas, TRUE);
+    first = mikado_canvas_connect(canvas, from_a, to);
+    mikado_canvas_end_step(canvas);
+    second = mikado_canvas_connect(canvas, from_b, to);
+    mikado_canvas_end_step(canvas);
+    g_assert_cmpint(mikado_connection_get_source(canvas, first), ==, 0);
+    g_assert_cmpuint(mikado_canvas_get_connection_count(canvas), ==, 1);
+
+    g_assert_true(mikado_canvas_undo(canvas));
+    g_assert_cmpuint(mikado_canvas_get_connection_count(canvas), ==, 1);
+    g_assert_cmpuint(mikado_pad_get_connections(canvas, to, NULL, 0), ==, 1);
+    g_assert_cmpint(mikado_canvas_get_connection(canvas, from_a, to), ==, first);
+    g_assert_cmpint(mikado_canvas_get_connection(canvas, from_b, to), ==, 0);
+    g_assert_cmpuint(mikado_pad_get_connections(canvas, from_b, NULL, 0), ==, 0);
+
+    g_assert_true(mikado_canvas_redo(canvas));
+    g_assert_cmpuint(mikado_canvas_get_connection_count(canvas), ==, 1);
+    g_assert_cmpint(mikado_canvas_get_connection(canvas, from_b, to), ==, second);
+    g_assert_cmpint(mikado_canvas_get_connection(canvas, from_a, to), ==, 0);
+    g_assert_cmpuint(mikado_pad_get_connections(canvas, from_a, NULL, 0), ==, 0);
+
+    g_assert_true(mikado_canvas_undo(canvas));
+    g_assert_true(mikado_canvas_undo(canvas));
+    g_assert_cmpuint(mikado_canvas_get_connection_count(canvas), ==, 0);
+    g_assert_cmpuint(mikado_pad_get_connections(canvas, to, NULL, 0), ==, 0);
+    mikado_canvas_free(canvas);
+}
+
+static void test_set_label(void)
+{
+    MikadoCanvas *canvas = mikado_canvas_new();
+    MikadoElement element = mikado_canvas_add_element(canvas);
+
+    mikado_canvas_set_history_enabled(canvas, TRUE);
+    mikado_element_set_label(canvas, element, "first");
+    mikado_canvas_end_step(canvas);
+    mikado_element_set_label(canvas, element, "second");
+    mikado_canvas_end_step(canvas);
+
+    g_assert_true(mikado_canvas_undo(canvas));
+    g_assert_cmpstr(mikado_element_get_label(canvas, element), ==, "first");
+    g_assert_true(mikado_canvas_undo(canvas));
+    g_assert_null(mikado_element_get_label(canvas, element));
+    g_assert_true(mikado_canvas_redo(canvas));
+    g_assert_cmpstr(mikado_element_get_label(canvas, element), ==, "first");
+    g_assert_cmpuint(mikado_canvas_get_redo_count(canvas), ==, 1);
+
+    /* a change drops what could be redone */
+    mikado_element_set_label(canvas, element, "third");
+    g_assert_cmpuint(mikado_canvas_get_redo_count(canvas), ==, 0);
+    g_assert_false(mikado_canvas_redo(canvas));
+    g_assert_true(mikado_canvas_undo(canvas));
+    g_assert_cmpstr(mikado_element_get_label(canvas, element), ==, "first");
+    mikado_canvas_free(canvas);
+}
+
+/* Asking for the undo count, as a UI updating its menu would while a
+ * drag goes on, does not split the drag. */
+static void test_undo_count_polled(void)
+{
+    MikadoCanvas *canvas = mikado_canvas_new();
+    MikadoElement element = mikado_canvas_add_element(canvas);
+    gdouble x, y;
+    guint i;
+
+    mikado_canvas_set_history_enabled(canvas, TRUE);
+    g_assert_cmpuint(mikado_canvas_get_undo_count(canvas), ==, 0);
+    for (i = 1; i <= 10; i++)
+    {
+        mikado_element_set_position(canvas, element, i, i);
+        g_assert_cmpuint(mikado_canvas_get_undo_count(canvas), ==, 1);
+    }
+    mikado_element_set_label(canvas, element, "moved");
+    g_assert_cmpuint(mikado_canvas_get_undo_count(canvas), ==, 1);
+    mikado_canvas_end_step(canvas);
+    g_assert_cmpuint(mikado_canvas_get_undo_count(canvas), ==, 1);
+
+    g_assert_true(mikado_canvas_undo(canvas));
+    g_assert_null(mikado_element_get_label(canvas, element));
+    mikado_element_get_position(canvas, element, &x, &y);
+    g_assert_cmpfloat(x, ==, 0.0);
+    g_assert_cmpfloat(y, ==, 0.0);
+    g_assert_cmpuint(mikado_canvas_get_undo_count(canvas), ==, 0);
+    g_assert_cmpuint(mikado_canvas_get_redo_count(canvas), ==, 1);
+    mikado_canvas_free(canvas);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/history/remove-element", test_remove_element);
+    g_test_add_func("/history/connect-replacing-connect", test_connect_replacing_connect);
+    g_test_add_func("/history/set-label", test_set_label);
+    g_test_add_func("/history/undo-count-polled", test_undo_count_polled);
+    return g_test_run();
+}
@@ -0,0 +1,125 @@
+/**
+ * Tests of the record pool behind the libmikado handles: stale handles
+ * are rejected, and released records come back under their handles in
+ * the reverse order of their release.
+ */
+#include <glib.h>
+#include "mikado-pool.h"
+
+typedef struct _Record
+{
+    MikadoPoolItem item;
+    gint value;
+} Record;
+
+static void test_stale_handle(void)
+{
+    MikadoPool pool;
+    gint a, b;
+
+    mikado_pool_init(&pool, sizeof(Record));
+    a = mikado_pool_alloc(&pool);
+    g_assert_cmpint(a, >, 0);
+    g_assert_nonnull(mikado_pool_get(&pool, a));
+    mikado_pool_release(&pool, a);
+    g_assert_null(mikado_pool_get(&pool, a));
+    g_assert_cmpuint(pool.live, ==, 0);
+
+    /* same slot, another generation */
+    b = mikado_pool_alloc(&pool);
+    g_assert_cmpint(b & MIKADO_SLOT_MASK, ==, a & MIKADO_SLOT_MASK);
+    g_assert_cmpint(b, !=, a);
+    g_assert_null(mikado_pool_get(&pool, a));
+    g_assert_nonnull(mikado_pool_get(&pool, b));
+
+    /* releasing a stale handle does nothing */
+    mikado_pool_release(&pool, a);
+    g_assert_nonnull(mikado_pool_get(&pool, b));
+    g_assert_cmpuint(pool.live, ==, 1);
+    g_assert_null(mikado_pool_get(&pool, 0));
+    g_assert_null(mikado_pool_get(&pool, -1));
+    mikado_pool_clear(&pool);
+}
+
+static void test_restore_lifo(void)
+{
+    MikadoPool pool;
+    Record *record;
+    gint a, b;
+
+    mikado_pool_init(&pool, sizeof(Record));
+    a = mikado_pool_alloc(&pool);
+    b = mikado_pool_alloc(&pool);
+    ((Record *) mikado_pool_get(&pool, b))->value = 7;
+    mikado_pool_release(&pool, a);
+    mikado_pool_release(&pool, b);
+
+    /* only the last one released can come back */
+    g_assert_null(mikado_pool_restore(&pool, a));
+    record = mikado_pool_restore(&pool, b);
+    g_assert_nonnull(record);
+    g_assert_cmpint(record->value, ==, 0);
+    g_assert_true(mikado_pool_get(&pool, b) == record);
+    g_assert_null(mikado_pool_restore(&pool, b));
+    g_assert_nonnull(mikado_pool_restore(&pool, a));
+    g_assert_cmpuint(pool.live, ==, 2);
+    mikado_pool_clear(&pool);
+}
+
+/* A record released, its slot given to another one, which is released
+ * in turn: undoing both brings the first back, and the handle of the
+ * second is not given again. */
+static void test_restore_after_reuse(void)
+{
+    MikadoPool pool;
+    gint a, b, c;
+
+    mikado_pool_init(&pool, sizeof(Record));
+    a = mikado_pool_alloc(&pool);
+    mikado_pool_release(&pool, a);
+    b = mikado_pool_alloc(&pool);
+    g_assert_cmpint(b & MIKADO_SLOT_MASK, ==, a & MIKADO_SLOT_MASK);
+    mikado_pool_release(&pool, b);
+    g_assert_nonnull(mikado_pool_restore(&pool, a));
+    g_assert_null(mikado_pool_get(&pool, b));
+    mikado_pool_release(&pool, a);
+    c = mikado_pool_alloc(&pool);
+    g_assert_cmpint(c, !=, a);
+    g_assert_cmpint(c, !=, b);
+    g_assert_null(mikado_pool_get(&pool, a));
+    g_assert_null(mikado_pool_get(&pool, b));
+    mikado_pool_clear(&pool);
+}
+
+/* A slot out of generations is not reused, but its last record can
+ * still come back. */
+static void test_retired_slot(void)
+{
+    MikadoPool pool;
+    gint handle = 0;
+    gint other;
+    guint i;
+
+    mikado_pool_init(&pool, sizeof(Record));
+    for (i = 0; i <= MIKADO_GENERATION_MAX; i++)
+    {
+        handle = mikado_pool_alloc(&pool);
+        g_assert_cmpint(handle & MIKADO_SLOT_MASK, ==, 1);
+        mikado_pool_release(&pool, handle);
+    }
+    other = mikado_pool_alloc(&pool);
+    g_assert_cmpint(other & MIKADO_SLOT_MASK, ==, 2);
+    g_assert_nonnull(mikado_pool_restore(&pool, handle));
+    g_assert_nonnull(mikado_pool_get(&pool, handle));
+    mikado_pool_clear(&pool);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/pool/stale-handle", test_stale_handle);
+    g_test_add_func("/pool/restore-lifo", test_restore_lifo);
+    g_test_add_func("/pool/restore-after-reuse", test_restore_after_reuse);
+    g_test_add_func("/pool/retired-slot", test_retired_slot);
+    return g_test_run();
+}
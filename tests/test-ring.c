@@ -0,0 +1,88 @@
+/**
+ * Tests of the libmikado ring between two threads: every item comes out
+ * once and in order, and the consumer, which only drains the ring when
+ * told an item went into an empty one, is never left with an item nobody
+ * told it about.
+ */
+#include <glib.h>
+#include "mikado-ring.h"
+
+#define ITEMS 1000000
+#define CAPACITY 4
+#define TIMEOUT (G_USEC_PER_SEC * 5)
+
+typedef struct _Shared
+{
+    MikadoRing *ring;
+    GMutex lock;
+    GCond cond;
+    gboolean announced;
+} Shared;
+
+static gpointer produce(gpointer data)
+{
+    Shared *shared = data;
+    guint i;
+
+    for (i = 1; i <= ITEMS; i++)
+    {
+        gboolean was_empty;
+
+        while (!mikado_ring_push(shared->ring, &i, &was_empty))
+            g_thread_yield();
+        if (was_empty)
+        {
+            g_mutex_lock(&shared->lock);
+            shared->announced = TRUE;
+            g_cond_signal(&shared->cond);
+            g_mutex_unlock(&shared->lock);
+        }
+    }
+    return NULL;
+}
+
+static void test_announced(void)
+{
+    Shared shared;
+    GThread *producer;
+    guint expected = 1;
+    guint item;
+
+    shared.ring = mikado_ring_new(sizeof(guint), CAPACITY);
+    g_mutex_init(&shared.lock);
+    g_cond_init(&shared.cond);
+    shared.announced = FALSE;
+    producer = g_thread_new("producer", produce, &shared);
+
+    /* sleeps on an empty ring until told otherwise, as the main loop of
+     * the engine and the idle handler of the UI do */
+    while (expected <= ITEMS)
+    {
+        gint64 end = g_get_monotonic_time() + TIMEOUT;
+
+        g_mutex_lock(&shared.lock);
+        while (!shared.announced)
+            if (!g_cond_wait_until(&shared.cond, &shared.lock, end))
+                break;
+        /* an item left in the ring without a word about it */
+        g_assert_true(shared.announced);
+        shared.announced = FALSE;
+        g_mutex_unlock(&shared.lock);
+
+        while (mikado_ring_pop(shared.ring, &item))
+            g_assert_cmpuint(item, ==, expected++);
+    }
+    g_thread_join(producer);
+    g_assert_cmpuint(mikado_ring_get_length(shared.ring), ==, 0);
+
+    g_cond_clear(&shared.cond);
+    g_mutex_clear(&shared.lock);
+    mikado_ring_free(shared.ring);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/ring/announced", test_announced);
+    return g_test_run();
+}
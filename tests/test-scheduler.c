@@ -0,0 +1,163 @@
+/**
+ * Tests of the libmikado scheduler: a change only evaluates again the
+ * elements downstream of it, and a value that comes back is found in the
+ * cache instead of being computed again.
+ */
+#include <glib.h>
+#include "mikado.h"
+
+/* Workers call the process function from several threads. */
+static GMutex calls_lock;
+
+/* Adds up the inputs and the opacity, counting the calls per element. */
+static void process(MikadoCanvas *canvas, MikadoElement element, gpointer *inputs, guint n_inputs,
+    gpointer *outputs, guint n_outputs, gpointer data)
+{
+    GHashTable *calls = data;
+    gdouble value = mikado_attribute_get_value(canvas, mikado_element_get_attribute(canvas, element, "opacity"));
+    guint i;
+
+    g_mutex_lock(&calls_lock);
+    g_hash_table_insert(calls, GINT_TO_POINTER(element),
+        GUINT_TO_POINTER(GPOINTER_TO_UINT(g_hash_table_lookup(calls, GINT_TO_POINTER(element))) + 1));
+    g_mutex_unlock(&calls_lock);
+    for (i = 0; i < n_inputs; i++)
+        if (inputs[i])
+            value += *(gdouble *) inputs[i];
+    for (i = 0; i < n_outputs; i++)
+    {
+        outputs[i] = g_new(gdouble, 1);
+        *(gdouble *) outputs[i] = value;
+    }
+}
+
+static gsize output_size(gpointer output, gpointer data)
+{
+    (void) output;
+    (void) data;
+    return sizeof(gdouble);
+}
+
+static guint get_calls(GHashTable *calls, MikadoElement element)
+{
+    return GPOINTER_TO_UINT(g_hash_table_lookup(calls, GINT_TO_POINTER(element)));
+}
+
+/* An element with an opacity, a sink when it has an upstream one and a
+ * source; returns the source. */
+static MikadoPad add_element(MikadoCanvas *canvas, MikadoPad upstream, MikadoElement *element)
+{
+    *element = mikado_canvas_add_element(canvas);
+    mikado_element_set_attribute(canvas, *element, "opacity", 1.0);
+    if (upstream)
+        mikado_canvas_connect(canvas, upstream, mikado_element_add_sink(canvas, *element));
+    return mikado_element_add_source(canvas, *element);
+}
+
+/* Two branches, a -> b and c -> d: a change on a leaves c and d alone. */
+static void test_dirty_cone(void)
+{
+    MikadoCanvas *canvas = mikado_canvas_new();
+    GHashTable *calls = g_hash_table_new(g_direct_hash, g_direct_equal);
+    MikadoScheduler *scheduler = mikado_scheduler_new(canvas, process, g_free, calls);
+    MikadoElement a, b, c, d;
+    MikadoPad from_a = add_element(canvas, 0, &a);
+    MikadoPad from_b = add_element(canvas, from_a, &b);
+    MikadoPad from_c = add_element(canvas, 0, &c);
+    MikadoPad from_d = add_element(canvas, from_c, &d);
+
+    g_assert_cmpfloat(*(gdouble *) mikado_scheduler_pull(scheduler, from_b), ==, 2.0);
+    g_assert_cmpfloat(*(gdouble *) mikado_scheduler_pull(scheduler, from_d), ==, 2.0);
+    g_assert_cmpuint(mikado_scheduler_get_evaluation_count(scheduler), ==, 4);
+
+    mikado_attribute_set_value(canvas, mikado_element_get_attribute(canvas, a, "opacity"), 5.0);
+    g_assert_true(mikado_scheduler_is_dirty(scheduler, a));
+    g_assert_true(mikado_scheduler_is_dirty(scheduler, b));
+    g_assert_false(mikado_scheduler_is_dirty(scheduler, c));
+    g_assert_false(mikado_scheduler_is_dirty(scheduler, d));
+
+    g_assert_cmpfloat(*(gdouble *) mikado_scheduler_pull(scheduler, from_b), ==, 6.0);
+    g_assert_cmpfloat(*(gdouble *) mikado_scheduler_pull(scheduler, from_d), ==, 2.0);
+    g_assert_cmpuint(get_calls(calls, a), ==, 2);
+    g_assert_cmpuint(get_calls(calls, b), ==, 2);
+    g_assert_cmpuint(get_calls(calls, c), ==, 1);
+    g_assert_cmpuint(get_calls(calls, d), ==, 1);
+    g_assert_cmpuint(mikado_scheduler_get_evaluation_count(scheduler), ==, 6);
+
+    mikado_scheduler_free(scheduler);
+    mikado_canvas_free(canvas);
+    g_hash_table_destroy(calls);
+}
+
+/* Going back to a value the chain already had is a cache hit. */
+static void test_cache_hit(void)
+{
+    MikadoCanvas *canvas = mikado_canvas_new();
+    GHashTable *calls = g_hash_table_new(g_direct_hash, g_direct_equal);
+    MikadoScheduler *scheduler = mikado_scheduler_new(canvas, process, g_free, calls);
+    MikadoCacheStats stats;
+    MikadoAttribute opacity;
+    MikadoElement a, b;
+    MikadoPad from_a = add_element(canvas, 0, &a);
+    MikadoPad from_b = add_element(canvas, from_a, &b);
+    guint evaluations;
+
+    mikado_scheduler_set_cache(scheduler, 1024, output_size);
+    opacity = mikado_element_get_attribute(canvas, a, "opacity");
+    g_assert_cmpfloat(*(gdouble *) mikado_scheduler_pull(scheduler, from_b), ==, 2.0);
+    mikado_attribute_set_value(canvas, opacity, 3.0);
+    g_assert_cmpfloat(*(gdouble *) mikado_scheduler_pull(scheduler, from_b), ==, 4.0);
+
+    evaluations = mikado_scheduler_get_evaluation_count(scheduler);
+    mikado_attribute_set_value(canvas, opacity, 1.0);
+    g_assert_cmpfloat(*(gdouble *) mikado_scheduler_pull(scheduler, from_b), ==, 2.0);
+    g_assert_cmpuint(get_calls(calls, a), ==, 2);
+    g_assert_cmpuint(get_calls(calls, b), ==, 2);
+    g_assert_cmpuint(mikado_scheduler_get_evaluation_count(scheduler), ==, evaluations);
+    mikado_scheduler_get_cache_stats(scheduler, &stats);
+    g_assert_cmpuint(stats.hits, >, 0);
+    g_assert_cmpuint(stats.entries, >, 0);
+
+    mikado_scheduler_free(scheduler);
+    mikado_canvas_free(canvas);
+    g_hash_table_destroy(calls);
+}
+
+/* A chain leaves all workers but one without anything to do: they wait
+ * for the job to end, and the values are the ones computed serially. */
+static void test_workers_chain(void)
+{
+    MikadoCanvas *canvas = mikado_canvas_new();
+    GHashTable *calls = g_hash_table_new(g_direct_hash, g_direct_equal);
+    MikadoScheduler *scheduler = mikado_scheduler_new(canvas, process, g_free, calls);
+    MikadoElement first = 0;
+    MikadoElement element;
+    MikadoPad pad = 0;
+    guint i;
+
+    for (i = 0; i < 100; i++)
+    {
+        pad = add_element(canvas, pad, &element);
+        if (i == 0)
+            first = element;
+    }
+    mikado_scheduler_set_workers(scheduler, 4);
+    g_assert_cmpfloat(*(gdouble *) mikado_scheduler_pull(scheduler, pad), ==, 100.0);
+    mikado_attribute_set_value(canvas, mikado_element_get_attribute(canvas, first, "opacity"), 2.0);
+    g_assert_cmpfloat(*(gdouble *) mikado_scheduler_pull(scheduler, pad), ==, 101.0);
+    g_assert_cmpuint(mikado_scheduler_get_evaluation_count(scheduler), ==, 200);
+
+    mikado_scheduler_free(scheduler);
+    mikado_canvas_free(canvas);
+    g_hash_table_destroy(calls);
+}
+
+int main(int argc, char *argv[])
+{
+    g_mutex_init(&calls_lock);
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/scheduler/dirty-cone", test_dirty_cone);
+    g_test_add_func("/scheduler/cache-hit", test_cache_hit);
+    g_test_add_func("/scheduler/workers-chain", test_workers_chain);
+    return g_test_run();
+}